@@ -80,6 +80,10 @@
 # include <string.h>
 #endif
 
+#ifdef HAVE_SYSLOG_H
+# include <syslog.h>
+#endif
+
 #include "lsr_priv.h"
 #include "libsecrm.h"
 
@@ -246,13 +250,57 @@ void __lsr_mem_set (
 
 /* =============================================================== */
 
+#if (defined HAVE_GETENV) && (defined HAVE_STDLIB_H) && (defined HAVE_STRTOUL)
+# ifndef LSR_ANSIC
+static void __lsr_read_setting LSR_PARAMS ((const char * const name,
+	void (*setter) LSR_PARAMS ((unsigned long int value))));
+# endif
+
+/**
+ * Reads a numeric setting from the environment and passes it to its setter.
+ * \param name The name of the environment variable.
+ * \param setter The function which sets the value.
+ */
+static void
+__lsr_read_setting (
+# ifdef LSR_ANSIC
+	const char * const name,
+	void (*setter) LSR_PARAMS ((unsigned long int value)))
+# else
+	name, setter)
+	const char * const name;
+	void (*setter) LSR_PARAMS ((unsigned long int value));
+# endif
+{
+	const char * env_value;
+	LSR_MAKE_ERRNO_VAR(err);
+	unsigned long int value;
+
+	env_value = getenv (name);
+	if ( env_value == NULL )
+	{
+		return;
+	}
+	LSR_SET_ERRNO (0);
+	value = strtoul (env_value, NULL, 10);
+	LSR_GET_ERRNO(err);
+# ifdef HAVE_ERRNO_H
+	if ( err == 0 )
+# endif
+	{
+		(*setter) (value);
+	}
+	/* don't do anything if can't be parsed */
+}
+#endif
+
+/* =============================================================== */
+
 int LSR_ATTR ((constructor))
 __lsr_main (LSR_VOID)
 {
 #if (defined HAVE_GETENV) && (defined HAVE_STDLIB_H) && (defined HAVE_STRTOUL)
-	const char * env_niter;
-	LSR_MAKE_ERRNO_VAR(err);
-	unsigned long int passes;
+	const char * env_method;
 #endif
 
 	if ( __lsr_is_initialized == LSR_INIT_STAGE_NOT_INITIALIZED )
@@ -334,20 +382,46 @@ __lsr_main (LSR_VOID)
 		/*srand (0xdeafface);*/
 # endif
 #endif
+		/* now, and not in malloc() */
+		__lsr_seed_random ();
 #if (defined HAVE_GETENV) && (defined HAVE_STDLIB_H) && (defined HAVE_STRTOUL)
-		env_niter = getenv (LSR_ITERATIONS_ENV);
-		if ( env_niter != NULL )
+		env_method = getenv (LSR_METHOD_ENV);
+		if ( env_method != NULL )
 		{
-			LSR_SET_ERRNO (0);
-			passes = strtoul (env_niter, NULL, 10);
-			LSR_GET_ERRNO(err);
-# ifdef HAVE_ERRNO_H
-			if ( err == 0 )
-# endif
+			/* before the iterations, which override
+			   the method's default number of passes */
+			if ( __lsr_set_method (env_method) != 0 )
 			{
-				__lsr_set_npasses (passes);
+# if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+				syslog (LOG_WARNING, "libsecrm: unknown wiping method '%s'"
+					" in %s, using the default", env_method, LSR_METHOD_ENV);
+# endif
+# ifdef LSR_DEBUG
+				fprintf (stderr, "libsecrm: unknown wiping method '%s'\n",
+					env_method);
+				fflush (stderr);
+# endif
 			}
 		}
+		__lsr_read_setting (LSR_ITERATIONS_ENV, &__lsr_set_npasses);
+		__lsr_read_setting (LSR_URING_DEPTH_ENV, &__lsr_set_uring_depth);
+		__lsr_read_setting (LSR_URING_ENV, &__lsr_set_uring);
+		__lsr_read_setting (LSR_DIRECT_IO_ENV, &__lsr_set_direct_io);
+		__lsr_read_setting (LSR_MMAP_ENV, &__lsr_set_mmap);
+		__lsr_read_setting (LSR_SPLICE_ENV, &__lsr_set_splice);
+		__lsr_read_setting (LSR_FALLOC_ZERO_ENV, &__lsr_set_falloc_zero);
+		__lsr_read_setting (LSR_VERIFY_ENV, &__lsr_set_verify);
+		__lsr_read_setting (LSR_THREADS_ENV, &__lsr_set_threads);
+		__lsr_read_setting (LSR_THREAD_THRESHOLD_ENV, &__lsr_set_thread_threshold);
+		__lsr_read_setting (LSR_SYNC_MODE_ENV, &__lsr_set_sync_mode);
+		__lsr_read_setting (LSR_WRITEBACK_WINDOW_ENV, &__lsr_set_writeback_window);
+		__lsr_read_setting (LSR_RATE_BYTES_ENV, &__lsr_set_rate_bytes);
+		__lsr_read_setting (LSR_RATE_IOPS_ENV, &__lsr_set_rate_iops);
+		__lsr_read_setting (LSR_IO_PRESSURE_ENV, &__lsr_set_io_pressure);
+		__lsr_read_setting (LSR_IO_PRIORITY_ENV, &__lsr_set_io_priority);
+		__lsr_read_setting (LSR_COW_POLICY_ENV, &__lsr_set_cow_policy);
+		__lsr_read_setting (LSR_CRYPT_PASSES_ENV, &__lsr_set_crypt_passes);
+		__lsr_read_setting (LSR_CHECKPOINT_BYTES_ENV, &__lsr_set_checkpoint_bytes);
 #endif
 		__lsr_set_internal_function (0);
 		__lsr_is_initialized = LSR_INIT_STAGE_FULLY_INITIALIZED;
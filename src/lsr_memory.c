@@ -166,7 +166,6 @@ malloc (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	void * ret;
-	int selected[LSR_NPAT] = {0};
 
 	__lsr_main ();
 #ifdef LSR_DEBUG
@@ -200,8 +199,8 @@ malloc (
 	ret = (*__lsr_real_malloc_location ()) ( size );
 	if ( ret != NULL )
 	{
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			ret, size, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			ret, size);
 	}
 	return ret;
 }
@@ -221,7 +220,6 @@ posix_memalign (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	int ret;
-	int selected[LSR_NPAT] = {0};
 
 	__lsr_main ();
 #ifdef LSR_DEBUG
@@ -262,8 +260,8 @@ posix_memalign (
 	ret = (*__lsr_real_psx_memalign_loc ()) ( memptr, alignment, size );
 	if ( ret == 0 )
 	{
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			*memptr, size, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			*memptr, size);
 	}
 	return ret;
 }
@@ -281,7 +279,6 @@ valloc (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	void *ret;
-	int selected[LSR_NPAT] = {0};
 
 	__lsr_main ();
 #ifdef LSR_DEBUG
@@ -315,8 +312,8 @@ valloc (
 	ret = (*__lsr_real_valloc_location ()) ( size );
 	if ( ret != NULL )
 	{
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			ret, size, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			ret, size);
 	}
 	return ret;
 }
@@ -336,7 +333,6 @@ pvalloc (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	void *ret;
-	int selected[LSR_NPAT] = {0};
 	size_t to_wipe;
 
 	__lsr_main ();
@@ -383,8 +379,8 @@ pvalloc (
 		to_wipe = size;
 #  endif
 # endif
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			ret, to_wipe, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			ret, to_wipe);
 	}
 	return ret;
 }
@@ -404,7 +400,6 @@ memalign (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	void *ret;
-	int selected[LSR_NPAT] = {0};
 
 	__lsr_main ();
 #ifdef LSR_DEBUG
@@ -438,8 +433,8 @@ memalign (
 	ret = (*__lsr_real_memalign_location ()) ( boundary, size );
 	if ( ret != NULL )
 	{
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			ret, size, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			ret, size);
 	}
 	return ret;
 }
@@ -460,7 +455,6 @@ aligned_alloc (
 {
 	LSR_MAKE_ERRNO_VAR(err);
 	void *ret;
-	int selected[LSR_NPAT] = {0};
 
 	__lsr_main ();
 # ifdef LSR_DEBUG
@@ -494,8 +488,8 @@ aligned_alloc (
 	ret = (*__lsr_real_aligned_alloc_loc ()) ( alignment, size );
 	if ( ret != NULL )
 	{
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-			ret, size, selected);
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+			ret, size);
 	}
 	return ret;
 }
@@ -518,7 +512,6 @@ brk (
 #if (defined LSR_BRK_RETTYPE_IS_POINTER && defined LSR_SBRK_RETTYPE_IS_POINTER) \
 	|| (!defined LSR_BRK_RETTYPE_IS_POINTER)
 	SBRK_RETTYPE top;
-	int selected[LSR_NPAT] = {0};
 #endif
 
 	__lsr_main ();
@@ -573,19 +566,19 @@ brk (
 		ret = (*__lsr_real_brk_location ()) ( end_data_segment );
 		if ( ret != NULL )
 		{
-			__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-				(unsigned char *)top, (size_t) ((char *)ret-(char *)top), selected);
+			__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+				(unsigned char *)top, (size_t) ((char *)ret-(char *)top));
 		}
 	}
 	else
 	{
 		/* deallocation */
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
 			/* NOTE: OpenBSD uses "const char * end_data_segment", but we can't
 			   pass "const" here, because the buffer is indeed modified. This is
 			   not a problem, because the user is freeing this memory anyway. */
 			(unsigned char *)end_data_segment,
-			(size_t) ((char *)top-(const char *)end_data_segment), selected);
+			(size_t) ((char *)top-(const char *)end_data_segment));
 		LSR_SET_ERRNO (err);
 		ret = (*__lsr_real_brk_location ()) ( end_data_segment );
 	}
@@ -607,17 +600,16 @@ brk (
 		ret = (*__lsr_real_brk_location ()) ( end_data_segment );
 		if ( ret == 0 )
 		{
-			__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-				(unsigned char *)top, (size_t) ((const char *)end_data_segment-(char *)top),
-				selected);
+			__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+				(unsigned char *)top, (size_t) ((const char *)end_data_segment-(char *)top));
 		}
 	}
 	else
 	{
 		/* deallocation */
-		__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+		__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
 			(unsigned char *)end_data_segment,
-			(size_t) ((char *)top-(const char *)end_data_segment), selected);
+			(size_t) ((char *)top-(const char *)end_data_segment));
 		LSR_SET_ERRNO (err);
 		ret = (*__lsr_real_brk_location ()) ( end_data_segment );
 	}
@@ -640,11 +632,6 @@ sbrk (
 	LSR_MAKE_ERRNO_VAR(err);
 	SBRK_RETTYPE ret;
 
-#if (defined LSR_SBRK_RETTYPE_IS_POINTER) || \
-	((!defined LSR_SBRK_RETTYPE_IS_POINTER) && (defined LSR_BRK_RETTYPE_IS_POINTER))
-	int selected[LSR_NPAT] = {0};
-#endif
-
 #if (!defined LSR_SBRK_RETTYPE_IS_POINTER) && (defined LSR_BRK_RETTYPE_IS_POINTER)
 	void * top;
 #endif
@@ -686,13 +673,13 @@ sbrk (
 	{
 		if ( increment > 0 )
 		{
-			__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-				(unsigned char *)ret, (size_t) increment, selected);
+			__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+				(unsigned char *)ret, (size_t) increment);
 		}
 		else if ( increment < 0 )
 		{
-			__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-				(unsigned char *)ret-increment, (size_t) (-increment), selected);
+			__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+				(unsigned char *)ret-increment, (size_t) (-increment));
 		}
 	}
 #else /* !LSR_SBRK_RETTYPE_IS_POINTER */
@@ -708,13 +695,13 @@ sbrk (
 		{
 			if ( increment > 0 )
 			{
-				__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-					(unsigned char *)top, (size_t) increment, selected);
+				__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+					(unsigned char *)top, (size_t) increment);
 			}
 			else if ( increment < 0 )
 			{
-				__lsr_fill_buffer ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
-					(unsigned char *)top-increment, (size_t)(-increment), selected);
+				__lsr_fill_buffer_once ((unsigned int) __lsr_rand () % __lsr_get_npasses (),
+					(unsigned char *)top-increment, (size_t)(-increment));
 			}
 		}
 	}
@@ -138,10 +138,13 @@ extern int LSR_ATTR ((nonnull)) renameat LSR_PARAMS ((int old_dir_fd,
 /**
  * Renames the given file using rename() or renameat(). The return value is
  * the "last new name" and MUST be free()d unless *free_new == 0.
+ * The renames are synced unless in_memory is non-zero (the file is on
+ * a filesystem kept in memory, like tmpfs).
  */
 # ifndef LSR_ANSIC
 static char * __lsr_rename LSR_PARAMS((const char * const name,
-	const int use_renameat, const int renameat_fd, int * const free_new));
+	const int use_renameat, const int renameat_fd, const int in_memory,
+	int * const free_new));
 # endif
 
 static char *
@@ -153,12 +156,14 @@ __lsr_rename (
 	const char * const name,
 	const int use_renameat LSR_ONLY_WITH_RENAMEAT,
 	const int renameat_fd LSR_ONLY_WITH_RENAMEAT,
+	const int in_memory,
 	int * const free_new )
 # else
-	name, use_renameat, renameat_fd, free_new )
+	name, use_renameat, renameat_fd, in_memory, free_new )
 	const char * const name;
 	const int use_renameat LSR_ONLY_WITH_RENAMEAT;
 	const int renameat_fd LSR_ONLY_WITH_RENAMEAT;
+	const int in_memory;
 	int * const free_new;
 # endif
 {
@@ -263,7 +268,7 @@ __lsr_rename (
 		}
 
 # if (!defined __STRICT_ANSI__) && (defined HAVE_UNISTD_H)
-		if ( __lsr_get_npasses () > 1 )
+		if ( (__lsr_get_npasses () > 1) && (in_memory == 0) )
 		{
 			sync();
 		}
@@ -289,6 +294,7 @@ unlink (
 # pragma GCC poison unlink
 #endif
 	int free_new;
+	int in_memory = 0;
 	int fd;
 	int res;
 	char *new_name = NULL;
@@ -321,13 +327,14 @@ unlink (
 			fflush (stderr);
 #endif
 			__lsr_fd_truncate ( fd, (off64_t)0 );
+			in_memory = __lsr_fd_in_memory (fd);
 			close (fd);
 		}
 	}
 
 	free_new = 0;
 #ifdef HAVE_MALLOC
-	new_name = __lsr_rename ( name, 0, -1, &free_new );
+	new_name = __lsr_rename ( name, 0, -1, in_memory, &free_new );
 #endif
 
 	if ( new_name == NULL )
@@ -373,6 +380,7 @@ unlinkat (
 # pragma GCC poison unlinkat
 #endif
 	int free_new;
+	int in_memory = 0;
 	int fd;
 	int res = -1;
 	char *new_name = NULL;
@@ -408,6 +416,7 @@ unlinkat (
 #endif
 
 			__lsr_fd_truncate ( fd, (off64_t)0 );
+			in_memory = __lsr_fd_in_memory (fd);
 #ifdef HAVE_UNISTD_H
 			close (fd);
 #endif
@@ -416,7 +425,7 @@ unlinkat (
 
 	free_new = 0;
 #ifdef HAVE_MALLOC
-	new_name = __lsr_rename ( name, 1, dirfd, &free_new );
+	new_name = __lsr_rename ( name, 1, dirfd, in_memory, &free_new );
 #endif
 	if ( new_name == NULL )
 	{
@@ -460,6 +469,7 @@ remove (
 # pragma GCC poison remove
 #endif
 	int free_new;
+	int in_memory = 0;
 	int fd;
 	int res;
 	char *new_name = NULL;
@@ -494,13 +504,14 @@ remove (
 			fflush (stderr);
 #endif
 			__lsr_fd_truncate ( fd, (off64_t)0 );
+			in_memory = __lsr_fd_in_memory (fd);
 			close (fd);
 		}	/* fd >= 0 */
 	} /* __real_open */
 
 	free_new = 0;
 #ifdef HAVE_MALLOC
-	new_name = __lsr_rename ( name, 0, -1, &free_new );
+	new_name = __lsr_rename ( name, 0, -1, in_memory, &free_new );
 #endif
 
 	if ( new_name == NULL )
@@ -544,6 +555,8 @@ rmdir (
 #endif
 
 	int free_new;
+	int in_memory = 0;
+	int fd;
 	int res;
 	char *new_name;
 #ifdef HAVE_SYS_STAT_H
@@ -617,9 +630,20 @@ rmdir (
 		return (*__lsr_real_rmdir_location ()) (name);
 	}
 
+	if ( (__lsr_get_npasses () > 1) && (__lsr_real_open_location () != NULL) )
+	{
+		/* check if the renames will need syncing */
+		fd = (*__lsr_real_open_location ()) (name, O_RDONLY);
+		if ( fd >= 0 )
+		{
+			in_memory = __lsr_fd_in_memory (fd);
+			close (fd);
+		}
+	}
+
 	free_new = 0;
 # ifdef HAVE_MALLOC
-	new_name = __lsr_rename ( name, 0, -1, &free_new );
+	new_name = __lsr_rename ( name, 0, -1, in_memory, &free_new );
 # endif
 
 	if ( new_name == NULL )
@@ -54,6 +54,89 @@
 # include <fcntl.h>
 #endif
 
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>	/* pwritev() */
+#endif
+
+#ifdef HAVE_LIMITS_H
+# include <limits.h>	/* IOV_MAX */
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#ifdef HAVE_SYS_RANDOM_H
+# include <sys/random.h>	/* getrandom() */
+#endif
+
+#if (defined HAVE_IMMINTRIN_H) && ((defined __x86_64__) || (defined __i386__)) \
+	&& ((defined __clang__) || ((defined __GNUC__) && (__GNUC__ >= 5)))
+# include <immintrin.h>	/* the vector kernels filling the buffers */
+#endif
+
+#if (defined HAVE_SYS_IOCTL_H) && (defined HAVE_LINUX_FS_H)
+# include <sys/ioctl.h>
+# include <linux/fs.h>		/* FS_IOC_FIEMAP, FS_IOC_GETFLAGS */
+# ifdef HAVE_LINUX_FIEMAP_H
+#  include <linux/fiemap.h>
+# endif
+#endif
+
+#ifdef HAVE_SYS_VFS_H
+# include <sys/vfs.h>	/* fstatfs() */
+#endif
+
+#ifdef HAVE_SYSLOG_H
+# include <syslog.h>
+#endif
+
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>	/* opendir() for the devices under dm-crypt */
+#endif
+
+#ifdef HAVE_SYS_XATTR_H
+# include <sys/xattr.h>	/* fsetxattr() for the checkpoints */
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>	/* watching the file while writing it directly */
+#endif
+
+#ifdef MAJOR_IN_MKDEV
+# include <sys/mkdev.h>
+#else
+# ifdef MAJOR_IN_SYSMACROS
+#  include <sys/sysmacros.h>
+# endif
+#endif
+
+#ifdef HAVE_LINUX_FALLOC_H
+# include <linux/falloc.h>	/* FALLOC_FL_PUNCH_HOLE, FALLOC_FL_ZERO_RANGE */
+#endif
+
+#if (defined LSR_WANT_IO_URING) && (defined HAVE_LINUX_IO_URING_H) \
+	&& (defined HAVE_SYS_SYSCALL_H) && (defined HAVE_SYS_MMAN_H)
+# include <linux/io_uring.h>
+# include <sys/syscall.h>	/* __NR_io_uring_* */
+#endif
+
+#ifdef HAVE_TIME_H
+# include <time.h>	/* clock_gettime(), nanosleep() for the rate limits */
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>	/* __NR_ioprio_* */
+#endif
+
 #ifdef HAVE_SIGNAL_H
 # include <signal.h>
 # ifndef RETSIGTYPE
@@ -65,6 +148,7 @@ typedef int sig_atomic_t;
 #endif
 
 #include "lsr_priv.h"
+#include "libsecrm.h"	/* LSR_CHECKPOINT_XATTR */
 
 #ifdef __GNUC__
 # ifndef fopen
@@ -98,12 +182,94 @@ enum lsr_method
 	LSR_METHOD_GUTMANN,
 	LSR_METHOD_RANDOM,
 	LSR_METHOD_SCHNEIER,
-	LSR_METHOD_DOD
+	LSR_METHOD_DOD,
+	LSR_METHOD_CLEAR	/* NIST SP 800-88 Clear - one pass of zeros */
+};
+
+/* the method chosen at compile time, can be changed at run time: */
+#ifdef LSR_WANT_RANDOM
+# define LSR_BUILD_METHOD LSR_METHOD_RANDOM
+#else
+# ifdef LSR_WANT_SCHNEIER
+#  define LSR_BUILD_METHOD LSR_METHOD_SCHNEIER
+# else
+#  ifdef LSR_WANT_DOD
+#   define LSR_BUILD_METHOD LSR_METHOD_DOD
+#  else
+#   ifdef LSR_WANT_CLEAR
+#    define LSR_BUILD_METHOD LSR_METHOD_CLEAR
+#   else
+#    define LSR_BUILD_METHOD LSR_METHOD_GUTMANN
+#   endif
+#  endif
+# endif
+#endif
+static enum lsr_method opt_method = LSR_BUILD_METHOD;
+
+enum lsr_sync_mode
+{
+	LSR_SYNC_FSYNC,		/* fsync() after each pass */
+	LSR_SYNC_FDATASYNC,	/* fdatasync() after each pass */
+	LSR_SYNC_RANGE,		/* sync_file_range() after each pass, fdatasync() at the end */
+	LSR_SYNC_END		/* start the writeback after each pass, fsync() at the end */
+};
+
+static enum lsr_sync_mode sync_mode = (enum lsr_sync_mode) LSR_SYNC_MODE;
+/* the amount of the wiped data allowed in the page cache, 0 for no limit: */
+static unsigned long int writeback_window = LSR_WRITEBACK_WINDOW;
+
+/* the limits of the wiping writes per second, 0 for no limit: */
+static unsigned long int rate_bytes = LSR_RATE_BYTES;
+static unsigned long int rate_iops = LSR_RATE_IOPS;
+/* the percentage of time with tasks stalled on I/O above which wiping
+   slows down, 0 to disable the pacing: */
+static unsigned long int io_pressure = LSR_IO_PRESSURE;
+
+enum lsr_io_priority
+{
+	LSR_IOPRIO_KEEP,	/* don't change the I/O priority */
+	LSR_IOPRIO_LOW,		/* the lowest best-effort priority */
+	LSR_IOPRIO_IDLE		/* the idle class: only when the disk isn't used */
+};
+
+static enum lsr_io_priority io_priority = (enum lsr_io_priority) LSR_IO_PRIORITY;
+
+enum lsr_cow_policy
+{
+	LSR_COW_WIPE,		/* wipe as on any other filesystem */
+	LSR_COW_ONE_PASS,	/* wipe with one pass */
+	LSR_COW_NOCOW,		/* mark the file as not copy-on-write, one pass if this fails */
+	LSR_COW_SKIP		/* don't wipe at all */
 };
 
-static enum lsr_method opt_method = LSR_METHOD_GUTMANN;
+static enum lsr_cow_policy cow_policy = (enum lsr_cow_policy) LSR_COW_POLICY;
 
 static unsigned long int npasses = LSR_PASSES;	/* Number of passes (patterns used) */
+/* whether to sync each pass: a single pass is usually not worth it, but
+   the only pass of the Clear method, or of a wipe with fewer passes than
+   usual (encrypted or copy-on-write files), must reach the disk before the
+   file is truncated or deleted: */
+#define LSR_SYNC_PASSES(passes) (((passes) > 1) || (opt_method == LSR_METHOD_CLEAR) \
+	|| ((passes) < npasses))
+/* the number of passes for encrypted files, 0 to wipe them like others: */
+static unsigned long int crypt_passes = LSR_CRYPT_PASSES;
+static unsigned int uring_depth = LSR_URING_DEPTH;	/* io_uring requests in flight */
+static int use_uring = 1;	/* whether to use io_uring, if it's compiled in */
+#ifdef LSR_WANT_DIRECT_IO
+static int direct_io = 1;	/* whether to bypass the page cache */
+#else
+static int direct_io = 0;	/* whether to bypass the page cache */
+#endif
+static int use_mmap = 0;	/* whether to wipe through a memory mapping */
+static int use_splice = 0;	/* whether to wipe by splicing from a pipe */
+static int verify = 0;		/* whether to read the last pass back */
+/* the size of the parts of the passes between the checkpoints, 0 for none */
+static unsigned long int checkpoint_bytes = LSR_CHECKPOINT_BYTES;
+/* whether to zero the regions with fallocate() in the passes with zeros: */
+static int use_falloc_zero = 0;
+static unsigned int wipe_threads = LSR_THREADS;	/* threads wiping one region */
+/* the minimum size of a region to be wiped by many threads: */
+static unsigned long int thread_threshold = LSR_THREAD_THRESHOLD;
 
 /* Taken from `shred' source */
 static const unsigned int patterns_random[] =
@@ -136,11 +302,336 @@ static unsigned int patterns_dod[] =
 	0xFFFFFFFF, 0x000	/* will be filled in later */
 };
 
+static const unsigned int patterns_clear[] =
+{
+	0x000
+};
+
 #ifdef N_BYTES
 # undef N_BYTES
 #endif
 #define N_BYTES	1024
 
+#ifdef N_PAGE_BYTES
+# undef N_PAGE_BYTES
+#endif
+/* 3 pages: a multiple of the pattern length, so the pattern doesn't
+   change its phase between the copies of the buffer. */
+#define N_PAGE_BYTES	(3*4096)
+
+#ifdef N_IOVECS
+# undef N_IOVECS
+#endif
+#if (defined IOV_MAX) && (IOV_MAX < 1024)
+# define N_IOVECS	IOV_MAX
+#else
+# define N_IOVECS	1024
+#endif
+
+#if (defined HAVE_SYS_UIO_H) && ((defined HAVE_PWRITEV) || (defined HAVE_PWRITEV64))
+# define LSR_CAN_USE_PWRITEV 1
+#else
+# undef LSR_CAN_USE_PWRITEV
+#endif
+
+#if (defined HAVE_SYNC_FILE_RANGE) && (defined SYNC_FILE_RANGE_WRITE)
+# define LSR_CAN_USE_SYNC_FILE_RANGE 1
+#else
+# undef LSR_CAN_USE_SYNC_FILE_RANGE
+#endif
+
+#if (defined LSR_CAN_USE_SYNC_FILE_RANGE) && (defined POSIX_FADV_DONTNEED) \
+	&& ((defined HAVE_POSIX_FADVISE) || (defined HAVE_POSIX_FADVISE64))
+# define LSR_CAN_USE_WRITEBACK 1
+# define LSR_ONLY_WITH_WRITEBACK
+#else
+# undef LSR_CAN_USE_WRITEBACK
+# define LSR_ONLY_WITH_WRITEBACK	LSR_ATTR((unused))
+#endif
+
+#if (defined HAVE_PWRITE) || (defined HAVE_PWRITE64)
+# define LSR_CAN_USE_PWRITE 1
+#else
+# undef LSR_CAN_USE_PWRITE
+#endif
+
+#if (defined LSR_WANT_IO_URING) && (defined HAVE_LINUX_IO_URING_H) \
+	&& (defined HAVE_SYS_SYSCALL_H) && (defined HAVE_SYS_MMAN_H) \
+	&& (defined __NR_io_uring_setup) && (defined __NR_io_uring_enter) \
+	&& (defined __NR_io_uring_register) && (defined __GNUC__)
+# define LSR_CAN_USE_IO_URING 1
+#else
+# undef LSR_CAN_USE_IO_URING
+#endif
+
+#ifdef N_URING_BYTES
+# undef N_URING_BYTES
+#endif
+/* The registered io_uring buffer: a whole number of pages and of
+   pattern periods, so that each request starts in the same phase. */
+#define N_URING_BYTES	(16*N_PAGE_BYTES)
+
+#if (defined HAVE_FCNTL_H) && (defined O_DIRECT) && (defined HAVE_SNPRINTF) \
+	&& (defined HAVE_SYS_INOTIFY_H) && (defined HAVE_INOTIFY_INIT1) \
+	&& (defined IN_OPEN)
+# define LSR_CAN_USE_DIRECT_IO 1
+#else
+# undef LSR_CAN_USE_DIRECT_IO
+#endif
+
+#ifdef LSR_DIRECT_ALIGN
+# undef LSR_DIRECT_ALIGN
+#endif
+/* The alignment of offsets, lengths and buffers for direct I/O, enough
+   for the logical block size of the devices in use. */
+#define LSR_DIRECT_ALIGN	4096
+
+#ifdef N_DIRECT_BYTES
+# undef N_DIRECT_BYTES
+#endif
+#define N_DIRECT_BYTES	(64*N_PAGE_BYTES)
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) \
+	&& ((defined MAP_ANONYMOUS) || (defined MAP_ANON))
+# define LSR_CAN_USE_HUGE_PAGES 1
+#else
+# undef LSR_CAN_USE_HUGE_PAGES
+#endif
+
+#ifdef LSR_HUGE_PAGE_SIZE
+# undef LSR_HUGE_PAGE_SIZE
+#endif
+/* The size of a huge page (of a transparent one, too) on most systems. */
+#define LSR_HUGE_PAGE_SIZE	(2*1024*1024)
+
+#ifdef N_HUGE_BYTES
+# undef N_HUGE_BYTES
+#endif
+/* The part of a huge page used as a buffer: a whole number of pattern
+   periods and of LSR_DIRECT_ALIGN blocks. */
+#define N_HUGE_BYTES	((LSR_HUGE_PAGE_SIZE / N_PAGE_BYTES) * N_PAGE_BYTES)
+
+#ifdef LSR_HUGE_MIN_BYTES
+# undef LSR_HUGE_MIN_BYTES
+#endif
+/* The size of regions which get a buffer in a huge page: for smaller ones
+   the page walks don't matter and the memory isn't worth it. */
+#define LSR_HUGE_MIN_BYTES	(64*1024*1024)
+
+#if (defined LSR_CAN_USE_PWRITEV) && (defined HAVE_MALLOC) \
+	&& (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+# define LSR_CAN_USE_THREADS 1
+#else
+# undef LSR_CAN_USE_THREADS
+#endif
+
+#if (defined HAVE_SYS_IOCTL_H) && (defined HAVE_LINUX_FS_H) \
+	&& (defined HAVE_LINUX_FIEMAP_H) && (defined FS_IOC_FIEMAP)
+# define LSR_CAN_USE_FIEMAP 1
+#else
+# undef LSR_CAN_USE_FIEMAP
+#endif
+
+#if (defined SEEK_DATA) && (defined SEEK_HOLE) && (defined HAVE_FCNTL_H) \
+	&& (defined HAVE_MALLOC) && (defined HAVE_SYS_STAT_H) \
+	&& ((defined HAVE_FSTAT64) || (defined HAVE_FSTAT))
+# define LSR_CAN_USE_EXTENTS 1
+#else
+# undef LSR_CAN_USE_EXTENTS
+#endif
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MSYNC) \
+	&& (defined HAVE_SYS_STAT_H) && ((defined HAVE_FSTAT64) || (defined HAVE_FSTAT)) \
+	&& (defined HAVE_MADVISE) && (defined MADV_POPULATE_WRITE)
+# define LSR_CAN_USE_MMAP 1
+#else
+# undef LSR_CAN_USE_MMAP
+#endif
+
+#if (defined HAVE_FCNTL_H) && (defined HAVE_SPLICE) && (defined HAVE_TEE) \
+	&& (defined HAVE_VMSPLICE) && (defined SPLICE_F_GIFT) \
+	&& (defined LSR_CAN_USE_PWRITEV) && (defined HAVE_MALLOC)
+# define LSR_CAN_USE_SPLICE 1
+#else
+# undef LSR_CAN_USE_SPLICE
+#endif
+
+#ifdef LSR_SPLICE_PIPE_BYTES
+# undef LSR_SPLICE_PIPE_BYTES
+#endif
+/* The size of the pipes to ask for (unprivileged processes can get
+   up to 1MB by default). */
+#define LSR_SPLICE_PIPE_BYTES	(1024*1024)
+
+#if ((defined LAST_PASS_ZERO) || (defined ALL_PASSES_ZERO)) \
+	&& ((defined HAVE_FALLOCATE) || (defined HAVE_FALLOCATE64)) \
+	&& (defined FALLOC_FL_KEEP_SIZE) \
+	&& ((defined FALLOC_FL_PUNCH_HOLE) || (defined FALLOC_FL_ZERO_RANGE))
+# define LSR_CAN_FALLOCATE_ZEROS 1
+#else
+# undef LSR_CAN_FALLOCATE_ZEROS
+#endif
+
+#if (defined HAVE_SYS_VFS_H) && (defined HAVE_FSTATFS) \
+	&& (defined HAVE_SYS_STAT_H) && ((defined HAVE_FSTAT64) || (defined HAVE_FSTAT))
+# define LSR_CAN_DETECT_COW 1
+#else
+# undef LSR_CAN_DETECT_COW
+#endif
+
+/* the flags of the files need only the ioctl(), not FIEMAP */
+#if (defined LSR_CAN_DETECT_COW) \
+	&& (defined FS_IOC_GETFLAGS) && (defined FS_IOC_SETFLAGS) \
+	&& (defined FS_NOCOW_FL)
+# define LSR_CAN_SET_NOCOW 1
+#else
+# undef LSR_CAN_SET_NOCOW
+#endif
+
+#if (defined LSR_CAN_DETECT_COW) && (defined HAVE_DIRENT_H) \
+	&& (defined HAVE_SNPRINTF) && (defined major) && (defined minor)
+# define LSR_CAN_DETECT_DM_CRYPT 1
+# define LSR_ONLY_WITH_DM_CRYPT
+#else
+# undef LSR_CAN_DETECT_DM_CRYPT
+# define LSR_ONLY_WITH_DM_CRYPT	LSR_ATTR((unused))
+#endif
+
+#if (defined LSR_CAN_DETECT_COW) \
+	&& (defined FS_IOC_GETFLAGS) && (defined FS_ENCRYPT_FL)
+# define LSR_CAN_DETECT_FSCRYPT 1
+#else
+# undef LSR_CAN_DETECT_FSCRYPT
+#endif
+
+#if (defined HAVE_UNISTD_H) && (defined HAVE_SYS_XATTR_H) \
+	&& (defined HAVE_FGETXATTR) && (defined HAVE_FSETXATTR) \
+	&& (defined HAVE_FREMOVEXATTR) && (defined HAVE_SNPRINTF)
+# define LSR_CAN_CHECKPOINT 1
+# define LSR_ONLY_WITH_CHECKPOINTS
+#else
+# undef LSR_CAN_CHECKPOINT
+# define LSR_ONLY_WITH_CHECKPOINTS	LSR_ATTR((unused))
+#endif
+
+#if (defined HAVE_TIME_H) && (defined HAVE_CLOCK_GETTIME) \
+	&& (defined HAVE_NANOSLEEP) && (defined CLOCK_MONOTONIC)
+# define LSR_CAN_THROTTLE 1
+# define LSR_ONLY_WITH_THROTTLE
+#else
+# undef LSR_CAN_THROTTLE
+# define LSR_ONLY_WITH_THROTTLE	LSR_ATTR((unused))
+#endif
+
+#if (defined LSR_CAN_THROTTLE) && (defined HAVE_SNPRINTF) \
+	&& (defined HAVE_STRING_H)
+# define LSR_CAN_PACE 1
+# define LSR_ONLY_WITH_PACING
+#else
+# undef LSR_CAN_PACE
+# define LSR_ONLY_WITH_PACING	LSR_ATTR((unused))
+#endif
+
+#if (defined HAVE_UNISTD_H) && (defined HAVE_SYS_SYSCALL_H) \
+	&& (defined __NR_gettid) && (defined HAVE_SIGNAL_H) \
+	&& (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__) \
+	&& (defined SA_SIGINFO) && (defined SIGRTMIN) && (defined SIGRTMAX) \
+	&& (defined HAVE_FCNTL_H) && (defined F_SETLEASE) && (defined F_SETOWN_EX) \
+	&& (defined F_GETOWN_EX) && (defined HAVE_DECL_F_SETSIG) && HAVE_DECL_F_SETSIG \
+	&& (defined HAVE_DECL_F_GETSIG) && HAVE_DECL_F_GETSIG \
+	&& (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE) \
+	&& (defined __GNUC__)
+# define LSR_CAN_MANAGE_LEASES 1
+# define LSR_ONLY_WITH_LEASES
+#else
+# undef LSR_CAN_MANAGE_LEASES
+# define LSR_ONLY_WITH_LEASES	LSR_ATTR((unused))
+#endif
+
+#if (defined HAVE_UNISTD_H) && (defined HAVE_SYS_SYSCALL_H) \
+	&& (defined __NR_ioprio_get) && (defined __NR_ioprio_set)
+# define LSR_CAN_SET_IOPRIO 1
+# define LSR_ONLY_WITH_IOPRIO
+#else
+# undef LSR_CAN_SET_IOPRIO
+# define LSR_ONLY_WITH_IOPRIO	LSR_ATTR((unused))
+#endif
+
+/* The size of the paths to the device files in sysfs. */
+#define LSR_SYSFS_PATH_LEN	320
+
+/* The time, in microseconds, for which the rate limits can be exceeded
+   in a burst, and the longest single sleep while waiting for the limits. */
+#define LSR_THROTTLE_BURST_US	100000
+#define LSR_THROTTLE_SLEEP_US	100000
+
+/* The pacing by the I/O pressure: the time between the samples of the
+   pressure, in microseconds, the lowest rate it can slow wiping down to
+   and the rate added after each sample without pressure, in bytes per
+   second, and the number of reads in flight on the device which count
+   as pressure. */
+#define LSR_PACING_INTERVAL_US	100000
+#define LSR_PACING_MIN_RATE	(1024*1024)
+#define LSR_PACING_STEP		(8*1024*1024)
+#define LSR_PACING_READS	4
+
+/* The number of the files which can be wiped at the same time, each with
+   its own lease and cancellation token. */
+#define LSR_MAX_WIPES		128
+
+/* The values for ioprio_set(), from the kernel's ABI. */
+#define LSR_IOPRIO_WHO_PROCESS	1
+#define LSR_IOPRIO_CLASS_SHIFT	13
+#define LSR_IOPRIO_CLASS_BE	2
+#define LSR_IOPRIO_CLASS_IDLE	3
+#define LSR_IOPRIO_BE_LOWEST	7
+
+/* The size of the text of a checkpoint and the version of its format. */
+#define LSR_CHECKPOINT_LEN	128
+#define LSR_CHECKPOINT_VERSION	1
+
+/* The unit of the bad extents found by the verification. */
+#define LSR_VERIFY_SECTOR	512
+/* The number of the bad extents reported for one file. */
+#define LSR_VERIFY_MAX_REPORTS	16
+
+/* The magic numbers of the copy-on-write filesystems (statfs(2)): */
+#define LSR_FS_BTRFS		0x9123683EUL
+#define LSR_FS_BCACHEFS		0xCA451A4EUL
+#define LSR_FS_ZFS		0x2FC12FC1UL
+
+/* The magic numbers of the filesystems kept in memory: */
+#define LSR_FS_TMPFS		0x01021994UL
+#define LSR_FS_RAMFS		0x858458F6UL
+
+#ifdef LSR_CAN_DETECT_COW
+# define LSR_UNUSED_WITHOUT_DEVICES
+#else
+# define LSR_UNUSED_WITHOUT_DEVICES LSR_ATTR ((unused))
+#endif
+
+/* The number of the devices whose filesystem types are remembered. */
+#define LSR_NDEVS		16
+/* The number of extents checked for sharing at once. */
+#define LSR_FIEMAP_EXTENTS	32
+
+/* The sizes of regions worth mapping: big enough for the system calls
+   to matter, small enough not to put pressure on the address space. */
+#ifdef LSR_MMAP_MIN_BYTES
+# undef LSR_MMAP_MIN_BYTES
+#endif
+#define LSR_MMAP_MIN_BYTES	(1024*1024)
+#ifdef LSR_MMAP_MAX_BYTES
+# undef LSR_MMAP_MAX_BYTES
+#endif
+#define LSR_MMAP_MAX_BYTES	(256*1024*1024)
+
+#ifdef N_MMAP_CHUNK
+# undef N_MMAP_CHUNK
+#endif
+/* how much to fill in the mapping between checks for signals */
+#define N_MMAP_CHUNK	(1024*1024)
+
 #ifdef TEST_COMPILE
 # undef LSR_ANSIC
 # if TEST_COMPILE > 1
@@ -227,6 +718,44 @@ __lsr_get_npasses (LSR_VOID)
 
 /* ======================================================= */
 
+#ifndef LSR_ANSIC
+static unsigned long int __lsr_get_default_npasses LSR_PARAMS ((void));
+#endif
+
+/**
+ * Gets the default number of passes of the current method: the number
+ *	chosen at compile time for the compile-time method, the method's own
+ *	default for the others.
+ * \return the default number of passes.
+ */
+static unsigned long int
+__lsr_get_default_npasses (LSR_VOID)
+{
+	if ( opt_method == LSR_BUILD_METHOD )
+	{
+		return LSR_PASSES;
+	}
+	if ( opt_method == LSR_METHOD_RANDOM )
+	{
+		return sizeof (patterns_random)/sizeof (patterns_random[0]) + 3;
+	}
+	else if ( opt_method == LSR_METHOD_SCHNEIER )
+	{
+		return sizeof (patterns_schneier)/sizeof (patterns_schneier[0]) + 5;
+	}
+	else if ( opt_method == LSR_METHOD_DOD )
+	{
+		return sizeof (patterns_dod)/sizeof (patterns_dod[0]) + 1;
+	}
+	else if ( opt_method == LSR_METHOD_CLEAR )
+	{
+		return sizeof (patterns_clear)/sizeof (patterns_clear[0]);
+	}
+	return sizeof (patterns_gutmann)/sizeof (patterns_gutmann[0]) + 9;
+}
+
+/* ======================================================= */
+
 /**
  * Sets the number of passes.
  * \param passes the new number of passes.
@@ -236,7 +765,8 @@ __lsr_set_npasses (unsigned long int passes)
 {
 	if ( passes == 0 )
 	{
-		npasses = LSR_PASSES; /* set default */
+		/* set default */
+		npasses = __lsr_get_default_npasses ();
 	}
 	else
 	{
@@ -246,505 +776,8291 @@ __lsr_set_npasses (unsigned long int passes)
 
 /* ======================================================= */
 
-#ifndef LSR_ANSIC
-static sig_atomic_t __lsr_sig_recvd LSR_PARAMS ((void));
+/**
+ * Sets the wiping method. The number of passes is set to the default
+ *	number of the new method, if the method is changed.
+ * \param name the name of the method: "gutmann", "random", "schneier",
+ *	"dod" or "clear" (or "nist").
+ * \return 0 if the method was set, -1 if the name is not known.
+ */
+int
+__lsr_set_method (
+#ifdef LSR_ANSIC
+	const char * const name)
+#else
+	name)
+	const char * const name;
 #endif
+{
+	enum lsr_method method;
 
-static volatile sig_atomic_t sig_recvd = 0;		/* non-zero after signal received */
+	if ( name == NULL )
+	{
+		return -1;
+	}
+	if ( strcmp (name, "gutmann") == 0 )
+	{
+		method = LSR_METHOD_GUTMANN;
+	}
+	else if ( strcmp (name, "random") == 0 )
+	{
+		method = LSR_METHOD_RANDOM;
+	}
+	else if ( strcmp (name, "schneier") == 0 )
+	{
+		method = LSR_METHOD_SCHNEIER;
+	}
+	else if ( strcmp (name, "dod") == 0 )
+	{
+		method = LSR_METHOD_DOD;
+	}
+	else if ( (strcmp (name, "clear") == 0) || (strcmp (name, "nist") == 0) )
+	{
+		method = LSR_METHOD_CLEAR;
+	}
+	else
+	{
+		return -1;
+	}
+	if ( method != opt_method )
+	{
+		opt_method = method;
+		npasses = __lsr_get_default_npasses ();
+	}
+	return 0;
+}
+
+/* ======================================================= */
 
 /**
- * Tells if a signal was received.
- * \return non-zero after a signal was received.
+ * Sets the number of io_uring requests in flight while wiping.
+ * \param depth the new queue depth.
  */
-static sig_atomic_t
-__lsr_sig_recvd (LSR_VOID)
+void
+__lsr_set_uring_depth (unsigned long int depth)
 {
-	return sig_recvd;
+	if ( (depth == 0) || (depth > 4096) )
+	{
+		uring_depth = LSR_URING_DEPTH; /* set default */
+	}
+	else
+	{
+		uring_depth = (unsigned int) depth;
+	}
 }
 
 /* ======================================================= */
 
 /**
- * Fills the given buffer with one of predefined patterns.
- * \param pat_no Pass number.
- * \param buffer Buffer to be filled.
- * \param buflen Length of the buffer.
- * \param selected array with 0s or 1s telling which patterns are already selected
+ * Sets whether to wipe big files with io_uring, if it's compiled in.
+ * \param enabled non-zero to use io_uring, zero to use the other ways.
  */
 void
-#ifdef LSR_ANSIC
-LSR_ATTR ((nonnull))
-#endif
-__lsr_fill_buffer (
-#ifdef LSR_ANSIC
-		unsigned long int 		pat_no,
-		unsigned char * const 		buffer,
-		const size_t 			buflen,
-		int * const			selected )
-#else
-	pat_no, buffer, buflen, selected )
-	unsigned long int 		pat_no;
-	unsigned char * const 		buffer;
-	const size_t 			buflen;
-	int * const			selected;
-#endif
-		/*@requires notnull buffer @*/ /*@sets *buffer @*/
+__lsr_set_uring (unsigned long int enabled)
+{
+	use_uring = (enabled != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets whether to bypass the page cache when wiping.
+ * \param direct non-zero to use direct I/O, zero to use the page cache.
+ */
+void
+__lsr_set_direct_io (unsigned long int direct)
+{
+	direct_io = (direct != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets whether to wipe large regions by splicing the patterns from a pipe.
+ * \param spliced non-zero to use splice(), zero to use writes.
+ */
+void
+__lsr_set_splice (unsigned long int spliced)
+{
+	use_splice = (spliced != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets whether to zero the regions with fallocate() instead of writing
+ *	the passes with zeros.
+ * \param falloc non-zero to use fallocate(), zero to write the zeros.
+ */
+void
+__lsr_set_falloc_zero (unsigned long int falloc)
+{
+	use_falloc_zero = (falloc != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets whether to wipe medium-sized regions through a memory mapping.
+ * \param mapped non-zero to use memory mappings, zero to use writes.
+ */
+void
+__lsr_set_mmap (unsigned long int mapped)
+{
+	use_mmap = (mapped != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the number of threads wiping one big region.
+ * \param threads the new number of threads.
+ */
+void
+__lsr_set_threads (unsigned long int threads)
+{
+	if ( (threads == 0) || (threads > 256) )
+	{
+		wipe_threads = LSR_THREADS; /* set default */
+	}
+	else
+	{
+		wipe_threads = (unsigned int) threads;
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the minimum size of a region to be wiped by many threads.
+ * \param threshold the new minimum size, in bytes.
+ */
+void
+__lsr_set_thread_threshold (unsigned long int threshold)
+{
+	if ( threshold == 0 )
+	{
+		thread_threshold = LSR_THREAD_THRESHOLD; /* set default */
+	}
+	else
+	{
+		thread_threshold = threshold;
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the way the wiped data is synchronized with the disk.
+ * \param mode the new synchronization mode (0 - fsync() after each pass,
+ *	1 - fdatasync() after each pass, 2 - sync_file_range() after each
+ *	pass and fdatasync() at the end, 3 - one fsync() at the end).
+ */
+void
+__lsr_set_sync_mode (unsigned long int mode)
+{
+	if ( mode > (unsigned long int) LSR_SYNC_END )
+	{
+		sync_mode = (enum lsr_sync_mode) LSR_SYNC_MODE; /* set default */
+	}
+	else
+	{
+		sync_mode = (enum lsr_sync_mode) mode;
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the amount of the wiped data which can be kept in the page cache.
+ * \param window the new amount of data, in bytes (0 means no limit).
+ */
+void
+__lsr_set_writeback_window (unsigned long int window)
+{
+	writeback_window = window;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the maximum number of bytes written per second while wiping.
+ * \param rate the new limit (0 means no limit).
+ */
+void
+__lsr_set_rate_bytes (unsigned long int rate)
+{
+	rate_bytes = rate;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the maximum number of write requests per second while wiping.
+ * \param rate the new limit (0 means no limit).
+ */
+void
+__lsr_set_rate_iops (unsigned long int rate)
+{
+	rate_iops = rate;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the I/O pressure above which wiping slows down.
+ * \param pressure the new threshold, the percentage of time with some tasks
+ *	stalled on I/O (0 disables the pacing).
+ */
+void
+__lsr_set_io_pressure (unsigned long int pressure)
+{
+	if ( pressure > 100 )
+	{
+		pressure = 100;
+	}
+	io_pressure = pressure;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the I/O priority of the wiping thread.
+ * \param priority the new priority (0 - don't change, 1 - the lowest
+ *	best-effort priority, 2 - the idle class).
+ */
+void
+__lsr_set_io_priority (unsigned long int priority)
+{
+	if ( priority > (unsigned long int) LSR_IOPRIO_IDLE )
+	{
+		io_priority = (enum lsr_io_priority) LSR_IO_PRIORITY; /* set default */
+	}
+	else
+	{
+		io_priority = (enum lsr_io_priority) priority;
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Sets what to do with the files on copy-on-write filesystems.
+ * \param policy the new policy (0 - wipe normally, 1 - wipe with one pass,
+ *	2 - mark the file as not copy-on-write, 3 - don't wipe).
+ */
+void
+__lsr_set_cow_policy (unsigned long int policy)
+{
+	if ( policy > (unsigned long int) LSR_COW_SKIP )
+	{
+		cow_policy = (enum lsr_cow_policy) LSR_COW_POLICY; /* set default */
+	}
+	else
+	{
+		cow_policy = (enum lsr_cow_policy) policy;
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Sets whether to read the wiped data back and check it after the last pass.
+ * \param verified non-zero to check the wiped data.
+ */
+void
+__lsr_set_verify (unsigned long int verified)
+{
+	verify = (verified != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the number of passes for the encrypted files.
+ * \param passes the new number of passes, 0 to wipe them like other files.
+ */
+void
+__lsr_set_crypt_passes (unsigned long int passes)
+{
+	crypt_passes = passes;
+}
+
+/* ======================================================= */
+
+/**
+ * Sets the size of the parts of the passes after which the progress
+ *	of wiping big files is saved.
+ * \param bytes the new size in bytes, 0 to save no progress.
+ */
+void
+__lsr_set_checkpoint_bytes (unsigned long int bytes)
+{
+	if ( (bytes != 0) && (bytes < LSR_BUF_SIZE) )
+	{
+		/* smaller parts wouldn't go through the fast ways of wiping */
+		bytes = LSR_BUF_SIZE;
+	}
+	checkpoint_bytes = bytes;
+}
+
+/* ======================================================= */
+
+/* The cancellation token of a wipe: the descriptor of the file being wiped
+   (-1 for a free token) and the signal which has cancelled the wipe (0 if
+   none). The tokens are kept in a table, so that the signal handler can
+   find them without locking. */
+struct lsr_wipe_token
+{
+	volatile sig_atomic_t fd;
+	volatile sig_atomic_t cancelled;
+};
+
+#ifdef LSR_CAN_MANAGE_LEASES
+static struct lsr_wipe_token wipe_tokens[LSR_MAX_WIPES];
+static pthread_mutex_t wipe_tokens_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the token of the wipe done by the current thread, NULL if none: */
+static __thread struct lsr_wipe_token * wipe_token = NULL;
+#else
+static volatile sig_atomic_t sig_recvd = 0;		/* non-zero after signal received */
+#endif
+
+#ifndef LSR_ANSIC
+static sig_atomic_t __lsr_sig_recvd LSR_PARAMS ((void));
+#endif
+
+/**
+ * Tells if the current wipe has been cancelled by a signal.
+ * \return non-zero after a signal was received.
+ */
+static sig_atomic_t
+__lsr_sig_recvd (LSR_VOID)
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	return (wipe_token != NULL) ? wipe_token->cancelled : 0;
+#else
+	return sig_recvd;
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static struct lsr_wipe_token * __lsr_get_wipe_token LSR_PARAMS ((void));
+#endif
+
+/**
+ * Gets the cancellation token of the wipe done by the current thread.
+ * \return the token, NULL if none.
+ */
+static struct lsr_wipe_token *
+__lsr_get_wipe_token (LSR_VOID)
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	return wipe_token;
+#else
+	return NULL;
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_set_wipe_token LSR_PARAMS ((
+	struct lsr_wipe_token * const token));
+#endif
+
+/**
+ * Makes the current thread take part in the wipe with the given
+ *	cancellation token (e.g. a thread writing a part of the wipe).
+ * \param token The token of the wipe, NULL if none.
+ */
+static void
+__lsr_set_wipe_token (
+#ifdef LSR_ANSIC
+	struct lsr_wipe_token * const token LSR_ONLY_WITH_LEASES)
+#else
+	token)
+	struct lsr_wipe_token * const token LSR_ONLY_WITH_LEASES;
+#endif
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	wipe_token = token;
+#endif
+}
+
+/* ======================================================= */
+
+#if (defined LSR_CAN_CHECKPOINT) || (defined LSR_CAN_PACE)
+# ifndef LSR_ANSIC
+static int __lsr_parse_number LSR_PARAMS ((const char ** const text,
+	off64_t * const value));
+# endif
+
+/**
+ * Reads the next decimal number of a text, after any spaces.
+ * \param text The text to read, moved after the number.
+ * \param value The place for the number.
+ * \return 0 if a number was read, -1 otherwise.
+ */
+static int
+__lsr_parse_number (
+# ifdef LSR_ANSIC
+	const char ** const text, off64_t * const value)
+# else
+	text, value)
+	const char ** const text;
+	off64_t * const value;
+# endif
+{
+	const char * p = *text;
+
+	while ( *p == ' ' )
+	{
+		p++;
+	}
+	if ( (*p < '0') || (*p > '9') )
+	{
+		return -1;
+	}
+	*value = 0;
+	while ( (*p >= '0') && (*p <= '9') )
+	{
+		if ( *value > (off64_t) (((unsigned long long int) 1 << 62) / 10) )
+		{
+			return -1;
+		}
+		*value = *value * 10 + (*p - '0');
+		p++;
+	}
+	*text = p;
+	return 0;
+}
+#endif /* LSR_CAN_CHECKPOINT || LSR_CAN_PACE */
+
+/* ======================================================= */
+
+#ifdef LSR_CAN_THROTTLE
+/* The token buckets of the rate limits, in millionths of a byte and of
+   a write request, and the time of their last refill, in microseconds.
+   The buckets are shared by all the wiping threads and go below zero when
+   a write is bigger than what's left - the writer then waits for the debt
+   to be paid back. */
+static off64_t throttle_bytes = 0;
+static off64_t throttle_ops = 0;
+static off64_t throttle_last = 0;
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+static pthread_mutex_t throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+# endif
+
+# ifndef LSR_ANSIC
+static off64_t __lsr_bucket_take LSR_PARAMS ((off64_t * const tokens,
+	const unsigned long int rate, const off64_t elapsed,
+	const off64_t amount));
+# endif
+
+/**
+ * Refills the given token bucket and takes the given amount from it.
+ * \param tokens The tokens in the bucket, in millionths of the unit.
+ * \param rate The refill rate in units per second, 0 for no limit.
+ * \param elapsed The time since the last refill, in microseconds.
+ * \param amount The number of units to take.
+ * \return the time to wait for the bucket to be refilled, in microseconds.
+ */
+static off64_t
+__lsr_bucket_take (
+# ifdef LSR_ANSIC
+	off64_t * const tokens, const unsigned long int rate,
+	const off64_t elapsed, const off64_t amount)
+# else
+	tokens, rate, elapsed, amount)
+	off64_t * const tokens;
+	const unsigned long int rate;
+	const off64_t elapsed;
+	const off64_t amount;
+# endif
+{
+	off64_t full;
+
+	if ( rate == 0 )
+	{
+		return 0;
+	}
+	/* the bucket holds the budget of a short burst */
+	full = (off64_t) rate * LSR_THROTTLE_BURST_US;
+	if ( elapsed >= (full - *tokens) / (off64_t) rate )
+	{
+		*tokens = full;
+	}
+	else
+	{
+		*tokens += (off64_t) rate * elapsed;
+	}
+	*tokens -= amount * 1000000;
+	if ( *tokens >= 0 )
+	{
+		return 0;
+	}
+	return (-*tokens + (off64_t) rate - 1) / (off64_t) rate;
+}
+
+# ifdef LSR_CAN_PACE
+/* The pacing by the I/O pressure, guarded by throttle_lock like the buckets:
+   the current limit of the written bytes per second (0 while the pressure
+   doesn't limit wiping), the time of the last sample, the stall time
+   reported by the kernel then (-1 if unknown), the number of bytes written
+   since then and the device being wiped. */
+static unsigned long int pace_rate = 0;
+static off64_t pace_last = 0;
+static off64_t pace_stalled = -1;
+static off64_t pace_bytes = 0;
+static dev_t pace_dev = 0;
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static int __lsr_read_first_line LSR_PARAMS ((const char * const path,
+	char * const line, const int len));
+#  endif
+
+/**
+ * Reads the first line of the given file, e.g. from procfs or sysfs.
+ * \param path The path to the file.
+ * \param line The place for the line.
+ * \param len The size of the place for the line.
+ * \return 0 if the line was read, -1 otherwise.
+ */
+static int
+__lsr_read_first_line (
+#  ifdef LSR_ANSIC
+	const char * const path, char * const line, const int len)
+#  else
+	path, line, len)
+	const char * const path;
+	char * const line;
+	const int len;
+#  endif
+{
+	FILE * fp;
+	int res = -1;
+
+	if ( __lsr_real_fopen_location () == NULL )
+	{
+		return -1;
+	}
+	fp = (*__lsr_real_fopen_location ()) (path, "r");
+	if ( fp == NULL )
+	{
+		return -1;
+	}
+	if ( fgets (line, len, fp) != NULL )
+	{
+		res = 0;
+	}
+	fclose (fp);
+	return res;
+}
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static off64_t __lsr_pace_reads LSR_PARAMS ((const dev_t dev));
+#  endif
+
+/**
+ * Gets the number of the reads in flight on the given block device,
+ *	which are likely waiting behind the wiping writes.
+ * \param dev The device.
+ * \return the number of the reads, -1 if it's unknown.
+ */
+static off64_t
+__lsr_pace_reads (
+#  ifdef LSR_ANSIC
+	const dev_t dev)
+#  else
+	dev)
+	const dev_t dev;
+#  endif
+{
+	char path[LSR_SYSFS_PATH_LEN];
+	char line[LSR_SYSFS_PATH_LEN];
+	const char * p = line;
+	off64_t reads;
+
+	/* "<reads> <writes>" */
+	snprintf (path, sizeof (path), "/sys/dev/block/%u:%u/inflight",
+		major (dev), minor (dev));
+	path[sizeof (path) - 1] = '\0';
+	if ( (__lsr_read_first_line (path, line, sizeof (line)) != 0)
+		|| (__lsr_parse_number (&p, &reads) != 0) )
+	{
+		return -1;
+	}
+	return reads;
+}
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static void __lsr_pace_update LSR_PARAMS ((const off64_t now_us));
+#  endif
+
+/**
+ * Samples the I/O pressure once in a while and adapts the pace of wiping
+ *	to it: halves the pace when the pressure exceeds the threshold and
+ *	raises it by a constant step otherwise. Called with throttle_lock held.
+ * \param now_us The current time, in microseconds.
+ */
+static void
+__lsr_pace_update (
+#  ifdef LSR_ANSIC
+	const off64_t now_us)
+#  else
+	now_us)
+	const off64_t now_us;
+#  endif
+{
+	off64_t elapsed = now_us - pace_last;
+	off64_t stalled;
+	off64_t achieved;
+	int pressed = 0;
+
+	if ( elapsed < LSR_PACING_INTERVAL_US )
+	{
+		return;
+	}
+	stalled = __lsr_pace_stalled ("/proc/pressure/io");
+	if ( elapsed <= 10 * LSR_PACING_INTERVAL_US )
+	{
+		if ( (stalled >= 0) && (pace_stalled >= 0)
+			&& ((stalled - pace_stalled) * 100
+				>= (off64_t) io_pressure * elapsed) )
+		{
+			pressed = 1;
+		}
+		if ( __lsr_pace_reads (pace_dev) >= LSR_PACING_READS )
+		{
+			pressed = 1;
+		}
+		achieved = pace_bytes * 1000000 / elapsed;
+		pace_rate = __lsr_pace_adapt (pace_rate, achieved, pressed, rate_bytes);
+	}
+	/* else: nothing was written for a while - just start a new sample */
+	pace_last = now_us;
+	pace_stalled = stalled;
+	pace_bytes = 0;
+}
+# endif /* LSR_CAN_PACE */
+#endif /* LSR_CAN_THROTTLE */
+
+/* ======================================================= */
+
+/**
+ * Gets the total time during which some tasks were stalled on I/O,
+ *	from the kernel's pressure stall information (PSI).
+ * \param path The file with the information, like "/proc/pressure/io".
+ * \return the time in microseconds, -1 if it's unknown, -2 if this
+ *	can't be checked on this system.
+ */
+off64_t
+__lsr_pace_stalled (
+#ifdef LSR_ANSIC
+	const char * const path LSR_ONLY_WITH_PACING)
+#else
+	path)
+	const char * const path LSR_ONLY_WITH_PACING;
+#endif
+{
+#ifdef LSR_CAN_PACE
+	char line[LSR_SYSFS_PATH_LEN];
+	const char * total;
+	off64_t stalled;
+
+	/* "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345" */
+	if ( (path == NULL)
+		|| (__lsr_read_first_line (path, line, sizeof (line)) != 0)
+		|| (strncmp (line, "some ", 5) != 0) )
+	{
+		return -1;
+	}
+	total = strstr (line, "total=");
+	if ( total == NULL )
+	{
+		return -1;
+	}
+	total += 6;
+	if ( __lsr_parse_number (&total, &stalled) != 0 )
+	{
+		return -1;
+	}
+	return stalled;
+#else
+	return -2;
+#endif
+}
+
+/* ======================================================= */
+
+/**
+ * Computes the pace of wiping after a sample of the I/O pressure: halves
+ *	it when the pressure exceeds the threshold and raises it by a constant
+ *	step otherwise, until the pressure doesn't limit wiping anymore.
+ * \param rate The pace so far, in bytes per second, 0 if the pressure
+ *	hasn't limited wiping.
+ * \param achieved The rate really achieved during the sample.
+ * \param pressed Non-zero if the pressure has exceeded the threshold.
+ * \param limit The static limit of the rate, 0 if none.
+ * \return the new pace, 0 if the pressure doesn't limit wiping.
+ */
+unsigned long int
+__lsr_pace_adapt (
+#ifdef LSR_ANSIC
+	unsigned long int rate, const off64_t achieved, const int pressed,
+	const unsigned long int limit)
+#else
+	rate, achieved, pressed, limit)
+	unsigned long int rate;
+	const off64_t achieved;
+	const int pressed;
+	const unsigned long int limit;
+#endif
+{
+	if ( pressed != 0 )
+	{
+		/* back off multiplicatively, from what's really written */
+		if ( (rate == 0) || ((off64_t) rate > achieved) )
+		{
+			rate = (unsigned long int) achieved;
+		}
+		rate /= 2;
+		if ( rate < LSR_PACING_MIN_RATE )
+		{
+			rate = LSR_PACING_MIN_RATE;
+		}
+	}
+	else if ( rate != 0 )
+	{
+		/* probe for the free capacity additively */
+		rate += LSR_PACING_STEP;
+		if ( ((limit != 0) && (rate >= limit)) || (rate < LSR_PACING_STEP) )
+		{
+			/* the static limit, if any, is low enough */
+			rate = 0;
+		}
+	}
+	return rate;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_throttle LSR_PARAMS ((const size_t bytes));
+#endif
+
+/**
+ * Waits, if needed, before writing the given number of bytes, so that
+ *	the wiping doesn't exceed the configured rate limits and the pace
+ *	set by the I/O pressure.
+ * \param bytes The number of bytes about to be written in one request.
+ */
+static void
+__lsr_throttle (
+#ifdef LSR_ANSIC
+	const size_t bytes LSR_ONLY_WITH_THROTTLE)
+#else
+	bytes)
+	const size_t bytes LSR_ONLY_WITH_THROTTLE;
+#endif
+{
+#ifdef LSR_CAN_THROTTLE
+	struct timespec now;
+	struct timespec pause;
+	off64_t now_us;
+	off64_t wait_us;
+	off64_t wait_ops;
+	off64_t slice;
+	unsigned long int byte_rate = rate_bytes;
+
+	if ( (rate_bytes == 0) && (rate_iops == 0) && (io_pressure == 0) )
+	{
+		return;
+	}
+	if ( clock_gettime (CLOCK_MONOTONIC, &now) != 0 )
+	{
+		return;
+	}
+	now_us = (off64_t) now.tv_sec * 1000000 + (off64_t) (now.tv_nsec / 1000);
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_mutex_lock (&throttle_lock);
+# endif
+# ifdef LSR_CAN_PACE
+	if ( io_pressure != 0 )
+	{
+		pace_bytes += (off64_t) bytes;
+		__lsr_pace_update (now_us);
+		if ( (pace_rate != 0) && ((byte_rate == 0) || (pace_rate < byte_rate)) )
+		{
+			byte_rate = pace_rate;
+		}
+	}
+# endif
+	wait_us = __lsr_bucket_take (&throttle_bytes, byte_rate,
+		now_us - throttle_last, (off64_t) bytes);
+	wait_ops = __lsr_bucket_take (&throttle_ops, rate_iops,
+		now_us - throttle_last, 1);
+	throttle_last = now_us;
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_mutex_unlock (&throttle_lock);
+# endif
+	if ( wait_ops > wait_us )
+	{
+		wait_us = wait_ops;
+	}
+	/* sleep in slices, to notice the signals */
+	while ( (wait_us > 0) && (__lsr_sig_recvd () == 0) )
+	{
+		slice = (wait_us < LSR_THROTTLE_SLEEP_US) ? wait_us : LSR_THROTTLE_SLEEP_US;
+		pause.tv_sec = 0;
+		pause.tv_nsec = (long int) (slice * 1000);
+		nanosleep (&pause, NULL);
+		wait_us -= slice;
+	}
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_pace_device LSR_PARAMS ((const dev_t dev));
+#endif
+
+/**
+ * Selects the block device whose reads in flight are watched by the pacing.
+ * \param dev The device with the file being wiped.
+ */
+static void
+__lsr_pace_device (
+#ifdef LSR_ANSIC
+	const dev_t dev LSR_ONLY_WITH_PACING)
+#else
+	dev)
+	const dev_t dev LSR_ONLY_WITH_PACING;
+#endif
+{
+#ifdef LSR_CAN_PACE
+	if ( io_pressure == 0 )
+	{
+		return;
+	}
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_mutex_lock (&throttle_lock);
+# endif
+	pace_dev = dev;
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_mutex_unlock (&throttle_lock);
+# endif
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static int __lsr_lower_io_priority LSR_PARAMS ((void));
+#endif
+
+/**
+ * Lowers the I/O priority of the calling thread for the time of wiping,
+ *	as configured. The threads created while wiping inherit it.
+ * \return the previous I/O priority, to be restored, or -1 if it
+ *	hasn't been changed.
+ */
+static int
+__lsr_lower_io_priority (LSR_VOID)
+{
+#ifdef LSR_CAN_SET_IOPRIO
+	long int old_prio;
+	long int new_prio;
+
+	if ( io_priority == LSR_IOPRIO_KEEP )
+	{
+		return -1;
+	}
+	old_prio = syscall (__NR_ioprio_get, LSR_IOPRIO_WHO_PROCESS, 0);
+	if ( (old_prio < 0)
+		|| ((old_prio >> LSR_IOPRIO_CLASS_SHIFT) == LSR_IOPRIO_CLASS_IDLE) )
+	{
+		/* unknown or already the lowest */
+		return -1;
+	}
+	if ( io_priority == LSR_IOPRIO_IDLE )
+	{
+		new_prio = (long int) LSR_IOPRIO_CLASS_IDLE << LSR_IOPRIO_CLASS_SHIFT;
+	}
+	else
+	{
+		new_prio = ((long int) LSR_IOPRIO_CLASS_BE << LSR_IOPRIO_CLASS_SHIFT)
+			| LSR_IOPRIO_BE_LOWEST;
+		if ( old_prio == new_prio )
+		{
+			return -1;
+		}
+	}
+	if ( syscall (__NR_ioprio_set, LSR_IOPRIO_WHO_PROCESS, 0, new_prio) != 0 )
+	{
+		return -1;
+	}
+	return (int) old_prio;
+#else
+	return -1;
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_restore_io_priority LSR_PARAMS ((const int old_prio));
+#endif
+
+/**
+ * Restores the I/O priority of the calling thread after wiping.
+ * \param old_prio The priority returned by __lsr_lower_io_priority().
+ */
+static void
+__lsr_restore_io_priority (
+#ifdef LSR_ANSIC
+	const int old_prio LSR_ONLY_WITH_IOPRIO)
+#else
+	old_prio)
+	const int old_prio LSR_ONLY_WITH_IOPRIO;
+#endif
+{
+#ifdef LSR_CAN_SET_IOPRIO
+	if ( old_prio < 0 )
+	{
+		return;
+	}
+	if ( syscall (__NR_ioprio_set, LSR_IOPRIO_WHO_PROCESS, 0, old_prio) != 0 )
+	{
+		/* e.g. the default priority, reported with a level - go back
+		   to the default */
+		syscall (__NR_ioprio_set, LSR_IOPRIO_WHO_PROCESS, 0, 0);
+	}
+#endif
+}
+
+/* ======================================================= */
+
+/* The ChaCha20 stream cipher, used as the source of data for the random
+   passes. The key is drawn once per process by the library's constructor
+   (and again in its children), each random pass gets its own stream (the
+   nonce) and the block counter is the offset in the file, so any part of
+   a pass can be generated independently of the others. */
+
+#ifdef HAVE_STDINT_H
+typedef uint32_t lsr_u32;
+#else
+typedef unsigned int lsr_u32;
+#endif
+
+#define LSR_U32(x) ((lsr_u32)(x) & 0xFFFFFFFFU)
+#define LSR_ROTL32(v, n) LSR_U32 (((v) << (n)) | (LSR_U32 (v) >> (32 - (n))))
+
+/* The number of blocks computed at once. The blocks are computed by plain
+   scalar C code, but interleaving a few independent blocks lets the
+   processor overlap their rounds (and lets the compiler use vector
+   registers for them, if it can). */
+#define LSR_CHACHA_LANES	4
+#define LSR_CHACHA_BLOCK	64
+
+static lsr_u32 chacha_key[8];
+
+#ifndef ALL_PASSES_ZERO
+static unsigned long int chacha_streams = 0;	/* the number of the random streams started */
+static int chacha_seeded = 0;	/* 0 - no key, 1 - a fallback key, 2 - a drawn key */
+
+# ifndef LSR_ANSIC
+static void __lsr_chacha_draw_key LSR_PARAMS ((void));
+# endif
+
+/**
+ * Draws a new ChaCha20 key for the random passes.
+ */
+static void
+__lsr_chacha_draw_key (LSR_VOID)
+{
+	unsigned char seed[sizeof (chacha_key)];
+	size_t got = 0;
+	size_t i;
+# if (defined HAVE_SYS_RANDOM_H) && (defined HAVE_GETRANDOM)
+	ssize_t res;
+# endif
+
+# if (defined HAVE_SYS_RANDOM_H) && (defined HAVE_GETRANDOM)
+	while ( got < sizeof (seed) )
+	{
+		res = getrandom (seed + got, sizeof (seed) - got, 0);
+		if ( res <= 0 )
+		{
+#  ifdef HAVE_ERRNO_H
+			if ( (res < 0) && (errno == EINTR) )
+			{
+				continue;
+			}
+#  endif
+			break;
+		}
+		got += (size_t) res;
+	}
+# endif
+	for ( i = got; i < sizeof (seed); i++ )
+	{
+		/* no getrandom() - the best that can be done */
+# if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
+		seed[i] = (unsigned char) (random () & 0xFF);
+# else
+		seed[i] = (unsigned char) (rand () & 0xFF);
+# endif
+	}
+	for ( i = 0; i < sizeof (chacha_key) / sizeof (chacha_key[0]); i++ )
+	{
+		chacha_key[i] = LSR_U32 (
+			((lsr_u32) seed[4*i])
+			| (((lsr_u32) seed[4*i+1]) << 8)
+			| (((lsr_u32) seed[4*i+2]) << 16)
+			| (((lsr_u32) seed[4*i+3]) << 24) );
+	}
+	LSR_MEMSET (seed, 0, sizeof (seed));
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_chacha_fallback_key LSR_PARAMS ((void));
+# endif
+
+/**
+ * Makes a key for the random passes started before the library's
+ *	constructor has drawn one (e.g. by the memory functions called by
+ *	other constructors). It uses no locks and no system calls which could
+ *	block, because it can run inside malloc().
+ */
+static void
+__lsr_chacha_fallback_key (LSR_VOID)
+{
+	lsr_u32 here = 0;
+# if (defined HAVE_TIME_H) && (defined HAVE_CLOCK_GETTIME)
+	struct timespec now;
+# endif
+
+	/* the addresses of the stack and of the library are randomized */
+	chacha_key[0] = LSR_U32 ((unsigned long int) &here);
+	chacha_key[1] = LSR_U32 (((unsigned long int) &here) >> 16 >> 16);
+	chacha_key[2] = LSR_U32 ((unsigned long int) chacha_key);
+	chacha_key[3] = LSR_U32 (((unsigned long int) chacha_key) >> 16 >> 16);
+# ifdef HAVE_GETPID
+	chacha_key[4] = LSR_U32 (getpid ());
+# endif
+# if (defined HAVE_TIME_H) && (defined HAVE_CLOCK_GETTIME)
+	if ( clock_gettime (CLOCK_MONOTONIC, &now) == 0 )
+	{
+		chacha_key[5] = LSR_U32 (now.tv_nsec);
+		chacha_key[6] = LSR_U32 (now.tv_sec);
+	}
+# endif
+	chacha_key[7] = 0x61707865;
+}
+#endif /* ! ALL_PASSES_ZERO */
+
+/* ======================================================= */
+
+/**
+ * Draws the key for the random passes and makes the children of the process
+ *	draw their own, so that they don't write the same random data. Called
+ *	by the library's constructor, so that the random fills done later
+ *	(also inside malloc()) need no locks or system calls.
+ */
+void
+__lsr_seed_random (LSR_VOID)
+{
+#ifndef ALL_PASSES_ZERO
+	__lsr_chacha_draw_key ();
+	chacha_seeded = 2;
+# if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_atfork (NULL, NULL, &__lsr_chacha_draw_key);
+# endif
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef ALL_PASSES_ZERO
+# ifndef LSR_ANSIC
+static unsigned long int __lsr_chacha_next_stream LSR_PARAMS ((void));
+# endif
+
+/**
+ * Starts a new stream of random data.
+ * \return the number of the new stream, never 0.
+ */
+static unsigned long int
+__lsr_chacha_next_stream (LSR_VOID)
+{
+	unsigned long int stream;
+
+	if ( chacha_seeded == 0 )
+	{
+		/* called before the constructor */
+		__lsr_chacha_fallback_key ();
+		chacha_seeded = 1;
+	}
+# ifdef __GNUC__
+	stream = __sync_add_and_fetch (&chacha_streams, 1);
+# else
+	stream = ++chacha_streams;
+# endif
+	if ( stream == 0 )
+	{
+		/* wrapped around - 0 means "no stream" */
+		stream = __lsr_chacha_next_stream ();
+	}
+	return stream;
+}
+#endif /* ! ALL_PASSES_ZERO */
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_chacha_blocks LSR_PARAMS ((const lsr_u32 * const key,
+	const unsigned long int stream, const off64_t block,
+	unsigned char * const out));
+#endif
+
+/**
+ * Computes LSR_CHACHA_LANES consecutive ChaCha20 blocks of the given stream.
+ * \param key The key, as 8 words.
+ * \param stream The number of the stream (the nonce).
+ * \param block The number of the first block (the counter).
+ * \param out The place for LSR_CHACHA_LANES * LSR_CHACHA_BLOCK bytes.
+ */
+static void
+__lsr_chacha_blocks (
+#ifdef LSR_ANSIC
+	const lsr_u32 * const key, const unsigned long int stream,
+	const off64_t block, unsigned char * const out)
+#else
+	key, stream, block, out)
+	const lsr_u32 * const key;
+	const unsigned long int stream;
+	const off64_t block;
+	unsigned char * const out;
+#endif
+{
+	lsr_u32 in[16][LSR_CHACHA_LANES];
+	lsr_u32 x[16][LSR_CHACHA_LANES];
+	unsigned int i;
+	unsigned int l;
+	unsigned int r;
+	lsr_u32 v;
+
+	for ( l = 0; l < LSR_CHACHA_LANES; l++ )
+	{
+		/* "expand 32-byte k" */
+		in[0][l] = 0x61707865U;
+		in[1][l] = 0x3320646eU;
+		in[2][l] = 0x79622d32U;
+		in[3][l] = 0x6b206574U;
+		for ( i = 0; i < 8; i++ )
+		{
+			in[4+i][l] = key[i];
+		}
+		in[12][l] = LSR_U32 (block + (off64_t) l);
+		in[13][l] = LSR_U32 (((block + (off64_t) l) >> 16) >> 16);
+		in[14][l] = LSR_U32 (stream);
+		in[15][l] = LSR_U32 ((stream >> 16) >> 16);
+	}
+	LSR_MEMCOPY (x, in, sizeof (x));
+
+#define LSR_CHACHA_QR(a, b, c, d) \
+	for ( l = 0; l < LSR_CHACHA_LANES; l++ ) \
+	{ \
+		x[a][l] = LSR_U32 (x[a][l] + x[b][l]); \
+		x[d][l] = LSR_ROTL32 (x[d][l] ^ x[a][l], 16); \
+		x[c][l] = LSR_U32 (x[c][l] + x[d][l]); \
+		x[b][l] = LSR_ROTL32 (x[b][l] ^ x[c][l], 12); \
+		x[a][l] = LSR_U32 (x[a][l] + x[b][l]); \
+		x[d][l] = LSR_ROTL32 (x[d][l] ^ x[a][l], 8); \
+		x[c][l] = LSR_U32 (x[c][l] + x[d][l]); \
+		x[b][l] = LSR_ROTL32 (x[b][l] ^ x[c][l], 7); \
+	}
+
+	for ( r = 0; r < 10; r++ )
+	{
+		/* the column round */
+		LSR_CHACHA_QR (0, 4, 8, 12);
+		LSR_CHACHA_QR (1, 5, 9, 13);
+		LSR_CHACHA_QR (2, 6, 10, 14);
+		LSR_CHACHA_QR (3, 7, 11, 15);
+		/* the diagonal round */
+		LSR_CHACHA_QR (0, 5, 10, 15);
+		LSR_CHACHA_QR (1, 6, 11, 12);
+		LSR_CHACHA_QR (2, 7, 8, 13);
+		LSR_CHACHA_QR (3, 4, 9, 14);
+	}
+#undef LSR_CHACHA_QR
+
+	for ( l = 0; l < LSR_CHACHA_LANES; l++ )
+	{
+		for ( i = 0; i < 16; i++ )
+		{
+			v = LSR_U32 (x[i][l] + in[i][l]);
+			out[l * LSR_CHACHA_BLOCK + 4*i] = (unsigned char) (v & 0xFF);
+			out[l * LSR_CHACHA_BLOCK + 4*i+1] = (unsigned char) ((v >> 8) & 0xFF);
+			out[l * LSR_CHACHA_BLOCK + 4*i+2] = (unsigned char) ((v >> 16) & 0xFF);
+			out[l * LSR_CHACHA_BLOCK + 4*i+3] = (unsigned char) ((v >> 24) & 0xFF);
+		}
+	}
+}
+
+/* ======================================================= */
+
+/**
+ * Computes one ChaCha20 block with the given key (for checking the cipher).
+ * \param key The key, 32 bytes.
+ * \param stream The number of the stream (the nonce).
+ * \param block The number of the block (the counter).
+ * \param out The place for the 64 bytes of the block.
+ */
+void
+#ifdef LSR_ANSIC
+LSR_ATTR ((nonnull))
+#endif
+__lsr_chacha20_block (
+#ifdef LSR_ANSIC
+	const unsigned char * const key, const unsigned long int stream,
+	const off64_t block, unsigned char * const out)
+#else
+	key, stream, block, out)
+	const unsigned char * const key;
+	const unsigned long int stream;
+	const off64_t block;
+	unsigned char * const out;
+#endif
+{
+	lsr_u32 words[8];
+	unsigned char blocks[LSR_CHACHA_LANES * LSR_CHACHA_BLOCK];
+	size_t i;
+
+	for ( i = 0; i < sizeof (words) / sizeof (words[0]); i++ )
+	{
+		words[i] = LSR_U32 (
+			((lsr_u32) key[4*i])
+			| (((lsr_u32) key[4*i+1]) << 8)
+			| (((lsr_u32) key[4*i+2]) << 16)
+			| (((lsr_u32) key[4*i+3]) << 24) );
+	}
+	__lsr_chacha_blocks (words, stream, block, blocks);
+	LSR_MEMCOPY (out, blocks, LSR_CHACHA_BLOCK);
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_fill_stream_at LSR_PARAMS ((const unsigned long int stream,
+	unsigned char * const buffer, const size_t buflen, const off64_t offset));
+#endif
+
+/**
+ * Fills the given buffer with the data of the given random stream
+ *	for the given offset in the file.
+ * \param stream The number of the random stream.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \param offset The offset in the file at which the buffer will be written.
+ */
+static void
+__lsr_fill_stream_at (
+#ifdef LSR_ANSIC
+	const unsigned long int stream, unsigned char * const buffer,
+	const size_t buflen, const off64_t offset)
+#else
+	stream, buffer, buflen, offset)
+	const unsigned long int stream;
+	unsigned char * const buffer;
+	const size_t buflen;
+	const off64_t offset;
+#endif
+{
+	unsigned char blocks[LSR_CHACHA_LANES * LSR_CHACHA_BLOCK];
+	off64_t block = offset / LSR_CHACHA_BLOCK;
+	size_t skip = (size_t) (offset % LSR_CHACHA_BLOCK);
+	size_t done = 0;
+	size_t len;
+
+	while ( done < buflen )
+	{
+		len = sizeof (blocks) - skip;
+		if ( len > buflen - done )
+		{
+			len = buflen - done;
+		}
+		if ( (skip == 0) && (len == sizeof (blocks)) )
+		{
+			/* a whole group of blocks - no need to copy */
+			__lsr_chacha_blocks (chacha_key, stream, block, buffer + done);
+		}
+		else
+		{
+			__lsr_chacha_blocks (chacha_key, stream, block, blocks);
+			LSR_MEMCOPY (buffer + done, blocks + skip, len);
+		}
+		done += len;
+		block += LSR_CHACHA_LANES;
+		skip = 0;
+	}
+	LSR_MEMSET (blocks, 0, sizeof (blocks));
+}
+
+/* ======================================================= */
+
+/* Replicating the 3-byte patterns over the buffers. The vector kernels
+   keep a multiple of the pattern's period in three registers and store
+   them over and over. The best kernel for the processor is selected on
+   the first use. */
+
+/* the length of the pattern's period */
+#define LSR_PATTERN_LEN		3
+/* three of the longest registers (AVX-512) - a multiple of the period */
+#define LSR_PATTERN_BLOCK	(3 * 64)
+/* a few periods, copied to build the block */
+#define LSR_PATTERN_CHUNK	(4 * LSR_PATTERN_LEN)
+/* Fills at least this big are done with non-temporal stores, which
+   don't push the rest of the data out of the processor's caches. */
+#define LSR_NT_FILL_SIZE	(4 * 1024 * 1024)
+
+typedef void (*lsr_fill_kernel) LSR_PARAMS ((unsigned char * const buffer,
+	const size_t buflen, const unsigned char * const block));
+
+#ifndef LSR_ANSIC
+static void __lsr_fill_pattern_generic LSR_PARAMS ((
+	unsigned char * const buffer, const size_t buflen,
+	const unsigned char * const block));
+#endif
+
+/**
+ * Replicates the pattern over the buffer by doubling the filled part.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \param block The pattern repeated over LSR_PATTERN_BLOCK + LSR_PATTERN_CHUNK
+ *	bytes.
+ */
+static void
+__lsr_fill_pattern_generic (
+#ifdef LSR_ANSIC
+	unsigned char * const buffer, const size_t buflen,
+	const unsigned char * const block)
+#else
+	buffer, buflen, block)
+	unsigned char * const buffer;
+	const size_t buflen;
+	const unsigned char * const block;
+#endif
+{
+	size_t i;
+
+	i = LSR_PATTERN_BLOCK;
+	if ( i > buflen )
+	{
+		i = buflen;
+	}
+	LSR_MEMCOPY (buffer, block, i);
+	for ( ; (i << 1) < buflen; i <<= 1)
+	{
+		LSR_MEMCOPY (buffer + i, buffer, i);
+	}
+	if (i < buflen)
+	{
+		LSR_MEMCOPY (buffer + i, buffer, buflen - i);
+	}
+}
+
+#if (defined HAVE_IMMINTRIN_H) && ((defined __x86_64__) || (defined __i386__)) \
+	&& ((defined __clang__) || ((defined __GNUC__) && (__GNUC__ >= 5)))
+# define LSR_CAN_USE_SIMD 1
+
+/* The vector kernels. Each of them stores the head of the buffer with
+   the generic code, up to the vector's alignment, because the aligned
+   stores are faster and the non-temporal stores require them. The block
+   has some spare bytes at the end, so the registers can be loaded from
+   any phase of the pattern. */
+
+# ifndef LSR_ANSIC
+static void __lsr_fill_pattern_sse2 LSR_PARAMS ((unsigned char * const buffer,
+	const size_t buflen, const unsigned char * const block));
+static void __lsr_fill_pattern_avx2 LSR_PARAMS ((unsigned char * const buffer,
+	const size_t buflen, const unsigned char * const block));
+static void __lsr_fill_pattern_avx512 LSR_PARAMS ((unsigned char * const buffer,
+	const size_t buflen, const unsigned char * const block));
+# endif
+
+# define LSR_FILL_KERNEL(name, isa, vtype, vsize, load, store, nt_store, fence) \
+static void LSR_ATTR ((target (isa))) \
+name ( \
+	unsigned char * const buffer, const size_t buflen, \
+	const unsigned char * const block) \
+{ \
+	size_t done = 0; \
+	size_t phase; \
+	vtype v0, v1, v2; \
+	\
+	done = (vsize - ((unsigned long int) buffer % vsize)) % vsize; \
+	LSR_MEMCOPY (buffer, block, done); \
+	phase = done % LSR_PATTERN_LEN; \
+	v0 = load ((const vtype *) (const void *) (block + phase)); \
+	v1 = load ((const vtype *) (const void *) (block + phase + vsize)); \
+	v2 = load ((const vtype *) (const void *) (block + phase + 2 * vsize)); \
+	if ( buflen >= LSR_NT_FILL_SIZE ) \
+	{ \
+		for ( ; done + 3 * vsize <= buflen; done += 3 * vsize ) \
+		{ \
+			nt_store ((vtype *) (void *) (buffer + done), v0); \
+			nt_store ((vtype *) (void *) (buffer + done + vsize), v1); \
+			nt_store ((vtype *) (void *) (buffer + done + 2 * vsize), v2); \
+		} \
+		fence (); \
+	} \
+	else \
+	{ \
+		for ( ; done + 3 * vsize <= buflen; done += 3 * vsize ) \
+		{ \
+			store ((vtype *) (void *) (buffer + done), v0); \
+			store ((vtype *) (void *) (buffer + done + vsize), v1); \
+			store ((vtype *) (void *) (buffer + done + 2 * vsize), v2); \
+		} \
+	} \
+	/* the tail is shorter than the block, in the same phase as the head */ \
+	LSR_MEMCOPY (buffer + done, block + phase, buflen - done); \
+}
+
+LSR_FILL_KERNEL (__lsr_fill_pattern_sse2, "sse2", __m128i, 16,
+	_mm_loadu_si128, _mm_storeu_si128, _mm_stream_si128, _mm_sfence)
+LSR_FILL_KERNEL (__lsr_fill_pattern_avx2, "avx2", __m256i, 32,
+	_mm256_loadu_si256, _mm256_storeu_si256, _mm256_stream_si256, _mm_sfence)
+LSR_FILL_KERNEL (__lsr_fill_pattern_avx512, "avx512f", __m512i, 64,
+	_mm512_loadu_si512, _mm512_storeu_si512, _mm512_stream_si512, _mm_sfence)
+# undef LSR_FILL_KERNEL
+#else
+# undef LSR_CAN_USE_SIMD
+#endif
+
+static lsr_fill_kernel fill_kernel = NULL;
+#if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+static pthread_once_t fill_kernel_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_select_fill_kernel LSR_PARAMS ((void));
+#endif
+
+/**
+ * Selects the best pattern-filling kernel for the processor.
+ */
+static void
+__lsr_select_fill_kernel (LSR_VOID)
+{
+	lsr_fill_kernel kernel = &__lsr_fill_pattern_generic;
+
+#ifdef LSR_CAN_USE_SIMD
+	__builtin_cpu_init ();
+	if ( __builtin_cpu_supports ("avx512f") )
+	{
+		kernel = &__lsr_fill_pattern_avx512;
+	}
+	else if ( __builtin_cpu_supports ("avx2") )
+	{
+		kernel = &__lsr_fill_pattern_avx2;
+	}
+	else if ( __builtin_cpu_supports ("sse2") )
+	{
+		kernel = &__lsr_fill_pattern_sse2;
+	}
+#endif
+	fill_kernel = kernel;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_fill_pattern LSR_PARAMS ((unsigned char * const buffer,
+	const size_t buflen, const unsigned char * const pattern));
+#endif
+
+/**
+ * Fills the given buffer with the given 3-byte pattern.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \param pattern The LSR_PATTERN_LEN bytes of the pattern.
+ */
+static void
+__lsr_fill_pattern (
+#ifdef LSR_ANSIC
+	unsigned char * const buffer, const size_t buflen,
+	const unsigned char * const pattern)
+#else
+	buffer, buflen, pattern)
+	unsigned char * const buffer;
+	const size_t buflen;
+	const unsigned char * const pattern;
+#endif
+{
+	unsigned char block[LSR_PATTERN_BLOCK + LSR_PATTERN_CHUNK];
+	size_t i;
+
+	if ( buflen < 64 )
+	{
+		/* not worth preparing the block */
+		for ( i = 0; i + LSR_PATTERN_LEN <= buflen; i += LSR_PATTERN_LEN )
+		{
+			buffer[i] = pattern[0];
+			buffer[i+1] = pattern[1];
+			buffer[i+2] = pattern[2];
+		}
+		for ( ; i < buflen; i++ )
+		{
+			buffer[i] = pattern[i % LSR_PATTERN_LEN];
+		}
+		return;
+	}
+	/* the first use selects the kernel */
+#if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	pthread_once (&fill_kernel_once, &__lsr_select_fill_kernel);
+#else
+	if ( fill_kernel == NULL )
+	{
+		__lsr_select_fill_kernel ();
+	}
+#endif
+	for ( i = 0; i < LSR_PATTERN_CHUNK; i += LSR_PATTERN_LEN )
+	{
+		block[i] = pattern[0];
+		block[i+1] = pattern[1];
+		block[i+2] = pattern[2];
+	}
+	for ( ; i < sizeof (block); i += LSR_PATTERN_CHUNK )
+	{
+		LSR_MEMCOPY (block + i, block, LSR_PATTERN_CHUNK);
+	}
+	(*fill_kernel) (buffer, buflen, block);
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static size_t __lsr_get_npat LSR_PARAMS ((void));
+#endif
+
+/**
+ * Returns the number of the fixed patterns of the current method.
+ */
+static size_t
+__lsr_get_npat (LSR_VOID)
+{
+	if ( opt_method == LSR_METHOD_GUTMANN )
+	{
+		return sizeof (patterns_gutmann)/sizeof (patterns_gutmann[0]);
+	}
+	else if ( opt_method == LSR_METHOD_RANDOM )
+	{
+		return sizeof (patterns_random)/sizeof (patterns_random[0]);
+	}
+	else if ( opt_method == LSR_METHOD_SCHNEIER )
+	{
+		return sizeof (patterns_schneier)/sizeof (patterns_schneier[0]);
+	}
+	else if ( opt_method == LSR_METHOD_DOD )
+	{
+		return sizeof (patterns_dod)/sizeof (patterns_dod[0]);
+	}
+	else if ( opt_method == LSR_METHOD_CLEAR )
+	{
+		return sizeof (patterns_clear)/sizeof (patterns_clear[0]);
+	}
+	return 0;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static unsigned int __lsr_get_pattern_bits LSR_PARAMS ((const size_t pat));
+#endif
+
+/**
+ * Returns the given fixed pattern of the current method.
+ * \param pat The number of the pattern, less than __lsr_get_npat().
+ * \return the 12 bits of the pattern.
+ */
+static unsigned int
+__lsr_get_pattern_bits (
+#ifdef LSR_ANSIC
+	const size_t pat)
+#else
+	pat)
+	const size_t pat;
+#endif
+{
+	if ( opt_method == LSR_METHOD_GUTMANN )
+	{
+		return patterns_gutmann[pat];
+	}
+	else if ( opt_method == LSR_METHOD_RANDOM )
+	{
+		return patterns_random[pat];
+	}
+	else if ( opt_method == LSR_METHOD_SCHNEIER )
+	{
+		return patterns_schneier[pat];
+	}
+	else if ( opt_method == LSR_METHOD_CLEAR )
+	{
+		return patterns_clear[pat];
+	}
+	/*else if ( opt_method == LSR_METHOD_DOD )*/
+	return patterns_dod[pat] & 0xFFF;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_get_pattern_bytes LSR_PARAMS ((unsigned int bits,
+	unsigned char * const pattern));
+#endif
+
+/**
+ * Converts the 12 bits of a pattern to the LSR_PATTERN_LEN bytes to write.
+ * \param bits The bits of the pattern.
+ * \param pattern The place for the bytes.
+ */
+static void
+__lsr_get_pattern_bytes (
+#ifdef LSR_ANSIC
+	unsigned int bits, unsigned char * const pattern)
+#else
+	bits, pattern)
+	unsigned int bits;
+	unsigned char * const pattern;
+#endif
+{
+	/* Taken from `shred' source and modified */
+	bits |= bits << 12;
+	pattern[0] = (unsigned char) ((bits >> 4) & 0xFF);
+	pattern[1] = (unsigned char) ((bits >> 8) & 0xFF);
+	pattern[2] = (unsigned char) (bits & 0xFF);
+}
+
+/* ======================================================= */
+
+/* The values returned by the pattern selection functions besides
+   the number of the pattern: */
+#define LSR_PATTERN_RANDOM	(-1)	/* a random pass */
+#define LSR_PATTERN_NONE	(-2)	/* no pattern could be selected */
+
+struct lsr_extents;
+
+/* The order of the fixed patterns for one wipe, drawn up front, so that
+   selecting the pattern of a pass is just looking it up. */
+struct lsr_schedule
+{
+	unsigned long int npasses;	/* the number of passes of this wipe */
+	unsigned long int selected;	/* the pass selected last plus 1, 0 if none */
+	unsigned long int nfixed;	/* the number of fixed passes done so far */
+	unsigned long int last_stream;	/* the random stream of the last pass */
+	unsigned long int phase;	/* the byte of the patterns at the start
+					   of the range being written now */
+	const struct lsr_extents * extents;	/* the allocated parts of
+					   the wiped region, NULL if it has no holes */
+	unsigned int first;		/* the first pass to write now */
+	unsigned int stop;		/* the pass after the last one to write now */
+	lsr_u32 seed;			/* the seed of the order of the patterns */
+	lsr_u32 state;			/* the generator of the order of the patterns */
+	int last_pat;			/* the pattern of the last pass */
+	int cow;			/* non-zero if the region is copy-on-write */
+	unsigned int last_bits;		/* the bits of the pattern of the last pass */
+	unsigned char order[28];	/* room for the longest table (27 patterns) */
+};
+
+#ifndef LSR_ANSIC
+static void __lsr_init_patterns LSR_PARAMS ((void));
+#endif
+
+/**
+ * Initializes the patterns depending on the process.
+ */
+static void
+__lsr_init_patterns (LSR_VOID)
+{
+	if ( patterns_dod[0] == 0xFFFFFFFF )
+	{
+		/* Not initialized. Perform initialization. */
+#if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
+		patterns_dod[0] = (unsigned int)(random () & 0xFFF);
+#else
+		patterns_dod[0] = (unsigned int)(rand () & 0xFFF);
+#endif
+		patterns_dod[1] = (~patterns_dod[0]) & 0xFFF;
+	}
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static size_t __lsr_random_below LSR_PARAMS ((const size_t n));
+#endif
+
+/**
+ * Draws a number for selecting the patterns.
+ * \param n The upper limit, greater than 0.
+ * \return a random number from 0 to n-1.
+ */
+static size_t
+__lsr_random_below (
+#ifdef LSR_ANSIC
+	const size_t n)
+#else
+	n)
+	const size_t n;
+#endif
+{
+#if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
+	return (size_t)random () % n;
+#else
+	return (size_t)rand () % n;
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static size_t __lsr_schedule_random LSR_PARAMS ((
+	struct lsr_schedule * const schedule, const size_t n));
+#endif
+
+/**
+ * Draws a number for the order of the patterns of a wipe, so that the same
+ *	seed gives the same order (a xorshift generator).
+ * \param schedule The schedule with the state of the generator.
+ * \param n The upper limit, greater than 0.
+ * \return a pseudo-random number from 0 to n-1.
+ */
+static size_t
+__lsr_schedule_random (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule, const size_t n)
+#else
+	schedule, n)
+	struct lsr_schedule * const schedule;
+	const size_t n;
+#endif
+{
+	lsr_u32 x = schedule->state;
+
+	x ^= LSR_U32 (x << 13);
+	x ^= x >> 17;
+	x ^= LSR_U32 (x << 5);
+	schedule->state = x;
+	return (size_t)x % n;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_shuffle_patterns LSR_PARAMS ((
+	struct lsr_schedule * const schedule));
+#endif
+
+/**
+ * Puts the fixed patterns of the current method in a new random order
+ *	(the Fisher-Yates shuffle).
+ * \param schedule The schedule to put the order in.
+ */
+static void
+__lsr_shuffle_patterns (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule)
+#else
+	schedule)
+	struct lsr_schedule * const schedule;
+#endif
+{
+	size_t npat = __lsr_get_npat ();
+	size_t i;
+	size_t k;
+	unsigned char tmp;
+
+	if ( npat > sizeof (schedule->order) )
+	{
+		npat = sizeof (schedule->order);
+	}
+	for ( i = 0; i < npat; i++ )
+	{
+		schedule->order[i] = (unsigned char) i;
+	}
+	for ( i = npat; i > 1; i-- )
+	{
+		k = __lsr_schedule_random (schedule, i);
+		tmp = schedule->order[i-1];
+		schedule->order[i-1] = schedule->order[k];
+		schedule->order[k] = tmp;
+	}
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_schedule_set_passes LSR_PARAMS ((
+	struct lsr_schedule * const schedule, const unsigned long int passes));
+#endif
+
+/**
+ * Sets the number of passes of a wipe, all of which are to be written.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param passes The number of passes.
+ */
+static void
+__lsr_schedule_set_passes (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule, const unsigned long int passes)
+#else
+	schedule, passes)
+	struct lsr_schedule * const schedule;
+	const unsigned long int passes;
+#endif
+{
+	schedule->npasses = passes;
+	schedule->first = 0;
+	schedule->stop = (unsigned int) passes
+#ifdef LAST_PASS_ZERO
+		+ 1
+#endif
+		;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_schedule_seed LSR_PARAMS ((
+	struct lsr_schedule * const schedule, const unsigned long int seed));
+#endif
+
+/**
+ * Starts the selection of the patterns of a wipe from the beginning.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param seed The seed of the order of the patterns.
+ */
+static void
+__lsr_schedule_seed (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule, const unsigned long int seed)
+#else
+	schedule, seed)
+	struct lsr_schedule * const schedule;
+	const unsigned long int seed;
+#endif
+{
+	schedule->seed = LSR_U32 (seed);
+	/* xorshift never leaves zero */
+	schedule->state = (schedule->seed != 0) ? schedule->seed : 1;
+	schedule->selected = 0;
+	schedule->nfixed = 0;
+	schedule->last_stream = 0;
+	schedule->last_pat = LSR_PATTERN_NONE;
+	schedule->last_bits = 0;
+	__lsr_shuffle_patterns (schedule);
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_schedule_init LSR_PARAMS ((
+	struct lsr_schedule * const schedule));
+#endif
+
+/**
+ * Prepares the schedule of the patterns for a new wipe.
+ * \param schedule The schedule to prepare.
+ */
+static void
+__lsr_schedule_init (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule)
+#else
+	schedule)
+	struct lsr_schedule * const schedule;
+#endif
+{
+	__lsr_init_patterns ();
+	schedule->phase = 0;
+	schedule->extents = NULL;
+	schedule->cow = 0;
+	__lsr_schedule_set_passes (schedule, npasses);
+#if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
+	__lsr_schedule_seed (schedule, (unsigned long int) random ());
+#else
+	__lsr_schedule_seed (schedule, (unsigned long int) rand ());
+#endif
+}
+
+/* ======================================================= */
+
+#ifdef ALL_PASSES_ZERO
+# define LSR_UNUSED_WITH_ZEROS LSR_ATTR ((unused))
+#else
+# define LSR_UNUSED_WITH_ZEROS
+#endif
+
+#ifndef LSR_ANSIC
+static int __lsr_pass_pattern LSR_PARAMS ((unsigned long int pat_no,
+	const size_t npat, size_t pattern, unsigned int * const bits,
+	unsigned long int * const stream));
+#endif
+
+/**
+ * Finishes the selection of the pattern for the given pass.
+ * \param pat_no Pass number.
+ * \param npat The number of the fixed patterns of the current method.
+ * \param pattern The number of the fixed pattern, if the pass isn't random.
+ * \param bits The place for the 12 bits of the selected pattern.
+ * \param stream The place for the number of the random stream (0 if
+ *	the pass isn't random).
+ * \return the number of the selected pattern in the current method's table
+ *	(or the number of patterns in the table for a pass with zeros) or
+ *	LSR_PATTERN_RANDOM for a random pass (a new stream of random data is
+ *	started).
+ */
+static int
+__lsr_pass_pattern (
+#ifdef LSR_ANSIC
+	unsigned long int pat_no LSR_UNUSED_WITH_ZEROS, const size_t npat,
+	size_t pattern LSR_UNUSED_WITH_ZEROS, unsigned int * const bits,
+	unsigned long int * const stream)
+#else
+	pat_no, npat, pattern, bits, stream)
+	unsigned long int pat_no LSR_UNUSED_WITH_ZEROS;
+	const size_t npat;
+	size_t pattern LSR_UNUSED_WITH_ZEROS;
+	unsigned int * const bits;
+	unsigned long int * const stream;
+#endif
+{
+	*stream = 0;
+#ifdef ALL_PASSES_ZERO
+	*bits = 0;
+	return (int) npat;
+#else
+	if ( lsr_is_pass_random (pat_no, opt_method) == 1 )
+	{
+		/* a new stream of random data for each random pass */
+		*stream = __lsr_chacha_next_stream ();
+		return LSR_PATTERN_RANDOM;
+	}
+	if ( (opt_method != LSR_METHOD_GUTMANN)
+		&& (opt_method != LSR_METHOD_RANDOM) )
+	{
+		/* other methods use their patterns in sequence */
+		pattern = pat_no;
+	}
+	if ( pattern >= npat )
+	{
+		pattern %= npat;
+	}
+	*bits = __lsr_get_pattern_bits (pattern);
+	return (int) pattern;
+#endif /* ALL_PASSES_ZERO */
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static int __lsr_schedule_pattern LSR_PARAMS ((
+	struct lsr_schedule * const schedule, unsigned long int pat_no,
+	unsigned int * const bits));
+#endif
+
+/**
+ * Selects the pattern for the given pass of a wipe.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param pat_no Pass number.
+ * \param bits The place for the 12 bits of the selected pattern.
+ * \return the number of the selected pattern in the current method's table
+ *	(or the number of patterns in the table for a pass with zeros),
+ *	LSR_PATTERN_RANDOM for a random pass (a new stream of random data is
+ *	started) or LSR_PATTERN_NONE if no pattern was selected.
+ */
+static int
+__lsr_schedule_pattern (
+#ifdef LSR_ANSIC
+	struct lsr_schedule * const schedule, unsigned long int pat_no,
+	unsigned int * const bits)
+#else
+	schedule, pat_no, bits)
+	struct lsr_schedule * const schedule;
+	unsigned long int pat_no;
+	unsigned int * const bits;
+#endif
+{
+	const size_t npat = __lsr_get_npat ();
+	size_t next;
+
+	if ( npat == 0 )
+	{
+		return LSR_PATTERN_NONE;
+	}
+	if ( schedule->selected == pat_no + 1 )
+	{
+		/* the next part of the same pass - keep its pattern or stream */
+		*bits = schedule->last_bits;
+		return schedule->last_pat;
+	}
+	schedule->selected = pat_no + 1;
+	pat_no %= schedule->npasses;
+	next = (size_t) (schedule->nfixed % npat);
+	if ( lsr_is_pass_random (pat_no, opt_method) != 1 )
+	{
+		if ( (next == 0) && (schedule->nfixed != 0) )
+		{
+			/* all the patterns have been used - a new order */
+			__lsr_shuffle_patterns (schedule);
+		}
+		schedule->nfixed++;
+	}
+	/* remember the pass, so that it can be verified after the wipe */
+	schedule->last_pat = __lsr_pass_pattern (pat_no, npat, schedule->order[next],
+		bits, &(schedule->last_stream));
+	schedule->last_bits = *bits;
+	return schedule->last_pat;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static int __lsr_select_pattern LSR_PARAMS ((unsigned long int pat_no,
+	int * const selected, unsigned int * const bits,
+	unsigned long int * const stream));
+#endif
+
+/**
+ * Selects the pattern for the given pass, avoiding the patterns already
+ *	marked as selected.
+ * \param pat_no Pass number.
+ * \param selected array with 0s or 1s telling which patterns are already selected
+ * \param bits The place for the 12 bits of the selected pattern.
+ * \param stream The place for the number of the random stream (0 if
+ *	the pass isn't random).
+ * \return the number of the selected pattern in the current method's table
+ *	(or the number of patterns in the table for a pass with zeros),
+ *	LSR_PATTERN_RANDOM for a random pass (a new stream of random data is
+ *	started) or LSR_PATTERN_NONE if no pattern was selected.
+ */
+static int
+__lsr_select_pattern (
+#ifdef LSR_ANSIC
+	unsigned long int pat_no, int * const selected, unsigned int * const bits,
+	unsigned long int * const stream)
+#else
+	pat_no, selected, bits, stream)
+	unsigned long int pat_no;
+	int * const selected;
+	unsigned int * const bits;
+	unsigned long int * const stream;
+#endif
 {
 	size_t i;
-	unsigned int bits;
 	size_t npat;
+	size_t nfree = 0;
+	size_t k;
+	int pat;
+
+	__lsr_init_patterns ();
+	npat = __lsr_get_npat ();
+	if ( npat == 0 )
+	{
+		return LSR_PATTERN_NONE;
+	}
+	if ( npat > LSR_NPAT )
+	{
+		/* the method was changed at run time - the array
+		   of the caller has room only for LSR_NPAT patterns */
+		npat = LSR_NPAT;
+	}
+	pat_no %= npasses;
+
+	for ( i = 0; i < npat; i++ )
+	{
+		if ( selected[i] == 0 )
+		{
+			nfree++;
+		}
+	}
+	if ( (nfree == 0) && (lsr_is_pass_random (pat_no, opt_method) != 1) )
+	{
+		/* no patterns left and this is not a "random" pass - deselect all the patterns */
+		for ( i = 0; i < npat; i++ )
+		{
+			selected[i] = 0;
+		}
+		nfree = npat;
+	}
+	/* pick one of the free patterns directly - no retrying */
+	k = (nfree != 0) ? __lsr_random_below (nfree) : 0;
+	for ( i = 0; i < npat; i++ )
+	{
+		if ( selected[i] == 0 )
+		{
+			if ( k == 0 )
+			{
+				break;
+			}
+			k--;
+		}
+	}
+	pat = __lsr_pass_pattern (pat_no, npat, i, bits, stream);
+	if ( (pat >= 0) && ((size_t) pat < npat) )
+	{
+		selected[pat] = 1;
+	}
+	return pat;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static int __lsr_fill_selected LSR_PARAMS ((const int pat,
+	const unsigned int bits, const unsigned long int stream,
+	unsigned char * const buffer, const size_t buflen));
+#endif
+
+/**
+ * Fills the given buffer with the data of the selected pattern.
+ * \param pat The selected pattern, as returned by the selection functions.
+ * \param bits The 12 bits of the selected pattern.
+ * \param stream The random stream of the selected pass, if it's random.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \return 1 if the buffer was filled with the data of a random pass, 0 otherwise.
+ */
+static int
+__lsr_fill_selected (
+#ifdef LSR_ANSIC
+	const int pat, const unsigned int bits, const unsigned long int stream,
+	unsigned char * const buffer, const size_t buflen)
+#else
+	pat, bits, stream, buffer, buflen)
+	const int pat;
+	const unsigned int bits;
+	const unsigned long int stream;
+	unsigned char * const buffer;
+	const size_t buflen;
+#endif
+{
+	unsigned char pattern[LSR_PATTERN_LEN];
+
+	if ( pat == LSR_PATTERN_NONE )
+	{
+		return 0;
+	}
+	if ( pat == LSR_PATTERN_RANDOM )
+	{
+#ifdef LSR_DEBUG
+		fprintf (stderr, "libsecrm: Using pattern (random)\n");
+#endif
+		__lsr_fill_stream_at (stream, buffer, buflen, 0);
+		return 1;
+	}
+
+	__lsr_get_pattern_bytes (bits, pattern);
+#ifdef LSR_DEBUG
+	fprintf (stderr, "libsecrm: Using pattern %02x%02x%02x\n",
+		pattern[0], pattern[1], pattern[2]);
+#endif
+	__lsr_fill_pattern (buffer, buflen, pattern);
+	return 0;
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static void __lsr_get_scheduled_bytes LSR_PARAMS ((
+	const struct lsr_schedule * const schedule, const unsigned int bits,
+	unsigned char * const pattern));
+#endif
+
+/**
+ * Gets the bytes of the given pattern, starting with the byte which falls
+ *	at the start of the range of the file being written now.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param bits The 12 bits of the pattern.
+ * \param pattern The place for the LSR_PATTERN_LEN bytes of the pattern.
+ */
+static void
+__lsr_get_scheduled_bytes (
+#ifdef LSR_ANSIC
+	const struct lsr_schedule * const schedule, const unsigned int bits,
+	unsigned char * const pattern)
+#else
+	schedule, bits, pattern)
+	const struct lsr_schedule * const schedule;
+	const unsigned int bits;
+	unsigned char * const pattern;
+#endif
+{
+	unsigned char bytes[LSR_PATTERN_LEN];
+	size_t k;
+
+	__lsr_get_pattern_bytes (bits, bytes);
+	for ( k = 0; k < LSR_PATTERN_LEN; k++ )
+	{
+		pattern[k] = bytes[(schedule->phase + k) % LSR_PATTERN_LEN];
+	}
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static int __lsr_fill_scheduled LSR_PARAMS ((unsigned long int pat_no,
+	unsigned char * const buffer, const size_t buflen,
+	struct lsr_schedule * const schedule));
+#endif
+
+/**
+ * Fills the given buffer with the data of the given pass of a wipe.
+ * \param pat_no Pass number.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 1 if the buffer was filled with the data of a random pass (which
+ *	doesn't repeat, so the buffer must be filled again for each offset with
+ *	__lsr_fill_stream_at()), 0 if it was filled with a 3-byte pattern.
+ */
+static int
+__lsr_fill_scheduled (
+#ifdef LSR_ANSIC
+	unsigned long int pat_no, unsigned char * const buffer,
+	const size_t buflen, struct lsr_schedule * const schedule)
+#else
+	pat_no, buffer, buflen, schedule)
+	unsigned long int pat_no;
+	unsigned char * const buffer;
+	const size_t buflen;
+	struct lsr_schedule * const schedule;
+#endif
+{
+	unsigned int bits = 0;
+	unsigned char pattern[LSR_PATTERN_LEN];
+	int pat;
+
+	pat = __lsr_schedule_pattern (schedule, pat_no, &bits);
+	if ( (pat < 0) || (schedule->phase == 0) )
+	{
+		return __lsr_fill_selected (pat, bits, schedule->last_stream,
+			buffer, buflen);
+	}
+	__lsr_get_scheduled_bytes (schedule, bits, pattern);
+	__lsr_fill_pattern (buffer, buflen, pattern);
+	return 0;
+}
+
+/* ======================================================= */
+
+/**
+ * Fills the given buffer with one of predefined patterns.
+ * \param pat_no Pass number.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ * \param selected array with 0s or 1s telling which patterns are already selected
+ * \return 1 if the buffer was filled with the data of a random pass (which
+ *	doesn't repeat, so the buffer must be filled again for each offset with
+ *	__lsr_fill_stream_at()), 0 if it was filled with a 3-byte pattern.
+ */
+int
+#ifdef LSR_ANSIC
+LSR_ATTR ((nonnull))
+#endif
+__lsr_fill_buffer (
+#ifdef LSR_ANSIC
+		unsigned long int 		pat_no,
+		unsigned char * const 		buffer,
+		const size_t 			buflen,
+		int * const			selected )
+#else
+	pat_no, buffer, buflen, selected )
+	unsigned long int 		pat_no;
+	unsigned char * const 		buffer;
+	const size_t 			buflen;
+	int * const			selected;
+#endif
+		/*@requires notnull buffer @*/ /*@sets *buffer @*/
+{
+	unsigned int bits = 0;
+	unsigned long int stream = 0;
+	int pat;
+
+	if ( (buffer == NULL) || (buflen == 0) || (selected == NULL) )
+	{
+		return 0;
+	}
+
+	pat = __lsr_select_pattern (pat_no, selected, &bits, &stream);
+	return __lsr_fill_selected (pat, bits, stream, buffer, buflen);
+}
+
+/* ======================================================= */
+
+/**
+ * Fills the given buffer with the pattern of the given pass, without
+ *	keeping track of the patterns used (for single fills, like
+ *	the allocated memory).
+ * \param pat_no Pass number.
+ * \param buffer Buffer to be filled.
+ * \param buflen Length of the buffer.
+ */
+void
+#ifdef LSR_ANSIC
+LSR_ATTR ((nonnull))
+#endif
+__lsr_fill_buffer_once (
+#ifdef LSR_ANSIC
+	unsigned long int pat_no, unsigned char * const buffer,
+	const size_t buflen)
+#else
+	pat_no, buffer, buflen)
+	unsigned long int pat_no;
+	unsigned char * const buffer;
+	const size_t buflen;
+#endif
+{
+	unsigned int bits = 0;
+	unsigned long int stream = 0;
+	size_t npat;
+	int pat;
+
+	if ( (buffer == NULL) || (buflen == 0) )
+	{
+		return;
+	}
+	__lsr_init_patterns ();
+	npat = __lsr_get_npat ();
+	if ( npat == 0 )
+	{
+		return;
+	}
+	pat = __lsr_pass_pattern (pat_no % npasses, npat,
+		__lsr_random_below (npat), &bits, &stream);
+	__lsr_fill_selected (pat, bits, stream, buffer, buflen);
+}
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_PWRITEV) && (defined HAVE_MALLOC)
+/* The pages with all the fixed patterns of the current method, each one
+   replicated over N_PAGE_BYTES, followed by N_PAGE_BYTES of zeros. They
+   are rendered once, at the first use, into one read-only mapping
+   (of a sealed memfd, if possible), and are written to the files directly
+   instead of rendering the pattern into a new buffer for each pass. */
+
+# if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MPROTECT) \
+	&& ((defined MAP_ANONYMOUS) || (defined MAP_ANON))
+#  define LSR_CAN_USE_PATTERN_PAGES 1
+#  ifndef MAP_ANONYMOUS
+#   define MAP_ANONYMOUS MAP_ANON
+#  endif
+#  if (defined HAVE_MEMFD_CREATE) && (defined MFD_ALLOW_SEALING) \
+	&& (defined F_ADD_SEALS) && (defined HAVE_UNISTD_H)
+#   define LSR_CAN_USE_MEMFD 1
+#  else
+#   undef LSR_CAN_USE_MEMFD
+#  endif
+# else
+#  undef LSR_CAN_USE_PATTERN_PAGES
+#  undef LSR_CAN_USE_MEMFD
+# endif
+
+# ifdef LSR_CAN_USE_PATTERN_PAGES
+/* never written after being published - the mapping is read-only: */
+static unsigned char * pattern_pages = NULL;
+static enum lsr_method pattern_pages_method = LSR_METHOD_GUTMANN;
+
+#  ifndef LSR_ANSIC
+static unsigned char * __lsr_get_pattern_pages LSR_PARAMS ((void));
+#  endif
+
+/**
+ * Returns the pages with the patterns of the current method, rendering
+ *	them at the first use.
+ * \return the pages, or NULL if they can't be used.
+ */
+static unsigned char *
+__lsr_get_pattern_pages (LSR_VOID)
+{
+	const size_t npat = __lsr_get_npat ();
+	const size_t size = (npat + 1) * N_PAGE_BYTES;
+	unsigned char pattern[LSR_PATTERN_LEN];
+	unsigned char * pages;
+	unsigned char * published;
+	size_t i;
+#  ifdef LSR_CAN_USE_MEMFD
+	i_i_o ftruncate_real;
+	int fd;
+#  endif
+
+	published = pattern_pages;
+	if ( published != NULL )
+	{
+		if ( pattern_pages_method != opt_method )
+		{
+			/* the method has changed since the pages were made */
+			return NULL;
+		}
+		return published;
+	}
+	if ( (npat == 0) || (patterns_dod[0] == 0xFFFFFFFF) )
+	{
+		/* no patterns selected yet */
+		return NULL;
+	}
+
+	pages = (unsigned char *) MAP_FAILED;
+#  ifdef LSR_CAN_USE_MEMFD
+	fd = -1;
+	ftruncate_real = __lsr_real_ftruncate_location ();
+	if ( ftruncate_real != NULL )
+	{
+		fd = memfd_create ("libsecrm-patterns",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	}
+	if ( fd >= 0 )
+	{
+		if ( (*ftruncate_real) (fd, (off_t) size) == 0 )
+		{
+			pages = (unsigned char *) mmap (NULL, size,
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if ( pages != (unsigned char *) MAP_FAILED )
+		{
+			for ( i = 0; i < npat; i++ )
+			{
+				__lsr_get_pattern_bytes (
+					__lsr_get_pattern_bits (i), pattern);
+				__lsr_fill_pattern (pages + i * N_PAGE_BYTES,
+					N_PAGE_BYTES, pattern);
+			}
+			/* the last part is already zeros */
+			munmap (pages, size);
+			/* the contents can't be changed by anyone from now on: */
+			fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+				| F_SEAL_WRITE | F_SEAL_SEAL);
+			pages = (unsigned char *) mmap (NULL, size,
+				PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close (fd);
+	}
+#  endif /* LSR_CAN_USE_MEMFD */
+	if ( pages == (unsigned char *) MAP_FAILED )
+	{
+		pages = (unsigned char *) mmap (NULL, size,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ( pages == (unsigned char *) MAP_FAILED )
+		{
+			return NULL;
+		}
+		for ( i = 0; i < npat; i++ )
+		{
+			__lsr_get_pattern_bytes (__lsr_get_pattern_bits (i), pattern);
+			__lsr_fill_pattern (pages + i * N_PAGE_BYTES,
+				N_PAGE_BYTES, pattern);
+		}
+		if ( mprotect (pages, size, PROT_READ) != 0 )
+		{
+			munmap (pages, size);
+			return NULL;
+		}
+	}
+
+	pattern_pages_method = opt_method;
+#  ifdef __GNUC__
+	/* another thread may have been faster - use its pages then */
+	if ( ! __sync_bool_compare_and_swap (&pattern_pages, NULL, pages) )
+	{
+		munmap (pages, size);
+		return __lsr_get_pattern_pages ();
+	}
+#  else
+	pattern_pages = pages;
+#  endif
+	return pages;
+}
+# endif /* LSR_CAN_USE_PATTERN_PAGES */
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static unsigned char * __lsr_get_pass_data LSR_PARAMS ((
+	unsigned long int pat_no, unsigned char * const buf,
+	struct lsr_schedule * const schedule, unsigned long int * const stream));
+# endif
+
+/**
+ * Prepares the data for the given pass: selects the pattern and returns
+ *	the shared pages with it, or fills the given buffer.
+ * \param pat_no Pass number.
+ * \param buf The buffer to fill if the pages can't be used, N_PAGE_BYTES long.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param stream Set to the random stream for a random pass (the buffer is
+ *	then returned, filled like __lsr_fill_buffer() does), 0 otherwise.
+ * \return N_PAGE_BYTES of the data of the pass, read-only unless it's the
+ *	given buffer.
+ */
+static unsigned char *
+__lsr_get_pass_data (
+# ifdef LSR_ANSIC
+	unsigned long int pat_no, unsigned char * const buf,
+	struct lsr_schedule * const schedule, unsigned long int * const stream)
+# else
+	pat_no, buf, schedule, stream)
+	unsigned long int pat_no;
+	unsigned char * const buf;
+	struct lsr_schedule * const schedule;
+	unsigned long int * const stream;
+# endif
+{
+	unsigned int bits = 0;
+	unsigned char pattern[LSR_PATTERN_LEN];
+	int pat;
+# ifdef LSR_CAN_USE_PATTERN_PAGES
+	unsigned char * pages;
+# endif
+
+	*stream = 0;
+	pat = __lsr_schedule_pattern (schedule, pat_no, &bits);
+	if ( pat == LSR_PATTERN_RANDOM )
+	{
+		*stream = schedule->last_stream;
+		__lsr_fill_stream_at (*stream, buf, N_PAGE_BYTES, 0);
+		return buf;
+	}
+# ifdef LSR_CAN_USE_PATTERN_PAGES
+	if ( (pat >= 0) && (schedule->phase == 0) )
+	{
+		/* the pages start with the first byte of the pattern */
+		pages = __lsr_get_pattern_pages ();
+		if ( pages != NULL )
+		{
+			return pages + (size_t) pat * N_PAGE_BYTES;
+		}
+	}
+# endif
+	__lsr_get_scheduled_bytes (schedule, bits, pattern);
+	__lsr_fill_pattern (buf, N_PAGE_BYTES, pattern);
+	return buf;
+}
+
+/* ======================================================= */
+
+# ifdef LAST_PASS_ZERO
+#  ifndef LSR_ANSIC
+static unsigned char * __lsr_get_zero_data LSR_PARAMS ((
+	unsigned char * const buf));
+#  endif
+
+/**
+ * Returns N_PAGE_BYTES of zeros, for the last pass.
+ * \param buf The buffer to fill with zeros if the pages can't be used,
+ *	N_PAGE_BYTES long.
+ * \return the zeros, read-only unless it's the given buffer.
+ */
+static unsigned char *
+__lsr_get_zero_data (
+#  ifdef LSR_ANSIC
+	unsigned char * const buf)
+#  else
+	buf)
+	unsigned char * const buf;
+#  endif
+{
+#  ifdef LSR_CAN_USE_PATTERN_PAGES
+	unsigned char * pages;
+
+	pages = __lsr_get_pattern_pages ();
+	if ( pages != NULL )
+	{
+		return pages + __lsr_get_npat () * N_PAGE_BYTES;
+	}
+#  endif
+	LSR_MEMSET (buf, 0, N_PAGE_BYTES);
+	return buf;
+}
+# endif /* LAST_PASS_ZERO */
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_PWRITEV && HAVE_MALLOC */
+
+/* ======================================================= */
+
+#ifdef LSR_CAN_FALLOCATE_ZEROS
+# ifndef LSR_ANSIC
+static int __lsr_fallocate_at LSR_PARAMS ((const int fd, const int mode,
+	const off64_t start, const off64_t len));
+# endif
+
+/**
+ * Calls the original fallocate() function.
+ * \param fd The file descriptor.
+ * \param mode The mode of the operation.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_fallocate_at (
+# ifdef LSR_ANSIC
+	const int fd, const int mode, const off64_t start, const off64_t len)
+# else
+	fd, mode, start, len)
+	const int fd;
+	const int mode;
+	const off64_t start;
+	const off64_t len;
+# endif
+{
+	i_i_i_o64_o64 falloc64;
+	i_i_i_o_o falloc;
+
+	falloc64 = __lsr_real_fallocate64_location ();
+	if ( falloc64 != NULL )
+	{
+		return (*falloc64) (fd, mode, start, len);
+	}
+	falloc = __lsr_real_fallocate_location ();
+	if ( (falloc != NULL) && ((off64_t) (off_t) (start + len) == start + len) )
+	{
+		return (*falloc) (fd, mode, (off_t) start, (off_t) len);
+	}
+	return -1;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_fallocate_zeros LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, const unsigned long int pass,
+	const unsigned long int passes));
+# endif
+
+/**
+ * Zeroes the given region of the file with fallocate() instead of writing
+ *	a pass of zeros, if enabled and supported by the filesystem. The blocks
+ *	are marked as unwritten (or freed), not overwritten, so this is done
+ *	only for the passes after the first one, which really overwrites the data.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param pass The number of the pass.
+ * \param passes The number of the passes of the wipe.
+ * \return 0 if the region was zeroed, -1 if the pass should be written.
+ */
+static int
+__lsr_fallocate_zeros (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	const unsigned long int pass, const unsigned long int passes LSR_UNUSED_WITH_ZEROS)
+# else
+	fd, start, len, pass, passes)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	const unsigned long int pass;
+	const unsigned long int passes LSR_UNUSED_WITH_ZEROS;
+# endif
+{
+	if ( (use_falloc_zero == 0) || (pass == 0) )
+	{
+		return -1;
+	}
+# ifndef ALL_PASSES_ZERO
+	if ( pass != passes )
+	{
+		/* only the additional last pass is all zeros */
+		return -1;
+	}
+# endif
+# ifdef FALLOC_FL_ZERO_RANGE
+	/* keeps the blocks in place (the devices which can do it get
+	   a request to zero them) and the file without holes */
+	if ( __lsr_fallocate_at (fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+		start, len) == 0 )
+	{
+		return 0;
+	}
+# endif
+# ifdef FALLOC_FL_PUNCH_HOLE
+	/* e.g. tmpfs - freeing the blocks lets the filesystem discard them */
+	if ( __lsr_fallocate_at (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		start, len) == 0 )
+	{
+		return 0;
+	}
+# endif
+	return -1;
+}
+#endif /* LSR_CAN_FALLOCATE_ZEROS */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (((defined LSR_CAN_USE_PWRITEV) \
+	&& (defined HAVE_MALLOC)) || (defined LSR_CAN_USE_DIRECT_IO))
+
+# ifdef LSR_CAN_USE_HUGE_PAGES
+#  ifndef MAP_ANONYMOUS
+#   define MAP_ANONYMOUS MAP_ANON
+#  endif
+#  define LSR_UNUSED_WITHOUT_HUGE_PAGES
+# else
+#  define LSR_UNUSED_WITHOUT_HUGE_PAGES LSR_ATTR ((unused))
+# endif
+
+# ifndef LSR_ANSIC
+static unsigned char * __lsr_alloc_huge LSR_PARAMS ((const off64_t len));
+# endif
+
+/**
+ * Allocates a buffer of N_HUGE_BYTES in a huge page for wiping a large
+ *	region, so that copying the data to the kernel doesn't need a page
+ *	walk for each 4kB. Uses a reserved huge page (MAP_HUGETLB), if
+ *	possible, or a 2MB-aligned mapping eligible for a transparent huge page.
+ * \param len The length of the region to be wiped.
+ * \return the buffer, or NULL if the region is too small or no buffer
+ *	could be mapped (the caller should use a normal one then).
+ */
+static unsigned char *
+__lsr_alloc_huge (
+# ifdef LSR_ANSIC
+	const off64_t len LSR_UNUSED_WITHOUT_HUGE_PAGES)
+# else
+	len)
+	const off64_t len LSR_UNUSED_WITHOUT_HUGE_PAGES;
+# endif
+{
+# ifdef LSR_CAN_USE_HUGE_PAGES
+	unsigned char * map;
+	unsigned char * buf;
+	size_t head;
+
+	if ( len < LSR_HUGE_MIN_BYTES )
+	{
+		return NULL;
+	}
+#  ifdef MAP_HUGETLB
+	map = (unsigned char *) mmap (NULL, LSR_HUGE_PAGE_SIZE,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if ( map != (unsigned char *) MAP_FAILED )
+	{
+		return map;
+	}
+#  endif
+	/* no reserved huge pages - map twice the size and keep
+	   the aligned part, which the kernel can back with a huge page */
+	map = (unsigned char *) mmap (NULL, 2 * LSR_HUGE_PAGE_SIZE,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( map == (unsigned char *) MAP_FAILED )
+	{
+		return NULL;
+	}
+	head = (LSR_HUGE_PAGE_SIZE - ((size_t) map % LSR_HUGE_PAGE_SIZE))
+		% LSR_HUGE_PAGE_SIZE;
+	buf = map + head;
+	if ( head != 0 )
+	{
+		munmap (map, head);
+	}
+	munmap (buf + LSR_HUGE_PAGE_SIZE, LSR_HUGE_PAGE_SIZE - head);
+#  if (defined HAVE_MADVISE) && (defined MADV_HUGEPAGE)
+	madvise (buf, LSR_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#  endif
+	return buf;
+# else
+	return NULL;
+# endif /* LSR_CAN_USE_HUGE_PAGES */
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_free_staging LSR_PARAMS ((void * const buf,
+	const int mapped));
+# endif
+
+/**
+ * Frees a buffer used for wiping.
+ * \param buf The buffer.
+ * \param mapped Non-zero if the buffer was allocated by __lsr_alloc_huge().
+ */
+static void
+__lsr_free_staging (
+# ifdef LSR_ANSIC
+	void * const buf, const int mapped LSR_UNUSED_WITHOUT_HUGE_PAGES)
+# else
+	buf, mapped)
+	void * const buf;
+	const int mapped LSR_UNUSED_WITHOUT_HUGE_PAGES;
+# endif
+{
+# ifdef LSR_CAN_USE_HUGE_PAGES
+	if ( mapped != 0 )
+	{
+		munmap (buf, LSR_HUGE_PAGE_SIZE);
+		return;
+	}
+# endif
+	free (buf);
+}
+
+#endif /* HAVE_UNISTD_H && ((LSR_CAN_USE_PWRITEV && HAVE_MALLOC) || LSR_CAN_USE_DIRECT_IO) */
+
+/* =============================================================== */
+
+#ifndef LSR_CAN_MANAGE_LEASES
+# ifndef LSR_ANSIC
+
+#  ifdef HAVE_SIGNAL_H
+#   if (defined __STRICT_ANSI__)
+typedef void (*sighandler_t) LSR_PARAMS ((int));
+#   endif
+#  else		/* ! HAVE_SIGNAL_H */
+/* dummy types: */
+typedef void (*sighandler_t) LSR_PARAMS ((int));
+struct sigaction
+{
+	void     (*sa_handler) LSR_PARAMS ((int));
+}
+#  endif		/* HAVE_SIGNAL_H */
+
+static int __lsr_set_signal_lock
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	LSR_PARAMS (( int * const fcntl_signal, const int fd,
+		int * const fcntl_signal_old,
+		struct sigaction * const sa,
+		struct sigaction * const old_sa,
+		int * const res_sig
+	));
+#  else
+	LSR_PARAMS (( int * const fcntl_signal, const int fd,
+		int * const fcntl_signal_old, sighandler_t * const sig_hndlr
+	));
+#  endif
+
+static void __lsr_unset_signal_unlock
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	LSR_PARAMS (( const int fcntl_signal, const int fd,
+		const int fcntl_sig_old,
+		const struct sigaction * const old_sa,
+		const int res_sig
+	));
+#  else
+	LSR_PARAMS (( const int fcntl_signal, const int fd,
+		const int fcntl_sig_old, const sighandler_t * const sig_hndlr
+	));
+#  endif
+
+# endif
+
+/* ======================================================= */
+
+# if (defined HAVE_SIGNAL_H) && (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
+#  ifndef RETSIGTYPE
+#   define RETSIGTYPE void
+#  endif
+/* Signal-related stuff */
+#  ifndef LSR_ANSIC
+static RETSIGTYPE __lsr_fcntl_signal_received LSR_PARAMS((const int signum));
+#  endif
+
+/**
+ * Signal handler - Sets a flag which will stop further program operations, when a
+ * signal which would normally terminate the program is received.
+ * \param signum Signal number.
+ */
+static RETSIGTYPE
+__lsr_fcntl_signal_received (
+#  ifdef LSR_ANSIC
+	const int signum )
+#  else
+	signum )
+	const int signum;
+#  endif
+{
+	sig_recvd = signum;
+#  define void 1
+#  define int 2
+#  if RETSIGTYPE != void
+	return 0;
+#  endif
+#  undef int
+#  undef void
+}
+# endif /* HAVE_SIGNAL_H && HAVE_FCNTL_H && F_SETLEASE */
+
+# if ! ((defined HAVE_FCNTL_H) && (defined F_SETLEASE)		&& \
+	(defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_GETSIG) && \
+	(defined HAVE_DECL_F_SETSIG) && HAVE_DECL_F_GETSIG && HAVE_DECL_F_SETSIG)
+#  define LSR_ONLY_WITH_FCNTL_SIGNALS	LSR_ATTR((unused))
+# else
+#  define LSR_ONLY_WITH_FCNTL_SIGNALS
+# endif
+
+/* =========== Setting signal handler and file lock ============== */
+
+static int __lsr_set_signal_lock (
+# ifdef LSR_ANSIC
+	int * const fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS,
+	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS,
+	int * const fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	, struct sigaction * const sa LSR_ONLY_WITH_FCNTL_SIGNALS,
+	struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS,
+	int * const res_sig LSR_ONLY_WITH_FCNTL_SIGNALS
+#  else
+	, sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS
+#  endif
+	)
+# else
+	fcntl_signal, fd, fcntl_sig_old
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	, sa, old_sa, res_sig
+#  else
+	, sig_hndlr
+#  endif
+	)
+	int * const fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS;
+	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS;
+	int * const fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	struct sigaction * const sa LSR_ONLY_WITH_FCNTL_SIGNALS;
+	struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS;
+	int * const res_sig LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  else
+	sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  endif
+# endif
+{
+	int res = -1;
+
+# if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
+	int res_fcntl = 0;
+#  if (defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_GETSIG) && \
+	(defined HAVE_DECL_F_SETSIG) && HAVE_DECL_F_GETSIG && HAVE_DECL_F_SETSIG
+
+	if ( (fcntl_signal == NULL) || (fcntl_sig_old == NULL) )
+	{
+		return res;
+	}
+#   if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	if ( (sa == NULL) || (old_sa == NULL) || (res_sig == NULL) )
+	{
+		return res;
+	}
+#   else
+	if ( sig_hndlr == NULL )
+	{
+		return res;
+	}
+#   endif
+	res = 0;
+	*fcntl_signal = fcntl (fd, F_GETSIG);
+
+	if ( *fcntl_signal == 0 )
+	{
+#   ifdef SIGIO
+		*fcntl_signal = SIGIO;
+#   else
+		*fcntl_signal = SIGPOLL; /* POSIX, so available */
+#   endif
+	}
+	/* replace the uncatchables */
+	if ( (*fcntl_signal == SIGSTOP) || (*fcntl_signal == SIGKILL) )
+	{
+		*fcntl_sig_old = *fcntl_signal;
+#   ifdef SIGIO
+		*fcntl_signal = SIGIO;
+#   else
+		*fcntl_signal = SIGTERM; /* POSIX, so available */
+#   endif
+		if ( fcntl (fd, F_SETSIG, *fcntl_signal) != 0 )
+		{
+			*fcntl_signal = 0;
+		}
+	}
+	else
+	{
+		*fcntl_sig_old = 0;
+	}
+
+#   if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
+	*sig_hndlr = signal ( *fcntl_signal, &__lsr_fcntl_signal_received );
+	if ( *sig_hndlr == SIG_ERR )
+	{
+		if ( *fcntl_sig_old != 0 )
+		{
+			fcntl (fd, F_SETSIG, *fcntl_sig_old);
+		}
+		res = -1;
+	}
+#   else
+	LSR_MEMSET (sa, 0, sizeof (struct sigaction));
+	(*sa).sa_handler = &__lsr_fcntl_signal_received;
+	*res_sig = sigaction ( *fcntl_signal, sa, old_sa );
+	if ( *res_sig != 0 )
+	{
+		if ( *fcntl_sig_old != 0 )
+		{
+			fcntl (fd, F_SETSIG, *fcntl_sig_old);
+		}
+		res = -1;
+	}
+
+#   endif
+#  endif	/* HAVE_SIGNAL_H */
+	res_fcntl = fcntl (fd, F_SETLEASE, F_WRLCK);
+	if ( res_fcntl != 0 )
+	{
+		if ( *fcntl_sig_old != 0 )
+		{
+			fcntl (fd, F_SETSIG, *fcntl_sig_old);
+		}
+		res = -2;
+	}
+# endif	/* (defined HAVE_FCNTL_H) && (defined F_SETLEASE) */
+
+	return res;
+}
+
+
+/* =========== Resetting signal handler and releasing file lock ============== */
+
+static void __lsr_unset_signal_unlock (
+# ifdef LSR_ANSIC
+	const int fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS,
+	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS,
+	const int fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	, const struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS,
+	const int res_sig LSR_ONLY_WITH_FCNTL_SIGNALS
+#  else
+	, const sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS
+#  endif
+	)
+# else
+	fcntl_signal, fd, fcntl_sig_old
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	, old_sa, res_sig
+#  else
+	, sig_hndlr
+#  endif
+	)
+	const int fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS;
+	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS;
+	const int fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	const struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS;
+	const int res_sig LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  else
+	const sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS;
+#  endif
+# endif
+{
+# if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
+#  if (defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_SETSIG) && (HAVE_DECL_F_SETSIG)
+	fcntl (fd, F_SETLEASE, F_UNLCK);
+
+#   if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
+	if ( sig_hndlr != SIG_ERR )
+	{
+		if ( (fcntl_sig_old == 0) || (fcntl_signal != 0) )
+		{
+			signal ( fcntl_signal, sig_hndlr );
+		}
+		else
+		{
+			signal ( fcntl_sig_old, sig_hndlr );
+		}
+	}
+#   else
+	if ( res_sig == 0 )
+	{
+		if ( (fcntl_sig_old == 0) || (fcntl_signal != 0) )
+		{
+			sigaction ( fcntl_signal, old_sa, NULL );
+		}
+		else
+		{
+			sigaction ( fcntl_sig_old, old_sa, NULL );
+		}
+	}
+#   endif
+	if ( fcntl_sig_old != 0 )
+	{
+		fcntl (fd, F_SETSIG, fcntl_sig_old);
+	}
+#  endif		/* HAVE_SIGNAL_H */
+# endif
+}
+#endif /* ! LSR_CAN_MANAGE_LEASES */
+
+/* ======================================================= */
+
+#ifdef LSR_CAN_MANAGE_LEASES
+/* The lease manager: one handler for one realtime signal, set up once,
+   gets the breaks of the leases of all the wipes. The signal is directed
+   to the wiping thread and carries the descriptor, which selects the
+   cancellation token of the wipe, so that concurrent wipes don't disturb
+   each other. */
+static pthread_once_t lease_once = PTHREAD_ONCE_INIT;
+static int lease_signal = 0;	/* the signal of the lease breaks, 0 if none */
+static __thread pid_t lease_tid = 0;	/* the ID of the current thread, 0 if unknown */
+
+# ifndef LSR_ANSIC
+static void __lsr_lease_broken LSR_PARAMS ((const int signum,
+	siginfo_t * const info, void * const context));
+# endif
+
+/**
+ * Signal handler - cancels the wipe of the file whose lease is being broken.
+ * \param signum Signal number.
+ * \param info The information about the signal, with the file descriptor.
+ * \param context The context of the signal (unused).
+ */
+static void
+__lsr_lease_broken (
+# ifdef LSR_ANSIC
+	const int signum, siginfo_t * const info,
+	void * const context LSR_ATTR ((unused)))
+# else
+	signum, info, context)
+	const int signum;
+	siginfo_t * const info;
+	void * const context LSR_ATTR ((unused));
+# endif
+{
+	unsigned int i;
+
+	if ( info == NULL )
+	{
+		return;
+	}
+	for ( i = 0; i < LSR_MAX_WIPES; i++ )
+	{
+		if ( wipe_tokens[i].fd == info->si_fd )
+		{
+			wipe_tokens[i].cancelled = signum;
+		}
+	}
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_lease_init LSR_PARAMS ((void));
+# endif
+
+/**
+ * Sets up the lease manager: installs the handler of the lease breaks
+ *	for the highest realtime signal not used by the program.
+ */
+static void
+__lsr_lease_init (LSR_VOID)
+{
+	struct sigaction sa;
+	struct sigaction old_sa;
+	unsigned int i;
+	int sig;
+
+	for ( i = 0; i < LSR_MAX_WIPES; i++ )
+	{
+		wipe_tokens[i].fd = -1;
+		wipe_tokens[i].cancelled = 0;
+	}
+	LSR_MEMSET (&sa, 0, sizeof (struct sigaction));
+	sa.sa_sigaction = &__lsr_lease_broken;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset (&sa.sa_mask);
+	/* the programs usually take the realtime signals from the lowest one */
+	for ( sig = SIGRTMAX; sig >= SIGRTMIN; sig-- )
+	{
+		if ( (sigaction (sig, NULL, &old_sa) == 0)
+			&& ((old_sa.sa_flags & SA_SIGINFO) == 0)
+			&& (old_sa.sa_handler == SIG_DFL)
+			&& (sigaction (sig, &sa, NULL) == 0) )
+		{
+			lease_signal = sig;
+			break;
+		}
+	}
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_lease_take_pending LSR_PARAMS ((void));
+# endif
+
+/**
+ * Handles the lease breaks which are still pending, e.g. because the program
+ *	blocks the signal of the lease manager. Otherwise they would be delivered
+ *	later and cancel another wipe of the same descriptor.
+ */
+static void
+__lsr_lease_take_pending (LSR_VOID)
+{
+# if (defined HAVE_SIGPENDING) && (defined HAVE_SIGTIMEDWAIT)
+	sigset_t pending;
+	sigset_t lease_set;
+	siginfo_t info;
+	struct timespec no_wait;
+
+	if ( (sigpending (&pending) != 0)
+		|| (sigismember (&pending, lease_signal) != 1) )
+	{
+		return;
+	}
+	sigemptyset (&lease_set);
+	sigaddset (&lease_set, lease_signal);
+	no_wait.tv_sec = 0;
+	no_wait.tv_nsec = 0;
+	while ( sigtimedwait (&lease_set, &info, &no_wait) == lease_signal )
+	{
+		/* as if delivered now, while the tokens are still taken */
+		__lsr_lease_broken (lease_signal, &info, NULL);
+	}
+# endif
+}
+#endif /* LSR_CAN_MANAGE_LEASES */
+
+/* ======================================================= */
+
+/* The lease on a file being wiped and what's needed to release it. */
+struct lsr_lease
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	struct lsr_wipe_token * token;
+	/* the owner and the signal of the file before the lease, to restore */
+	struct f_owner_ex old_owner;
+	int old_owner_set;
+	int old_sig;
+#else
+# ifdef HAVE_SIGNAL_H
+	int fcntl_signal;
+	int fcntl_sig_old;
+#  if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
+	sighandler_t sig_hndlr;
+#  else
+	struct sigaction sa;
+	struct sigaction old_sa;
+#  endif
+# endif
+# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+	int res_sig;
+# endif
+#endif
+};
+
+#ifndef LSR_ANSIC
+static int __lsr_lease_take LSR_PARAMS ((const int fd,
+	struct lsr_lease * const lease));
+#endif
+
+/**
+ * Takes a write lease on the file about to be wiped, so that the wipe
+ *	gets cancelled when another process opens the file. With the lease
+ *	manager, the lease breaks are sent only to the current thread and
+ *	cancel only this wipe.
+ * \param fd The file descriptor of the file.
+ * \param lease The place for the lease.
+ * \return 0 if the lease was taken, -1 otherwise (the file mustn't be
+ *	wiped then).
+ */
+static int
+__lsr_lease_take (
+#ifdef LSR_ANSIC
+	const int fd, struct lsr_lease * const lease)
+#else
+	fd, lease)
+	const int fd;
+	struct lsr_lease * const lease;
+#endif
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	struct f_owner_ex owner;
+	unsigned int i;
+
+	pthread_once (&lease_once, &__lsr_lease_init);
+	if ( lease_signal == 0 )
+	{
+		return -1;
+	}
+	lease->token = NULL;
+	pthread_mutex_lock (&wipe_tokens_lock);
+	for ( i = 0; i < LSR_MAX_WIPES; i++ )
+	{
+		if ( wipe_tokens[i].fd == -1 )
+		{
+			wipe_tokens[i].cancelled = 0;
+			wipe_tokens[i].fd = fd;
+			lease->token = &wipe_tokens[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock (&wipe_tokens_lock);
+	if ( lease->token == NULL )
+	{
+		/* too many wipes at once */
+		return -1;
+	}
+	/* the program may use the signals of the descriptor itself */
+	lease->old_sig = fcntl (fd, F_GETSIG);
+	if ( lease->old_sig < 0 )
+	{
+		lease->old_sig = 0;
+	}
+	lease->old_owner_set = (fcntl (fd, F_GETOWN_EX, &(lease->old_owner)) == 0) ? 1 : 0;
+	if ( (fcntl (fd, F_SETSIG, lease_signal) != 0)
+		|| (fcntl (fd, F_SETLEASE, F_WRLCK) != 0) )
+	{
+		fcntl (fd, F_SETSIG, lease->old_sig);
+		lease->token->fd = -1;
+		return -1;
+	}
+	/* taking the lease has made the whole process the owner of the file
+	   - direct the breaks to this thread */
+	if ( lease_tid == 0 )
+	{
+		lease_tid = (pid_t) syscall (__NR_gettid);
+	}
+	owner.type = F_OWNER_TID;
+	owner.pid = lease_tid;
+	fcntl (fd, F_SETOWN_EX, &owner);
+	__lsr_set_wipe_token (lease->token);
+	return 0;
+#else
+	return (__lsr_set_signal_lock ( &(lease->fcntl_signal), fd,
+		&(lease->fcntl_sig_old)
+# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+		, &(lease->sa), &(lease->old_sa), &(lease->res_sig)
+# else
+		, &(lease->sig_hndlr)
+# endif
+		) != 0) ? -1 : 0;
+#endif
+}
+
+/* ======================================================= */
+
+#ifndef LSR_ANSIC
+static sig_atomic_t __lsr_lease_release LSR_PARAMS ((const int fd,
+	struct lsr_lease * const lease));
+#endif
+
+/**
+ * Releases the lease on the wiped file.
+ * \param fd The file descriptor of the file.
+ * \param lease The lease taken by __lsr_lease_take().
+ * \return the signal which has cancelled the wipe, 0 if none.
+ */
+static sig_atomic_t
+__lsr_lease_release (
+#ifdef LSR_ANSIC
+	const int fd, struct lsr_lease * const lease)
+#else
+	fd, lease)
+	const int fd;
+	struct lsr_lease * const lease;
+#endif
+{
+#ifdef LSR_CAN_MANAGE_LEASES
+	sig_atomic_t cancelled;
+
+	fcntl (fd, F_SETLEASE, F_UNLCK);
+	/* no more breaks can come now - the ones not delivered yet
+	   belong to this wipe, not to the next one of the descriptor */
+	__lsr_lease_take_pending ();
+	cancelled = lease->token->cancelled;
+	fcntl (fd, F_SETSIG, lease->old_sig);
+	if ( lease->old_owner_set != 0 )
+	{
+		fcntl (fd, F_SETOWN_EX, &(lease->old_owner));
+	}
+	__lsr_set_wipe_token (NULL);
+	lease->token->fd = -1;
+	return cancelled;
+#else
+	__lsr_unset_signal_unlock ( lease->fcntl_signal, fd, lease->fcntl_sig_old
+# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
+		, &(lease->old_sa), lease->res_sig
+# else
+		, &(lease->sig_hndlr)
+# endif
+		);
+	return __lsr_sig_recvd ();
+#endif
+}
+
+/* ======================================================= */
+
+#ifdef LSR_CAN_USE_DIRECT_IO
+# ifndef LSR_ANSIC
+static void __lsr_cancel_wipe LSR_PARAMS ((void));
+# endif
+
+/**
+ * Cancels the wipe done by the current thread, like a break of its lease.
+ */
+static void
+__lsr_cancel_wipe (LSR_VOID)
+{
+# ifdef LSR_CAN_MANAGE_LEASES
+	if ( wipe_token != NULL )
+	{
+		wipe_token->cancelled = lease_signal;
+	}
+# else
+	sig_recvd = 1;
+# endif
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_lease_suspend LSR_PARAMS ((const int fd));
+# endif
+
+/**
+ * Gives the lease on the file being wiped back for a while, so that
+ *	the file can be opened again by the wipe itself (opening it would
+ *	break the lease otherwise).
+ * \param fd The file descriptor of the file.
+ */
+static void
+__lsr_lease_suspend (
+# ifdef LSR_ANSIC
+	const int fd)
+# else
+	fd)
+	const int fd;
+# endif
+{
+# if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
+	fcntl (fd, F_SETLEASE, F_UNLCK);
+# endif
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_lease_resume LSR_PARAMS ((const int fd));
+# endif
+
+/**
+ * Takes the lease given back by __lsr_lease_suspend() again. If the file
+ *	has been opened by someone else in the meantime, the lease can't be
+ *	taken and the wipe gets cancelled.
+ * \param fd The file descriptor of the file.
+ * \return 0 if the lease was taken, -1 otherwise.
+ */
+static int
+__lsr_lease_resume (
+# ifdef LSR_ANSIC
+	const int fd)
+# else
+	fd)
+	const int fd;
+# endif
+{
+# ifdef LSR_CAN_MANAGE_LEASES
+	struct f_owner_ex owner;
+
+	if ( fcntl (fd, F_SETLEASE, F_WRLCK) != 0 )
+	{
+		__lsr_cancel_wipe ();
+		return -1;
+	}
+	/* taking the lease has made the whole process the owner again */
+	owner.type = F_OWNER_TID;
+	owner.pid = lease_tid;
+	fcntl (fd, F_SETOWN_EX, &owner);
+# else
+#  if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
+	if ( fcntl (fd, F_SETLEASE, F_WRLCK) != 0 )
+	{
+		__lsr_cancel_wipe ();
+		return -1;
+	}
+#  endif
+# endif
+	return 0;
+}
+#endif /* LSR_CAN_USE_DIRECT_IO */
+
+/* ======================================================= */
+
+#ifdef HAVE_UNISTD_H
+# ifndef LSR_ANSIC
+static void __lsr_sync_pass LSR_PARAMS ((const int fd));
+# endif
+
+/**
+ * Makes sure that the pass which has just been written reaches the disk
+ *	before the next one, in the way selected by the synchronization mode.
+ *	In the mode LSR_SYNC_END, writing a pass waits only for the previous
+ *	one to be written. Without sync_file_range(), the modes LSR_SYNC_RANGE
+ *	and LSR_SYNC_END fall back to fdatasync() after each pass.
+ * \param fd The file descriptor to synchronize.
+ */
+static void
+__lsr_sync_pass (
+# ifdef LSR_ANSIC
+	const int fd)
+# else
+	fd)
+	const int fd;
+# endif
+{
+# ifdef LSR_CAN_USE_SYNC_FILE_RANGE
+	if ( sync_mode == LSR_SYNC_RANGE )
+	{
+		/* write the data and wait for it, skipping the metadata */
+		sync_file_range (fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE
+			| SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		return;
+	}
+	if ( sync_mode == LSR_SYNC_END )
+	{
+		/* wait for the previous pass and start writing this one */
+		sync_file_range (fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE
+			| SYNC_FILE_RANGE_WRITE);
+		return;
+	}
+# endif
+# ifdef HAVE_FDATASYNC
+	if ( sync_mode != LSR_SYNC_FSYNC )
+	{
+		fdatasync (fd);
+		return;
+	}
+# endif
+	fsync (fd);
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_sync_final LSR_PARAMS ((const int fd));
+# endif
+
+/**
+ * Finishes synchronizing the wiped file with the disk, when the
+ *	synchronization mode doesn't do it fully after each pass.
+ * \param fd The file descriptor to synchronize.
+ */
+static void
+__lsr_sync_final (
+# ifdef LSR_ANSIC
+	const int fd)
+# else
+	fd)
+	const int fd;
+# endif
+{
+	if ( sync_mode == LSR_SYNC_END )
+	{
+		fsync (fd);
+	}
+# ifdef LSR_CAN_USE_SYNC_FILE_RANGE
+	else if ( sync_mode == LSR_SYNC_RANGE )
+	{
+		/* flush the disk's cache, too */
+#  ifdef HAVE_FDATASYNC
+		fdatasync (fd);
+#  else
+		fsync (fd);
+#  endif
+	}
+# endif
+}
+
+/* ======================================================= */
+
+struct lsr_writeback
+{
+	off64_t dropped;	/* the data before this is out of the page cache */
+	off64_t started;	/* the writeback of the data before this has started */
+};
+
+# ifndef LSR_ANSIC
+static void __lsr_writeback_init LSR_PARAMS ((
+	struct lsr_writeback * const wb, const off64_t start));
+# endif
+
+/**
+ * Starts tracking the writeback of a region being written sequentially.
+ * \param wb The writeback state to initialize.
+ * \param start The offset of the region in the file.
+ */
+static void
+__lsr_writeback_init (
+# ifdef LSR_ANSIC
+	struct lsr_writeback * const wb, const off64_t start)
+# else
+	wb, start)
+	struct lsr_writeback * const wb;
+	const off64_t start;
+# endif
+{
+	wb->dropped = start;
+	wb->started = start;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_writeback_drop LSR_PARAMS ((const int fd,
+	struct lsr_writeback * const wb, const off64_t end));
+# endif
+
+/**
+ * Waits for the data up to the given offset to be written and then
+ *	removes it from the page cache.
+ * \param fd The file descriptor being written.
+ * \param wb The writeback state.
+ * \param end The offset of the end of the data to drop.
+ */
+static void
+__lsr_writeback_drop (
+# ifdef LSR_ANSIC
+	const int fd LSR_ONLY_WITH_WRITEBACK,
+	struct lsr_writeback * const wb, const off64_t end)
+# else
+	fd, wb, end)
+	const int fd LSR_ONLY_WITH_WRITEBACK;
+	struct lsr_writeback * const wb;
+	const off64_t end;
+# endif
+{
+# ifdef LSR_CAN_USE_WRITEBACK
+	if ( end > wb->dropped )
+	{
+		sync_file_range (fd, wb->dropped, end - wb->dropped,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+			| SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise64 (fd, wb->dropped, end - wb->dropped,
+			POSIX_FADV_DONTNEED);
+	}
+# endif
+	wb->dropped = end;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_writeback_advance LSR_PARAMS ((const int fd,
+	struct lsr_writeback * const wb, const off64_t written));
+# endif
+
+/**
+ * Keeps the amount of the written data in the page cache bounded: when
+ *	a full window has been written, starts its writeback and drops
+ *	the previous window (whose writeback has been started before).
+ * \param fd The file descriptor being written.
+ * \param wb The writeback state.
+ * \param written The offset up to which the data has been written.
+ */
+static void
+__lsr_writeback_advance (
+# ifdef LSR_ANSIC
+	const int fd LSR_ONLY_WITH_WRITEBACK,
+	struct lsr_writeback * const wb, const off64_t written)
+# else
+	fd, wb, written)
+	const int fd LSR_ONLY_WITH_WRITEBACK;
+	struct lsr_writeback * const wb;
+	const off64_t written;
+# endif
+{
+# ifdef LSR_CAN_USE_WRITEBACK
+	if ( (writeback_window == 0)
+		|| (written - wb->started < (off64_t) writeback_window) )
+	{
+		return;
+	}
+	sync_file_range (fd, wb->started, written - wb->started,
+		SYNC_FILE_RANGE_WRITE);
+	__lsr_writeback_drop (fd, wb, wb->started);
+# endif
+	wb->started = written;
+}
+
+/* ======================================================= */
+
+# if (defined LSR_CAN_USE_IO_URING) && (defined HAVE_MALLOC)
+#  ifndef LSR_ANSIC
+static int __lsr_writeback_room LSR_PARAMS ((
+	const struct lsr_writeback * const wb, const off64_t written));
+#  endif
+
+/**
+ * Tells if more data can be written before the current window is full.
+ * \param wb The writeback state.
+ * \param written The offset up to which the data has been written (or queued).
+ * \return non-zero if more data can be written, 0 if the window is full
+ *	and has to be passed to __lsr_writeback_advance() first.
+ */
+static int
+__lsr_writeback_room (
+#  ifdef LSR_ANSIC
+	const struct lsr_writeback * const wb LSR_ONLY_WITH_WRITEBACK,
+	const off64_t written LSR_ONLY_WITH_WRITEBACK)
+#  else
+	wb, written)
+	const struct lsr_writeback * const wb LSR_ONLY_WITH_WRITEBACK;
+	const off64_t written LSR_ONLY_WITH_WRITEBACK;
+#  endif
+{
+#  ifdef LSR_CAN_USE_WRITEBACK
+	if ( (writeback_window != 0)
+		&& (written - wb->started >= (off64_t) writeback_window) )
+	{
+		return 0;
+	}
+#  endif
+	return 1;
+}
+# endif /* LSR_CAN_USE_IO_URING && HAVE_MALLOC */
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_writeback_finish LSR_PARAMS ((const int fd,
+	struct lsr_writeback * const wb, const off64_t written));
+# endif
+
+/**
+ * Drops all the written data from the page cache, after it's been written.
+ * \param fd The file descriptor being written.
+ * \param wb The writeback state.
+ * \param written The offset up to which the data has been written.
+ */
+static void
+__lsr_writeback_finish (
+# ifdef LSR_ANSIC
+	const int fd, struct lsr_writeback * const wb, const off64_t written)
+# else
+	fd, wb, written)
+	const int fd;
+	struct lsr_writeback * const wb;
+	const off64_t written;
+# endif
+{
+# ifdef LSR_CAN_USE_WRITEBACK
+	if ( writeback_window == 0 )
+	{
+		return;
+	}
+# endif
+	__lsr_writeback_drop (fd, wb, written);
+	wb->started = written;
+}
+#endif /* HAVE_UNISTD_H */
+
+/* ======================================================= */
+
+#ifdef HAVE_UNISTD_H
+# ifndef LSR_ANSIC
+static ssize_t __lsr_write_at LSR_PARAMS ((const int fd,
+	const unsigned char * const buf, const size_t len,
+	const off64_t offset));
+# endif
+
+/**
+ * Writes the given buffer to the file at the given offset. The file
+ *	position of the descriptor is not changed when pwrite() is available.
+ * \param fd The file descriptor to write to.
+ * \param buf The buffer to write.
+ * \param len The length of the buffer.
+ * \param offset The offset in the file to write at.
+ * \return the number of bytes written or -1 on error.
+ */
+static ssize_t
+__lsr_write_at (
+# ifdef LSR_ANSIC
+	const int fd, const unsigned char * const buf, const size_t len,
+	const off64_t offset)
+# else
+	fd, buf, len, offset)
+	const int fd;
+	const unsigned char * const buf;
+	const size_t len;
+	const off64_t offset;
+# endif
+{
+	__lsr_throttle (len);
+# ifdef LSR_CAN_USE_PWRITE
+	return pwrite64 (fd, buf, len, offset);
+# else
+	if ( lseek64 (fd, offset, SEEK_SET) != offset )
+	{
+		/* Unable to set current file position. */
+		return -1;
+	}
+	return write (fd, buf, len);
+# endif
+}
+#endif /* HAVE_UNISTD_H */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_PWRITEV) && (defined HAVE_MALLOC)
+# ifndef LSR_ANSIC
+static int __lsr_pwritev_region LSR_PARAMS ((const int fd,
+	unsigned char * const buf, const size_t buflen,
+	struct iovec * const iov, const off64_t origin,
+	const off64_t start, const off64_t len,
+	const unsigned long int stream));
+# endif
+
+/**
+ * Writes copies of the given buffer over the given region of the file, with
+ *	many copies per system call. The buffer is phase-aligned with the given
+ *	origin: the byte at offset (origin + k) gets the value of buf[k % buflen].
+ * \param fd The file descriptor to write to.
+ * \param buf The buffer with the rendered pattern.
+ * \param buflen The length of the buffer, a multiple of the pattern length.
+ * \param iov An array of N_IOVECS I/O vectors to use.
+ * \param origin The offset the pattern is aligned to, at or before start.
+ *	Different from start when only a part of a wiped region is written.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param stream The random stream of a random pass, which doesn't repeat:
+ *	the buffer is then filled again before each write. 0 if the buffer
+ *	holds a fixed pattern.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_pwritev_region (
+# ifdef LSR_ANSIC
+	const int fd, unsigned char * const buf, const size_t buflen,
+	struct iovec * const iov, const off64_t origin,
+	const off64_t start, const off64_t len,
+	const unsigned long int stream)
+# else
+	fd, buf, buflen, iov, origin, start, len, stream)
+	const int fd;
+	unsigned char * const buf;
+	const size_t buflen;
+	struct iovec * const iov;
+	const off64_t origin;
+	const off64_t start;
+	const off64_t len;
+	const unsigned long int stream;
+# endif
+{
+	off64_t done = 0;
+	off64_t left;
+	size_t phase;
+	size_t write_len;
+	int niov;
+	ssize_t write_res;
+	struct lsr_writeback wb;
+
+	__lsr_writeback_init (&wb, start);
+	while ( (done < len) && (__lsr_sig_recvd () == 0) )
+	{
+		left = len - done;
+# ifdef LSR_CAN_USE_WRITEBACK
+		if ( (writeback_window != 0) && (left > (off64_t) writeback_window) )
+		{
+			/* don't dirty more than a window at once */
+			left = (off64_t) writeback_window;
+		}
+# endif
+		if ( stream != 0 )
+		{
+			/* one freshly generated buffer per write */
+			if ( left > (off64_t)buflen )
+			{
+				left = (off64_t)buflen;
+			}
+			__lsr_fill_stream_at (stream, buf, (size_t)left, start + done);
+		}
+		/* the first vector may start in the middle of the buffer */
+		phase = (stream != 0) ? 0 :
+			(size_t) ((start - origin + done) % (off64_t)buflen);
+		write_len = 0;
+		for ( niov = 0; (niov < N_IOVECS) && (left > 0); niov++ )
+		{
+			iov[niov].iov_base = buf + phase;
+			iov[niov].iov_len = buflen - phase;
+			if ( (off64_t)iov[niov].iov_len > left )
+			{
+				iov[niov].iov_len = (size_t)left;
+			}
+			left -= (off64_t)iov[niov].iov_len;
+			write_len += iov[niov].iov_len;
+			phase = 0;
+		}
+		__lsr_throttle (write_len);
+		write_res = pwritev64 (fd, iov, niov, start + done);
+		if ( write_res <= 0 )
+		{
+			return -1;
+		}
+		done += write_res;
+		__lsr_writeback_advance (fd, &wb, start + done);
+	}
+	if ( done < len )
+	{
+		return -1;
+	}
+	__lsr_writeback_finish (fd, &wb, start + done);
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_vec LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given (large) region of the file with all the passes, using
+ *	scatter-gather writes of a single phase-aligned pattern buffer.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if no memory could be allocated,
+ *	-2 if a write has failed and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_vec (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char /*@only@*/ *buf;
+	unsigned char *data;
+	struct iovec /*@only@*/ *iov;
+	unsigned int j;
+	unsigned long int stream;
+	size_t buflen = N_HUGE_BYTES;
+	int mapped = 1;
+	int res = 0;
+
+	/* the random passes write the whole buffer at once, so a big
+	   region gets a big buffer, in a huge page if possible */
+	buf = __lsr_alloc_huge (len);
+	if ( buf == NULL )
+	{
+		buflen = N_PAGE_BYTES;
+		mapped = 0;
+		buf = (unsigned char *) malloc ( sizeof(unsigned char) * buflen );
+	}
+	if ( buf == NULL )
+	{
+		return -1;
+	}
+	iov = (struct iovec *) malloc ( sizeof(struct iovec) * N_IOVECS );
+	if ( iov == NULL )
+	{
+		__lsr_free_staging (buf, mapped);
+		return -1;
+	}
+
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			data = __lsr_get_zero_data (buf);
+			if ( __lsr_pwritev_region (fd, data, N_PAGE_BYTES,
+				iov, start, start, len, 0) == 0 )
+			{
+				/* this is the last pass and there was at
+				  least one pass before - sync unconditionally */
+				__lsr_sync_pass (fd);
+			}
+			else if ( __lsr_sig_recvd () == 0 )
+			{
+				res = -2;
+			}
+			break;
+		}
+# endif /* LAST_PASS_ZERO */
+		data = __lsr_get_pass_data (j, buf, schedule, &stream);
+		if ( __lsr_pwritev_region (fd, data,
+			(stream != 0) ? buflen : N_PAGE_BYTES,
+			iov, start, start, len, stream) != 0 )
+		{
+			if ( __lsr_sig_recvd () == 0 )
+			{
+				res = -2;
+			}
+			break;
+		}
+		if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+			/* if LAST_PASS_ZERO is defined, there will be
+			 one additionall pass with zeros, so sync no
+			 matter how many passes there are declared: */
+			|| (1 == 1)
+# endif
+			)
+		{
+			__lsr_sync_pass (fd);
+		}
+	}
+	free (iov);
+	__lsr_free_staging (buf, mapped);
+	return res;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_PWRITEV && HAVE_MALLOC */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_SPLICE)
+# ifndef LSR_ANSIC
+static int __lsr_open_pipe LSR_PARAMS ((int * const fds,
+	size_t * const capacity));
+# endif
+
+/**
+ * Opens a pipe for splicing, as big as allowed.
+ * \param fds The place for the two descriptors of the pipe.
+ * \param capacity The place for the number of bytes the pipe can hold.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_open_pipe (
+# ifdef LSR_ANSIC
+	int * const fds, size_t * const capacity)
+# else
+	fds, capacity)
+	int * const fds;
+	size_t * const capacity;
+# endif
+{
+# ifdef F_GETPIPE_SZ
+	int size;
+# endif
+
+# if (defined HAVE_PIPE2) && (defined O_CLOEXEC)
+	if ( pipe2 (fds, O_CLOEXEC) != 0 )
+# else
+	if ( pipe (fds) != 0 )
+# endif
+	{
+		return -1;
+	}
+	/* the default size (16 pages) is the minimum */
+	*capacity = 16 * 4096;
+# ifdef F_SETPIPE_SZ
+	/* a bigger pipe means fewer system calls, but it's not an error
+	   if the limit is lower */
+	fcntl (fds[1], F_SETPIPE_SZ, LSR_SPLICE_PIPE_BYTES);
+# endif
+# ifdef F_GETPIPE_SZ
+	size = fcntl (fds[1], F_GETPIPE_SZ);
+	if ( size > 0 )
+	{
+		*capacity = (size_t) size;
+	}
+# endif
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_close_pipe LSR_PARAMS ((int * const fds));
+# endif
+
+/**
+ * Closes the given pipe.
+ * \param fds The descriptors of the pipe.
+ */
+static void
+__lsr_close_pipe (
+# ifdef LSR_ANSIC
+	int * const fds)
+# else
+	fds)
+	int * const fds;
+# endif
+{
+	close (fds[0]);
+	close (fds[1]);
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static size_t __lsr_get_page_size LSR_PARAMS ((void));
+# endif
+
+/**
+ * Gets the size of a memory page.
+ * \return the size of a memory page.
+ */
+static size_t
+__lsr_get_page_size (LSR_VOID)
+{
+# ifdef HAVE_SYSCONF
+	return (size_t) sysconf (_SC_PAGESIZE);
+# else
+#  ifdef HAVE_GETPAGESIZE
+	return (size_t) getpagesize ();
+#  else
+	return 4096;
+#  endif
+# endif
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_splice_region LSR_PARAMS ((const int fd,
+	unsigned char * const data, const int gift,
+	const off64_t start, const off64_t len));
+# endif
+
+/**
+ * Writes a fixed pattern over the given region of the file without copying
+ *	it from the user space for each part of the region: the pattern is
+ *	loaded into a pipe once (with vmsplice()), duplicated into another pipe
+ *	(with tee(), which only adds references to the same pages) and spliced
+ *	from there into the file.
+ * \param fd The file descriptor to write to.
+ * \param data N_PAGE_BYTES of the rendered pattern, in phase with the region,
+ *	starting on a page boundary (the pattern pages or an aligned buffer).
+ * \param gift Non-zero if the data is never changed (the pattern pages),
+ *	so that the pages can be given to the kernel.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_splice_region (
+# ifdef LSR_ANSIC
+	const int fd, unsigned char * const data, const int gift,
+	const off64_t start, const off64_t len)
+# else
+	fd, data, gift, start, len)
+	const int fd;
+	unsigned char * const data;
+	const int gift;
+	const off64_t start;
+	const off64_t len;
+# endif
+{
+	int src[2];
+	int dst[2];
+	size_t src_cap;
+	size_t dst_cap;
+	size_t page;
+	size_t slots;
+	size_t loaded;
+	size_t filled;
+	size_t chunk;
+	size_t phase;
+	struct iovec iov;
+	ssize_t res;
+	ssize_t teed;
+	loff_t offset;
+	off64_t done = 0;
+	int ret = 0;
+	struct lsr_writeback wb;
+
+	if ( __lsr_open_pipe (src, &src_cap) != 0 )
+	{
+		return -1;
+	}
+	if ( __lsr_open_pipe (dst, &dst_cap) != 0 )
+	{
+		__lsr_close_pipe (src);
+		return -1;
+	}
+	/* whole copies of the buffer, so that each part of the region
+	   starts in the same phase. The capacity of a pipe is a number of
+	   slots, one for each page (or a part of a page) of the data. */
+	page = __lsr_get_page_size ();
+	slots = ((src_cap < dst_cap) ? src_cap : dst_cap) / page;
+	loaded = (slots / ((((size_t) data % page) + N_PAGE_BYTES + page - 1)
+		/ page)) * N_PAGE_BYTES;
+	if ( loaded == 0 )
+	{
+		__lsr_close_pipe (dst);
+		__lsr_close_pipe (src);
+		return -1;
+	}
+	if ( (off64_t) loaded > len )
+	{
+		loaded = (size_t) len;
+	}
+
+	/* load the pattern into the pipe, referencing the same pages,
+	   without waiting if the pipe still gets full */
+	for ( filled = 0; filled < loaded; )
+	{
+		phase = filled % N_PAGE_BYTES;
+		iov.iov_base = data + phase;
+		iov.iov_len = N_PAGE_BYTES - phase;
+		if ( iov.iov_len > loaded - filled )
+		{
+			iov.iov_len = loaded - filled;
+		}
+		res = vmsplice (src[1], &iov, 1, SPLICE_F_NONBLOCK
+			| ((gift != 0) ? SPLICE_F_GIFT : 0));
+		if ( res <= 0 )
+		{
+# ifdef HAVE_ERRNO_H
+			if ( (res < 0) && (errno == EAGAIN)
+				&& (filled >= N_PAGE_BYTES) )
+			{
+				/* use the whole copies which fit */
+				loaded = (filled / N_PAGE_BYTES) * N_PAGE_BYTES;
+				break;
+			}
+# endif
+			__lsr_close_pipe (dst);
+			__lsr_close_pipe (src);
+			return -1;
+		}
+		filled += (size_t) res;
+	}
+
+	__lsr_writeback_init (&wb, start);
+	while ( (done < len) && (__lsr_sig_recvd () == 0) )
+	{
+		chunk = loaded;
+		if ( (off64_t) chunk > len - done )
+		{
+			chunk = (size_t) (len - done);
+		}
+		teed = tee (src[0], dst[1], chunk, 0);
+		if ( (teed <= 0) || (((size_t) teed != chunk)
+			&& (((size_t) teed % N_PAGE_BYTES) != 0)) )
+		{
+			/* a part not ending on a whole copy of the buffer
+			   would put the next part out of phase */
+			ret = -1;
+			break;
+		}
+		while ( teed > 0 )
+		{
+			offset = (loff_t) (start + done);
+			__lsr_throttle ((size_t) teed);
+			res = splice (dst[0], NULL, fd, &offset, (size_t) teed,
+				SPLICE_F_MOVE);
+			if ( res <= 0 )
+			{
+				ret = -1;
+				break;
+			}
+			teed -= res;
+			done += res;
+		}
+		if ( ret != 0 )
+		{
+			break;
+		}
+		__lsr_writeback_advance (fd, &wb, start + done);
+	}
+	__lsr_close_pipe (dst);
+	__lsr_close_pipe (src);
+	if ( (ret != 0) || (done < len) )
+	{
+		return -1;
+	}
+	__lsr_writeback_finish (fd, &wb, start + done);
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_splice LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given (large) region of the file with all the passes, splicing
+ *	the fixed patterns into the file from a pipe. The random passes, which
+ *	don't repeat, are written with pwritev().
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if splicing can't be used and
+ *	the caller should fall back to other methods, -2 if a write has failed
+ *	and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_splice (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char /*@only@*/ *buf;
+	void /*@only@*/ *mem = NULL;
+	unsigned char *data;
+	struct iovec /*@only@*/ *iov;
+	unsigned int j;
+	unsigned long int stream;
+	int res;
+	int ret = 0;
+	size_t buflen = N_HUGE_BYTES;
+	int mapped = 1;
+
+	/* vmsplice() needs the data on page boundaries */
+	buf = __lsr_alloc_huge (len);
+	if ( buf == NULL )
+	{
+		buflen = N_PAGE_BYTES;
+		mapped = 0;
+		if ( __lsr_real_psx_memalign_loc () == NULL )
+		{
+			return -1;
+		}
+		if ( (*__lsr_real_psx_memalign_loc ()) (&mem,
+			__lsr_get_page_size (), sizeof(unsigned char) * buflen) != 0 )
+		{
+			return -1;
+		}
+		buf = (unsigned char *) mem;
+	}
+	iov = (struct iovec *) malloc ( sizeof(struct iovec) * N_IOVECS );
+	if ( iov == NULL )
+	{
+		__lsr_free_staging (buf, mapped);
+		return -1;
+	}
+
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			data = __lsr_get_zero_data (buf);
+			if ( __lsr_splice_region (fd, data, (data != buf) ? 1 : 0,
+				start, len) == 0 )
+			{
+				/* this is the last pass and there was at
+				  least one pass before - sync unconditionally */
+				__lsr_sync_pass (fd);
+			}
+			else if ( __lsr_sig_recvd () == 0 )
+			{
+				ret = -2;
+			}
+			break;
+		}
+# endif /* LAST_PASS_ZERO */
+		data = __lsr_get_pass_data (j, buf, schedule, &stream);
+		if ( stream != 0 )
+		{
+			res = __lsr_pwritev_region (fd, data, buflen,
+				iov, start, start, len, stream);
+		}
+		else
+		{
+			res = __lsr_splice_region (fd, data,
+				(data != buf) ? 1 : 0, start, len);
+		}
+		if ( res != 0 )
+		{
+			if ( (j == schedule->first) && (__lsr_sig_recvd () == 0) )
+			{
+				/* splicing doesn't work for this file
+				   - let the caller do the wiping */
+				free (iov);
+				__lsr_free_staging (buf, mapped);
+				return -1;
+			}
+			if ( __lsr_sig_recvd () == 0 )
+			{
+				ret = -2;
+			}
+			break;
+		}
+		if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+			/* if LAST_PASS_ZERO is defined, there will be
+			 one additionall pass with zeros, so sync no
+			 matter how many passes there are declared: */
+			|| (1 == 1)
+# endif
+			)
+		{
+			__lsr_sync_pass (fd);
+		}
+	}
+	free (iov);
+	__lsr_free_staging (buf, mapped);
+	return ret;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_SPLICE */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_THREADS)
+/* The workers of one wipe, started once and woken for each pass. */
+struct lsr_wipe_crew
+{
+	pthread_mutex_t lock;
+	pthread_cond_t go;	/* signalled when a new pass begins */
+	pthread_cond_t done;	/* signalled when the last worker ends its range */
+	unsigned long int pass;	/* the number of passes begun so far */
+	unsigned int pending;	/* the workers still writing the current pass */
+	int quit;		/* set when the wipe is over */
+};
+
+struct lsr_wipe_range
+{
+	unsigned char * buf;
+	unsigned char * data;	/* the data of the current pass: buf or the patterns */
+	struct iovec * iov;
+	const unsigned long int * stream;	/* the random stream of the current pass, common to all ranges */
+	struct lsr_wipe_token * token;	/* the cancellation token of the wipe */
+	struct lsr_wipe_crew * crew;
+	off64_t start;
+	off64_t len;
+	int fd;
+	int result;
+};
+
+# ifndef LSR_ANSIC
+static void __lsr_wipe_range LSR_PARAMS ((struct lsr_wipe_range * const range));
+# endif
+
+/**
+ * Writes one pass over the given range.
+ * \param range The range to wipe.
+ */
+static void
+__lsr_wipe_range (
+# ifdef LSR_ANSIC
+	struct lsr_wipe_range * const range)
+# else
+	range)
+	struct lsr_wipe_range * const range;
+# endif
+{
+	range->result = __lsr_pwritev_region (range->fd, range->data,
+		N_PAGE_BYTES, range->iov, range->start, range->start,
+		range->len, *(range->stream));
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void * __lsr_wipe_range_thread LSR_PARAMS ((void * arg));
+# endif
+
+/**
+ * The wiping thread's function: writes each pass over the thread's range,
+ *	waiting for the next pass in between, until the wipe is over.
+ * \param arg The range to wipe (struct lsr_wipe_range *).
+ * \return NULL.
+ */
+static void *
+__lsr_wipe_range_thread (
+# ifdef LSR_ANSIC
+	void * arg)
+# else
+	arg)
+	void * arg;
+# endif
+{
+	struct lsr_wipe_range * const range = (struct lsr_wipe_range *) arg;
+	struct lsr_wipe_crew * const crew = range->crew;
+	unsigned long int seen = 0;
+
+	__lsr_set_wipe_token (range->token);
+	pthread_mutex_lock (&(crew->lock));
+	while ( 1 )
+	{
+		while ( (crew->pass == seen) && (crew->quit == 0) )
+		{
+			pthread_cond_wait (&(crew->go), &(crew->lock));
+		}
+		if ( crew->quit != 0 )
+		{
+			break;
+		}
+		seen = crew->pass;
+		pthread_mutex_unlock (&(crew->lock));
+		__lsr_wipe_range (range);
+		pthread_mutex_lock (&(crew->lock));
+		crew->pending--;
+		if ( crew->pending == 0 )
+		{
+			pthread_cond_signal (&(crew->done));
+		}
+	}
+	pthread_mutex_unlock (&(crew->lock));
+	return NULL;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_threads LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given (very large) region of the file with all the passes,
+ *	splitting each pass into contiguous ranges written by separate threads.
+ *	The threads are started once for the whole wipe and the calling
+ *	thread writes the first range. Each pass ends when all the ranges
+ *	are written, followed by one sync.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if threads can't be used and
+ *	the caller should fall back to other methods, -2 if a write has failed
+ *	and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_threads (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char /*@only@*/ *buf;
+	unsigned char *data;
+	struct lsr_wipe_range /*@only@*/ *ranges;
+	pthread_t /*@only@*/ *threads;
+	int /*@only@*/ *started;
+	struct lsr_wipe_crew crew;
+	off64_t part;
+	unsigned int nthreads;
+	unsigned int nstarted = 0;
+	unsigned int i;
+	unsigned int j;
+	int res = 0;
+	unsigned long int stream = 0;
+
+	nthreads = wipe_threads;
+	if ( nthreads < 2 )
+	{
+		return -1;
+	}
+	/* compare in 64 bits - the region may be longer than a long */
+# ifdef HAVE_LONG_LONG_INT
+	if ( (unsigned long long int)len < (unsigned long long int)thread_threshold )
+# else
+	if ( len < (off64_t)thread_threshold )
+# endif
+	{
+		return -1;
+	}
+	/* each range must start in the pattern's phase, so round
+	   the ranges' lengths up to whole pattern buffers */
+	part = len / (off64_t)nthreads;
+	part = ((part + N_PAGE_BYTES - 1) / N_PAGE_BYTES) * N_PAGE_BYTES;
+
+	/* a buffer for each range - the random passes are generated
+	   in the threads, while writing */
+	buf = (unsigned char *) malloc ( sizeof(unsigned char) * N_PAGE_BYTES
+		* nthreads );
+	ranges = (struct lsr_wipe_range *) malloc (
+		sizeof (struct lsr_wipe_range) * nthreads );
+	threads = (pthread_t *) malloc ( sizeof (pthread_t) * nthreads );
+	started = (int *) malloc ( sizeof (int) * nthreads );
+	if ( (buf == NULL) || (ranges == NULL) || (threads == NULL) || (started == NULL) )
+	{
+		free (started);
+		free (threads);
+		free (ranges);
+		free (buf);
+		return -1;
+	}
+	pthread_mutex_init (&(crew.lock), NULL);
+	pthread_cond_init (&(crew.go), NULL);
+	pthread_cond_init (&(crew.done), NULL);
+	crew.pass = 0;
+	crew.pending = 0;
+	crew.quit = 0;
+	for ( i = 0; i < nthreads; i++ )
+	{
+		ranges[i].buf = buf + N_PAGE_BYTES * i;
+		ranges[i].data = ranges[i].buf;
+		ranges[i].fd = fd;
+		ranges[i].stream = &stream;
+		ranges[i].token = __lsr_get_wipe_token ();
+		ranges[i].crew = &crew;
+		ranges[i].result = 0;
+		ranges[i].start = start + part * (off64_t)i;
+		ranges[i].len = part;
+		if ( ranges[i].start >= start + len )
+		{
+			ranges[i].len = 0;
+		}
+		else if ( ranges[i].start + part > start + len )
+		{
+			ranges[i].len = start + len - ranges[i].start;
+		}
+		started[i] = 0;
+		ranges[i].iov = (struct iovec *) malloc (
+			sizeof (struct iovec) * N_IOVECS );
+		if ( ranges[i].iov == NULL )
+		{
+			res = -1;
+		}
+	}
+	if ( res == 0 )
+	{
+		for ( i = 1; i < nthreads; i++ )
+		{
+			if ( ranges[i].len == 0 )
+			{
+				continue;
+			}
+			if ( pthread_create (&threads[i], NULL,
+				&__lsr_wipe_range_thread, &ranges[i]) == 0 )
+			{
+				started[i] = 1;
+				nstarted++;
+			}
+			/* else: no more threads - the range is written here */
+		}
+	}
+	if ( (res != 0) || (nstarted == 0) )
+	{
+		/* nothing to share the work with */
+		for ( i = 0; i < nthreads; i++ )
+		{
+			free (ranges[i].iov);
+		}
+		pthread_cond_destroy (&(crew.done));
+		pthread_cond_destroy (&(crew.go));
+		pthread_mutex_destroy (&(crew.lock));
+		free (started);
+		free (threads);
+		free (ranges);
+		free (buf);
+		return -1;
+	}
+
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			data = __lsr_get_zero_data (buf);
+			stream = 0;
+		}
+		else
+# endif /* LAST_PASS_ZERO */
+		{
+			data = __lsr_get_pass_data (j, buf, schedule, &stream);
+		}
+		for ( i = 0; i < nthreads; i++ )
+		{
+			/* the fixed patterns are only read, so they can be shared,
+			   but each thread generates its own random data */
+			ranges[i].data = (stream != 0) ? ranges[i].buf : data;
+			ranges[i].result = 0;
+		}
+		/* wake the workers up for this pass */
+		pthread_mutex_lock (&(crew.lock));
+		crew.pending = nstarted;
+		crew.pass++;
+		pthread_cond_broadcast (&(crew.go));
+		pthread_mutex_unlock (&(crew.lock));
+		for ( i = 0; i < nthreads; i++ )
+		{
+			if ( (started[i] == 0) && (ranges[i].len != 0) )
+			{
+				__lsr_wipe_range (&ranges[i]);
+			}
+		}
+		/* the barrier: wait for all the ranges of this pass */
+		pthread_mutex_lock (&(crew.lock));
+		while ( crew.pending != 0 )
+		{
+			pthread_cond_wait (&(crew.done), &(crew.lock));
+		}
+		pthread_mutex_unlock (&(crew.lock));
+		for ( i = 0; i < nthreads; i++ )
+		{
+			if ( (ranges[i].result != 0) && (__lsr_sig_recvd () == 0) )
+			{
+				res = -2;
+			}
+		}
+		if ( res != 0 )
+		{
+			break;
+		}
+		if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+			/* if LAST_PASS_ZERO is defined, there will be
+			 one additionall pass with zeros, so sync no
+			 matter how many passes there are declared: */
+			|| (1 == 1)
+# endif
+			)
+		{
+			__lsr_sync_pass (fd);
+		}
+	}
+	/* let the workers go */
+	pthread_mutex_lock (&(crew.lock));
+	crew.quit = 1;
+	pthread_cond_broadcast (&(crew.go));
+	pthread_mutex_unlock (&(crew.lock));
+	for ( i = 1; i < nthreads; i++ )
+	{
+		if ( started[i] != 0 )
+		{
+			pthread_join (threads[i], NULL);
+		}
+	}
+	for ( i = 0; i < nthreads; i++ )
+	{
+		free (ranges[i].iov);
+	}
+	pthread_cond_destroy (&(crew.done));
+	pthread_cond_destroy (&(crew.go));
+	pthread_mutex_destroy (&(crew.lock));
+	free (started);
+	free (threads);
+	free (ranges);
+	free (buf);
+	return res;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_THREADS */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_IO_URING) && (defined HAVE_MALLOC)
+struct lsr_uring
+{
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_ring;
+	void * cq_ring;
+	unsigned int * sq_head;
+	unsigned int * sq_tail;
+	unsigned int * sq_mask;
+	unsigned int * sq_array;
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int * cq_mask;
+	size_t sq_ring_len;
+	size_t cq_ring_len;
+	size_t sqes_len;
+	int ring_fd;
+	unsigned int entries;
+};
+
+# ifndef LSR_ANSIC
+static int __lsr_uring_init LSR_PARAMS ((struct lsr_uring * const ring,
+	const unsigned int depth));
+# endif
+
+/**
+ * Creates an io_uring instance and maps its rings.
+ * \param ring The structure to fill with the ring's data.
+ * \param depth The requested number of submission queue entries.
+ * \return 0 on success, -1 if io_uring can't be used.
+ */
+static int
+__lsr_uring_init (
+# ifdef LSR_ANSIC
+	struct lsr_uring * const ring, const unsigned int depth)
+# else
+	ring, depth)
+	struct lsr_uring * const ring;
+	const unsigned int depth;
+# endif
+{
+	struct io_uring_params params;
+	unsigned char * sq_ptr;
+	unsigned char * cq_ptr;
+	long int res;
+
+	LSR_MEMSET (&params, 0, sizeof (struct io_uring_params));
+	res = syscall (__NR_io_uring_setup, depth, &params);
+	if ( res < 0 )
+	{
+		return -1;
+	}
+	ring->ring_fd = (int) res;
+	ring->entries = params.sq_entries;
+	ring->sq_ring_len = params.sq_off.array
+		+ params.sq_entries * sizeof (unsigned int);
+	ring->cq_ring_len = params.cq_off.cqes
+		+ params.cq_entries * sizeof (struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof (struct io_uring_sqe);
+
+	ring->sq_ring = mmap (NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if ( ring->sq_ring == MAP_FAILED )
+	{
+		close (ring->ring_fd);
+		return -1;
+	}
+	ring->cq_ring = mmap (NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+	if ( ring->cq_ring == MAP_FAILED )
+	{
+		munmap (ring->sq_ring, ring->sq_ring_len);
+		close (ring->ring_fd);
+		return -1;
+	}
+	ring->sqes = (struct io_uring_sqe *) mmap (NULL, ring->sqes_len,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring->ring_fd, IORING_OFF_SQES);
+	if ( ring->sqes == MAP_FAILED )
+	{
+		munmap (ring->cq_ring, ring->cq_ring_len);
+		munmap (ring->sq_ring, ring->sq_ring_len);
+		close (ring->ring_fd);
+		return -1;
+	}
+
+	sq_ptr = (unsigned char *) ring->sq_ring;
+	cq_ptr = (unsigned char *) ring->cq_ring;
+	ring->sq_head = (unsigned int *) (sq_ptr + params.sq_off.head);
+	ring->sq_tail = (unsigned int *) (sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *) (sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) (sq_ptr + params.sq_off.array);
+	ring->cq_head = (unsigned int *) (cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned int *) (cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *) (cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq_ptr + params.cq_off.cqes);
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_uring_exit LSR_PARAMS ((struct lsr_uring * const ring));
+# endif
+
+/**
+ * Unmaps the rings and closes the given io_uring instance.
+ * \param ring The io_uring instance to destroy.
+ */
+static void
+__lsr_uring_exit (
+# ifdef LSR_ANSIC
+	struct lsr_uring * const ring)
+# else
+	ring)
+	struct lsr_uring * const ring;
+# endif
+{
+	munmap (ring->sqes, ring->sqes_len);
+	munmap (ring->cq_ring, ring->cq_ring_len);
+	munmap (ring->sq_ring, ring->sq_ring_len);
+	close (ring->ring_fd);
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static struct io_uring_sqe * __lsr_uring_get_sqe LSR_PARAMS ((
+	struct lsr_uring * const ring, unsigned int * const tail));
+# endif
+
+/**
+ * Gets the next free submission queue entry, cleared, and adds it to the queue.
+ *	The entry becomes visible to the kernel only after the tail is published.
+ * \param ring The io_uring instance.
+ * \param tail The local (not yet published) tail of the submission queue.
+ * \return the submission queue entry to fill.
+ */
+static struct io_uring_sqe *
+__lsr_uring_get_sqe (
+# ifdef LSR_ANSIC
+	struct lsr_uring * const ring, unsigned int * const tail)
+# else
+	ring, tail)
+	struct lsr_uring * const ring;
+	unsigned int * const tail;
+# endif
+{
+	const unsigned int index = *tail & *(ring->sq_mask);
+	struct io_uring_sqe * const sqe = &(ring->sqes[index]);
+
+	LSR_MEMSET (sqe, 0, sizeof (struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	(*tail)++;
+	return sqe;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_uring_write_pass LSR_PARAMS ((struct lsr_uring * const ring,
+	const int fd, unsigned char * const buf, const size_t buflen,
+	const off64_t start, const off64_t len, const unsigned long int stream,
+	const int do_sync));
+# endif
+
+/**
+ * Writes the registered buffer over the given region of the file, keeping
+ *	up to the whole submission queue in flight, and optionally queues
+ *	an fsync() which the kernel starts only after all the writes complete.
+ *	The data of a random pass doesn't repeat, so it's generated into the
+ *	two registered buffers in turns: one is filled while the write of
+ *	the other is in flight.
+ * \param ring The io_uring instance with the buffers registered as
+ *	numbers 0 and 1, one after the other.
+ * \param fd The file descriptor to write to.
+ * \param buf The first registered buffer, filled with the pattern.
+ * \param buflen The length of each registered buffer.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param stream The random stream to write, 0 to write the pattern.
+ * \param do_sync Whether to sync the file after the writes.
+ * \return 0 on success, -1 on error, -2 if the kernel may still be using
+ *	the buffer (the requests in flight couldn't be waited for).
+ */
+static int
+__lsr_uring_write_pass (
+# ifdef LSR_ANSIC
+	struct lsr_uring * const ring, const int fd,
+	unsigned char * const buf, const size_t buflen,
+	const off64_t start, const off64_t len, const unsigned long int stream,
+	const int do_sync)
+# else
+	ring, fd, buf, buflen, start, len, stream, do_sync)
+	struct lsr_uring * const ring;
+	const int fd;
+	unsigned char * const buf;
+	const size_t buflen;
+	const off64_t start;
+	const off64_t len;
+	const unsigned long int stream;
+	const int do_sync;
+# endif
+{
+	struct io_uring_sqe * sqe;
+	struct io_uring_cqe * cqe;
+	off64_t done = 0;
+	size_t write_len;
+	unsigned int index = 0;
+	unsigned int busy = 0;	/* the bits of the buffers being written */
+	unsigned int tail;
+	unsigned int head;
+	unsigned int queued;
+	unsigned int inflight = 0;
+	int sync_queued = (do_sync == 0);
+	int res = 0;
+	long int enter_res;
+	struct lsr_writeback wb;
+	LSR_MAKE_ERRNO_VAR(err);
+
+	__lsr_writeback_init (&wb, start);
+	while ( (done < len) || (sync_queued == 0) || (inflight > 0) )
+	{
+		if ( (res != 0) || (__lsr_sig_recvd () != 0) )
+		{
+			/* stop queueing, but wait for what's in flight,
+			   because it's still using the buffer */
+			done = len;
+			sync_queued = 1;
+		}
+		else if ( inflight == 0 )
+		{
+			/* everything queued so far has been written */
+			__lsr_writeback_advance (fd, &wb, start + done);
+		}
+		queued = 0;
+		tail = *(ring->sq_tail);
+		while ( (inflight + queued < ring->entries)
+			&& ((done < len) || (sync_queued == 0))
+			/* don't dirty more than a window at once */
+			&& ((done >= len)
+				|| (__lsr_writeback_room (&wb, start + done) != 0))
+			/* when the writes are limited, submit them one by one */
+			&& ((queued == 0) || ((rate_bytes == 0) && (rate_iops == 0)))
+			/* a random buffer can be refilled only after its write */
+			&& ((stream == 0) || (done >= len) || (busy != 3)) )
+		{
+			sqe = __lsr_uring_get_sqe (ring, &tail);
+			sqe->fd = fd;
+			if ( done < len )
+			{
+				write_len = buflen;
+				if ( (off64_t)write_len > len - done )
+				{
+					write_len = (size_t)(len - done);
+				}
+				__lsr_throttle (write_len);
+				if ( stream != 0 )
+				{
+					index = ((busy & 1) != 0) ? 1 : 0;
+					busy |= 1U << index;
+					__lsr_fill_stream_at (stream, buf + index * buflen,
+						write_len, start + done);
+				}
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+				sqe->off = (__u64) (start + done);
+				sqe->addr = (__u64) (unsigned long int) (buf + index * buflen);
+				sqe->len = (__u32) write_len;
+				sqe->buf_index = (__u16) index;
+				/* the expected result, to check in the completion,
+				   and the buffer to free */
+				sqe->user_data = (((__u64) write_len) << 1) | index;
+				done += (off64_t)write_len;
+			}
+			else
+			{
+				sqe->opcode = IORING_OP_FSYNC;
+				/* start only after all the previous writes */
+				sqe->flags = IOSQE_IO_DRAIN;
+#  ifdef IORING_FSYNC_DATASYNC
+				if ( sync_mode != LSR_SYNC_FSYNC )
+				{
+					/* the metadata is synchronized at the end, if at all */
+					sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+				}
+#  endif
+				sqe->user_data = 0;
+				sync_queued = 1;
+			}
+			queued++;
+		}
+		__atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+		inflight += queued;
+		if ( inflight == 0 )
+		{
+			break;
+		}
+
+		do
+		{
+			/* submit everything the kernel hasn't consumed yet */
+			queued = tail - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+			enter_res = syscall (__NR_io_uring_enter, ring->ring_fd,
+				queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if ( enter_res >= 0 )
+			{
+				break;
+			}
+			LSR_GET_ERRNO(err);
+		}
+# ifdef HAVE_ERRNO_H
+		while ( err == EINTR );
+# else
+		while ( 0 );
+# endif
+		if ( enter_res < 0 )
+		{
+			/* take back what the kernel hasn't consumed */
+			queued = tail - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+			tail -= queued;
+			__atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+			inflight -= queued;
+			if ( res != 0 )
+			{
+				/* can't even wait for the requests in flight */
+				return (inflight > 0) ? -2 : -1;
+			}
+			/* wait for the rest before giving up */
+			res = -1;
+			continue;
+		}
+
+		head = *(ring->cq_head);
+		while ( head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE) )
+		{
+			cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+			if ( cqe->user_data != 0 )
+			{
+				if ( (cqe->res < 0)
+					|| ((__u64)cqe->res != (cqe->user_data >> 1)) )
+				{
+					/* error or short write */
+					res = -1;
+				}
+				busy &= ~(1U << (unsigned int) (cqe->user_data & 1));
+			}
+			head++;
+			inflight--;
+		}
+		__atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	if ( __lsr_sig_recvd () != 0 )
+	{
+		return -1;
+	}
+	if ( res == 0 )
+	{
+		__lsr_writeback_finish (fd, &wb, start + len);
+	}
+	return res;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_uring LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given (large) region of the file with all the passes, using
+ *	io_uring with two registered buffers. The patterns are selected
+ *	in the same way as in the other methods of writing.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if io_uring can't be used and
+ *	the caller should fall back to other methods, -2 if a write has failed
+ *	and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_uring (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	struct lsr_uring ring;
+	struct iovec reg[2];
+	unsigned char /*@only@*/ *buf;
+	unsigned long int stream;
+	unsigned int j;
+	int do_sync;
+	int ring_sync;
+	int ring_used = 0;
+	int pass_res;
+	int res = 0;
+	/* the schedule for the other methods, if this one can't be used */
+	const struct lsr_schedule saved_schedule = *schedule;
+
+	/* the second buffer is used only by the random passes */
+	buf = (unsigned char *) malloc ( sizeof(unsigned char) * 2 * N_URING_BYTES );
+	if ( buf == NULL )
+	{
+		return -1;
+	}
+	if ( __lsr_uring_init (&ring, uring_depth) != 0 )
+	{
+		free (buf);
+		return -1;
+	}
+	reg[0].iov_base = buf;
+	reg[0].iov_len = N_URING_BYTES;
+	reg[1].iov_base = buf + N_URING_BYTES;
+	reg[1].iov_len = N_URING_BYTES;
+	if ( syscall (__NR_io_uring_register, ring.ring_fd,
+		IORING_REGISTER_BUFFERS, reg, 2) != 0 )
+	{
+		__lsr_uring_exit (&ring);
+		free (buf);
+		return -1;
+	}
+
+	do_sync = LSR_SYNC_PASSES (schedule->npasses) ? 1 : 0;
+# ifdef LAST_PASS_ZERO
+	/* if LAST_PASS_ZERO is defined, there will be
+	 one additionall pass with zeros, so sync no
+	 matter how many passes there are declared: */
+	do_sync = 1;
+# endif
+	/* The ring can only queue full synchronizations, so the other
+	   modes are handled after the pass, like in the other engines. */
+	ring_sync = ( (sync_mode == LSR_SYNC_FSYNC)
+		|| (sync_mode == LSR_SYNC_FDATASYNC) ) ? do_sync : 0;
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+		stream = 0;
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			/* this is the last pass and there was at least one
+			  pass before - do_sync is set, so it's synced */
+			LSR_MEMSET (buf, 0, N_URING_BYTES);
+		}
+		else
+# endif /* LAST_PASS_ZERO */
+		if ( __lsr_fill_scheduled ( j, buf, N_URING_BYTES, schedule ) != 0 )
+		{
+			/* the data is generated for each request */
+			stream = schedule->last_stream;
+		}
+		pass_res = __lsr_uring_write_pass (&ring, fd, buf, N_URING_BYTES,
+			start, len, stream, ring_sync);
+		if ( pass_res == 0 )
+		{
+			ring_used = 1;
+			if ( (do_sync != 0) && (ring_sync == 0) )
+			{
+				__lsr_sync_pass (fd);
+			}
+		}
+		else
+		{
+			__lsr_uring_exit (&ring);
+			if ( pass_res == -2 )
+			{
+				/* the requests in flight may still be reading
+				   the buffer - better lose it than reuse it */
+				buf = NULL;
+			}
+			if ( (ring_used == 0) && (__lsr_sig_recvd () == 0) )
+			{
+				/* io_uring doesn't work for this file at all
+				   (e.g. the kernel doesn't support fixed
+				   buffers) - let the caller do the wiping
+				   from the beginning */
+				*schedule = saved_schedule;
+				if ( buf != NULL )
+				{
+					free (buf);
+				}
+				return -1;
+			}
+			if ( buf != NULL )
+			{
+				free (buf);
+			}
+			return (__lsr_sig_recvd () == 0) ? -2 : 0;
+		}
+	}
+	__lsr_uring_exit (&ring);
+	free (buf);
+	return res;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_IO_URING && HAVE_MALLOC */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_DIRECT_IO)
+/* The descriptor for direct I/O and the watch standing in for the lease
+   while it's open. */
+struct lsr_direct
+{
+	int fd;		/* the file opened again with O_DIRECT */
+	int watch;	/* the inotify instance watching the opens of the file */
+};
+
+# ifndef LSR_ANSIC
+static int __lsr_direct_opened LSR_PARAMS ((const int watch));
+# endif
+
+/**
+ * Reads all the events of the watch of the file being written directly.
+ * \param watch The inotify instance watching the file.
+ * \return non-zero if the file has been opened since the last check.
+ */
+static int
+__lsr_direct_opened (
+# ifdef LSR_ANSIC
+	const int watch)
+# else
+	watch)
+	const int watch;
+# endif
+{
+	/* only the fact of an event matters, not its contents */
+	unsigned char events[8 * (sizeof (struct inotify_event) + 256)];
+	int opened = 0;
+
+	while ( read (watch, events, sizeof (events)) > 0 )
+	{
+		opened = 1;
+	}
+	return opened;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_open_direct LSR_PARAMS ((const int fd,
+	struct lsr_direct * const direct));
+# endif
+
+/**
+ * Opens the file being wiped again, for direct I/O. The new descriptor
+ *	is private to the wipe: the status flags of the given one are shared
+ *	with the program (and its copies made by dup() and fork()), so they
+ *	can't be changed. No write lease can be held while the file is open
+ *	twice, so the lease is given back until the new descriptor is closed
+ *	with __lsr_close_direct() and the opens of the file are watched
+ *	instead (see __lsr_check_direct()).
+ * \param fd The file descriptor of the file being wiped.
+ * \param direct The place for the new descriptor and its watch.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_open_direct (
+# ifdef LSR_ANSIC
+	const int fd, struct lsr_direct * const direct)
+# else
+	fd, direct)
+	const int fd;
+	struct lsr_direct * const direct;
+# endif
+{
+	char path[32];
+
+	snprintf (path, sizeof (path), "/proc/self/fd/%d", fd);
+	path[sizeof (path) - 1] = '\0';
+	if ( __lsr_real_open_location () == NULL )
+	{
+		return -1;
+	}
+	/* watch before giving the lease back, so that no opening is missed */
+	direct->watch = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if ( direct->watch < 0 )
+	{
+		return -1;
+	}
+	if ( inotify_add_watch (direct->watch, path, IN_OPEN) < 0 )
+	{
+		close (direct->watch);
+		return -1;
+	}
+	__lsr_lease_suspend (fd);
+	direct->fd = (*__lsr_real_open_location ()) (path, O_WRONLY | O_DIRECT);
+	if ( direct->fd < 0 )
+	{
+		close (direct->watch);
+		__lsr_lease_resume (fd);
+		return -1;
+	}
+	/* forget the opening of the new descriptor itself (an opening by
+	   someone else at the same moment is merged with it, but is still
+	   caught when the lease is taken again, if the file is still open) */
+	__lsr_direct_opened (direct->watch);
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_check_direct LSR_PARAMS ((
+	const struct lsr_direct * const direct));
+# endif
+
+/**
+ * Cancels the wipe if the file written directly has been opened by
+ *	someone else, like the break of the lease would.
+ * \param direct The descriptor opened by __lsr_open_direct().
+ */
+static void
+__lsr_check_direct (
+# ifdef LSR_ANSIC
+	const struct lsr_direct * const direct)
+# else
+	direct)
+	const struct lsr_direct * const direct;
+# endif
+{
+	if ( __lsr_direct_opened (direct->watch) != 0 )
+	{
+		__lsr_cancel_wipe ();
+	}
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_close_direct LSR_PARAMS ((const int fd,
+	const struct lsr_direct * const direct));
+# endif
+
+/**
+ * Closes the descriptor opened by __lsr_open_direct() and takes
+ *	the lease on the file being wiped again.
+ * \param fd The file descriptor of the file being wiped.
+ * \param direct The descriptor opened for direct I/O.
+ * \return 0 on success, -1 if the file has been opened by someone else
+ *	in the meantime (the wipe is then cancelled).
+ */
+static int
+__lsr_close_direct (
+# ifdef LSR_ANSIC
+	const int fd, const struct lsr_direct * const direct)
+# else
+	fd, direct)
+	const int fd;
+	const struct lsr_direct * const direct;
+# endif
+{
+	__lsr_check_direct (direct);
+	close (direct->fd);
+	close (direct->watch);
+	if ( __lsr_lease_resume (fd) != 0 )
+	{
+		return -1;
+	}
+	return (__lsr_sig_recvd () != 0) ? -1 : 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_direct_pass LSR_PARAMS ((const int fd,
+	const struct lsr_direct * const direct,
+	unsigned char * const buf, const size_t buflen,
+	const off64_t start, const off64_t len,
+	const off64_t astart, const off64_t aend, const unsigned long int stream));
+# endif
+
+/**
+ * Writes one pass: the unaligned head and tail of the region through the
+ *	page cache and the aligned middle part directly to the device.
+ * \param fd The file descriptor to write to.
+ * \param direct The descriptor for direct I/O, see __lsr_open_direct().
+ * \param buf The buffer with the pattern for the pass, in phase with the start
+ *	of the region. Gets rotated to be in phase with the aligned part.
+ * \param buflen The length of the buffer, a multiple of the pattern length
+ *	and of LSR_DIRECT_ALIGN.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param astart The start of the aligned part of the region.
+ * \param aend The end of the aligned part of the region.
+ * \param stream The random stream of a random pass: the buffer is then
+ *	filled again before each write. 0 if the buffer holds a fixed pattern.
+ * \return 0 on success, -1 on error.
+ */
+static int
+__lsr_direct_pass (
+# ifdef LSR_ANSIC
+	const int fd, const struct lsr_direct * const direct,
+	unsigned char * const buf, const size_t buflen, const off64_t start,
+	const off64_t len, const off64_t astart, const off64_t aend,
+	const unsigned long int stream)
+# else
+	fd, direct, buf, buflen, start, len, astart, aend, stream)
+	const int fd;
+	const struct lsr_direct * const direct;
+	unsigned char * const buf;
+	const size_t buflen;
+	const off64_t start;
+	const off64_t len;
+	const off64_t astart;
+	const off64_t aend;
+	const unsigned long int stream;
+# endif
+{
+	unsigned char pattern[3];
+	size_t phase;
+	size_t write_len;
+	off64_t offset;
+	ssize_t write_res;
+
+	/* the head and the tail are shorter than LSR_DIRECT_ALIGN and
+	   the buffer's length is a multiple of 3, so they fit in the buffer */
+	write_len = (size_t)(astart - start);
+	if ( stream != 0 )
+	{
+		__lsr_fill_stream_at (stream, buf, write_len, start);
+	}
+	if ( (write_len > 0)
+		&& (__lsr_write_at (fd, buf, write_len, start) != (ssize_t)write_len) )
+	{
+		return -1;
+	}
+	write_len = (size_t)(start + len - aend);
+	phase = (size_t)((aend - start) % 3);
+	if ( stream != 0 )
+	{
+		__lsr_fill_stream_at (stream, buf, write_len, aend);
+		phase = 0;
+	}
+	if ( (write_len > 0)
+		&& (__lsr_write_at (fd, buf + phase, write_len, aend) != (ssize_t)write_len) )
+	{
+		return -1;
+	}
+
+	/* rotate the pattern, so that the buffer starts in phase with 'astart' */
+	phase = (size_t)((astart - start) % 3);
+	if ( (phase != 0) && (stream == 0) )
+	{
+		LSR_MEMCOPY (pattern, buf, sizeof (pattern));
+		memmove (buf, buf + phase, buflen - phase);
+		LSR_MEMCOPY (buf + buflen - phase, pattern, phase);
+	}
+
+	for ( offset = astart; (offset < aend) && (__lsr_sig_recvd () == 0); )
+	{
+		write_len = buflen;
+		if ( (off64_t)write_len > aend - offset )
+		{
+			write_len = (size_t)(aend - offset);
+		}
+		if ( stream != 0 )
+		{
+			__lsr_fill_stream_at (stream, buf, write_len, offset);
+		}
+		write_res = __lsr_write_at (direct->fd, buf, write_len, offset);
+		if ( write_res != (ssize_t)write_len )
+		{
+			return -1;
+		}
+		offset += write_res;
+		__lsr_check_direct (direct);
+	}
+	return (__lsr_sig_recvd () != 0) ? -1 : 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_direct LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given (large) region of the file with all the passes, bypassing
+ *	the page cache for the part of the region aligned to LSR_DIRECT_ALIGN.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if direct I/O can't be used and
+ *	the caller should fall back to other methods, -2 if a write has failed
+ *	and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_direct (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	void /*@only@*/ *buf = NULL;
+	struct lsr_direct direct;
+	off64_t astart;
+	off64_t aend;
+	unsigned int j;
+	int random_pass;
+	int res = 0;
+	size_t buflen = N_HUGE_BYTES;
+	int mapped = 1;
+
+	astart = ((start + LSR_DIRECT_ALIGN - 1) / LSR_DIRECT_ALIGN) * LSR_DIRECT_ALIGN;
+	aend = ((start + len) / LSR_DIRECT_ALIGN) * LSR_DIRECT_ALIGN;
+	if ( astart >= aend )
+	{
+		/* nothing to write directly */
+		return -1;
+	}
+	/* a huge page is aligned enough for direct I/O */
+	buf = __lsr_alloc_huge (len);
+	if ( buf == NULL )
+	{
+		buflen = N_DIRECT_BYTES;
+		mapped = 0;
+		if ( __lsr_real_psx_memalign_loc () == NULL )
+		{
+			return -1;
+		}
+		if ( (*__lsr_real_psx_memalign_loc ()) (&buf, LSR_DIRECT_ALIGN,
+			sizeof(unsigned char) * buflen) != 0 )
+		{
+			return -1;
+		}
+	}
+	if ( buf == NULL )
+	{
+		return -1;
+	}
+	/* once for all the passes */
+	if ( __lsr_open_direct (fd, &direct) != 0 )
+	{
+		__lsr_free_staging (buf, mapped);
+		return -1;
+	}
+
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			LSR_MEMSET (buf, 0, buflen);
+			if ( __lsr_direct_pass (fd, &direct, (unsigned char *) buf,
+				buflen, start, len, astart, aend, 0) == 0 )
+			{
+				/* this is the last pass and there was at
+				  least one pass before - sync unconditionally */
+				__lsr_sync_pass (fd);
+			}
+			else if ( __lsr_sig_recvd () == 0 )
+			{
+				res = -2;
+			}
+			break;
+		}
+# endif /* LAST_PASS_ZERO */
+		random_pass = __lsr_fill_scheduled ( j, (unsigned char *) buf,
+			buflen, schedule );
+		if ( __lsr_direct_pass (fd, &direct, (unsigned char *) buf,
+			buflen, start, len, astart, aend,
+			(random_pass != 0) ? schedule->last_stream : 0) != 0 )
+		{
+			if ( (j == schedule->first) && (__lsr_sig_recvd () == 0) )
+			{
+				/* direct I/O doesn't work for this file
+				   (e.g. the filesystem doesn't support it)
+				   - let the caller do the wiping */
+				__lsr_close_direct (fd, &direct);
+				__lsr_free_staging (buf, mapped);
+				return -1;
+			}
+			if ( __lsr_sig_recvd () == 0 )
+			{
+				res = -2;
+			}
+			break;
+		}
+		if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+			/* if LAST_PASS_ZERO is defined, there will be
+			 one additionall pass with zeros, so sync no
+			 matter how many passes there are declared: */
+			|| (1 == 1)
+# endif
+			)
+		{
+			__lsr_sync_pass (fd);
+		}
+	}
+	/* cancels the wipe if the file has been opened meanwhile */
+	__lsr_close_direct (fd, &direct);
+	__lsr_free_staging (buf, mapped);
+	return res;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_DIRECT_IO */
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_MMAP)
+# ifndef LSR_ANSIC
+static int __lsr_populate_mapped LSR_PARAMS ((unsigned char * const map,
+	const size_t offset, const size_t len, const size_t page));
+# endif
+
+/**
+ * Makes the given part of a shared mapping of a file writable in advance.
+ *	A store to a page which needs a new block (a hole, a copy-on-write
+ *	block or a page of a full tmpfs) gets a SIGBUS when the filesystem has
+ *	no space left - this reports it as an error instead.
+ * \param map The start of the mapping.
+ * \param offset The offset of the part in the mapping.
+ * \param len The length of the part.
+ * \param page The size of a memory page.
+ * \return 0 if the part can be stored to, -1 otherwise.
+ */
+static int
+__lsr_populate_mapped (
+# ifdef LSR_ANSIC
+	unsigned char * const map, const size_t offset, const size_t len,
+	const size_t page)
+# else
+	map, offset, len, page)
+	unsigned char * const map;
+	const size_t offset;
+	const size_t len;
+	const size_t page;
+# endif
+{
+	const size_t first = offset - offset % page;
+
+	return (madvise (map + first, offset + len - first,
+		MADV_POPULATE_WRITE) == 0) ? 0 : -1;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_fill_mapped LSR_PARAMS ((unsigned char * const dest,
+	const size_t len, const unsigned char * const pattern,
+	const size_t phase));
+# endif
+
+/**
+ * Fills the given memory with the given 3-byte pattern, storing whole
+ *	machine words in the main loop.
+ * \param dest The memory to fill.
+ * \param len The length of the memory.
+ * \param pattern The 3-byte pattern.
+ * \param phase The index of the pattern byte to put at dest[0].
+ */
+static void
+__lsr_fill_mapped (
+# ifdef LSR_ANSIC
+	unsigned char * const dest, const size_t len,
+	const unsigned char * const pattern, const size_t phase)
+# else
+	dest, len, pattern, phase)
+	unsigned char * const dest;
+	const size_t len;
+	const unsigned char * const pattern;
+	const size_t phase;
+# endif
+{
+	/* three words hold a whole number of pattern periods */
+	unsigned long int words[3];
+	unsigned long int * wdest;
+	unsigned char * const wbytes = (unsigned char *) words;
+	size_t i = 0;
+	size_t k;
+	size_t nblocks;
+
+	/* bytes up to the first word boundary */
+	while ( (i < len)
+		&& (((unsigned long int) (dest + i) % sizeof (unsigned long int)) != 0) )
+	{
+		dest[i] = pattern[(phase + i) % 3];
+		i++;
+	}
+	for ( k = 0; k < sizeof (words); k++ )
+	{
+		wbytes[k] = pattern[(phase + i + k) % 3];
+	}
+	nblocks = (len - i) / sizeof (words);
+	wdest = (unsigned long int *) (dest + i);
+	for ( k = 0; k < nblocks; k++ )
+	{
+		wdest[0] = words[0];
+		wdest[1] = words[1];
+		wdest[2] = words[2];
+		wdest += 3;
+	}
+	i += nblocks * sizeof (words);
+	/* the remaining bytes */
+	for ( ; i < len; i++ )
+	{
+		dest[i] = pattern[(phase + i) % 3];
+	}
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_mmap LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given region of the file with all the passes, by mapping it
+ *	into memory and storing the patterns directly in the mapping.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if the region can't be mapped and
+ *	the caller should fall back to other methods, -2 if a part of the mapping
+ *	couldn't be stored to and the old data may still be there.
+ */
+static int
+__lsr_wipe_region_mmap (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char pattern[3];
+	unsigned char * map;
+	unsigned char * region;
+	off64_t map_start;
+	size_t map_len;
+	size_t page;
+	size_t done;
+	size_t chunk;
+	unsigned int j;
+	int random_pass;
+# ifdef HAVE_FSTAT64
+	struct stat64 s;
+# else
+	struct stat s;
+# endif
+
+	if ( (len < LSR_MMAP_MIN_BYTES) || (len > LSR_MMAP_MAX_BYTES) )
+	{
+		return -1;
+	}
+	/* Storing to a hole in a mapping needs a new block and a full
+	   filesystem would make it a SIGBUS, so don't map sparse files. */
+# ifdef HAVE_FSTAT64
+	if ( fstat64 (fd, &s) != 0 )
+# else
+	if ( fstat (fd, &s) != 0 )
+# endif
+	{
+		return -1;
+	}
+	if ( (off64_t)s.st_blocks * 512 < (off64_t)s.st_size )
+	{
+		return -1;
+	}
+
+# ifdef HAVE_SYSCONF
+	page = (size_t) sysconf (_SC_PAGESIZE);
+# else
+#  ifdef HAVE_GETPAGESIZE
+	page = (size_t) getpagesize ();
+#  else
+	page = 4096;
+#  endif
+# endif
+	map_start = start - (start % (off64_t)page);
+	map_len = (size_t) (start + len - map_start);
+	map = (unsigned char *) mmap64 (NULL, map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, map_start);
+	if ( map == MAP_FAILED )
+	{
+		/* e.g. a write-only descriptor or a filesystem without mmap() */
+		return -1;
+	}
+	region = map + (start - map_start);
+
+	for ( j = schedule->first; (j < schedule->stop)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+		if ( __lsr_fallocate_zeros (fd, start, len, j,
+			schedule->npasses) == 0 )
+		{
+			/* the filesystem has zeroed the region without writing */
+			__lsr_sync_pass (fd);
+			continue;
+		}
+# endif
+# ifdef LAST_PASS_ZERO
+		if ( j == schedule->npasses )
+		{
+			LSR_MEMSET (pattern, 0, sizeof (pattern));
+			random_pass = 0;
+		}
+		else
+# endif /* LAST_PASS_ZERO */
+		{
+			random_pass = __lsr_fill_scheduled ( j, pattern, sizeof (pattern), schedule );
+		}
+		for ( done = 0; (done < (size_t)len) && (__lsr_sig_recvd () == 0); done += chunk )
+		{
+			chunk = N_MMAP_CHUNK;
+			if ( chunk > (size_t)len - done )
+			{
+				chunk = (size_t)len - done;
+			}
+			/* the dirtied pages are written back later, but at
+			   the same rate on average */
+			__lsr_throttle (chunk);
+			if ( __lsr_populate_mapped (map, (size_t) (start - map_start)
+				+ done, chunk, page) != 0 )
+			{
+				munmap (map, map_len);
+				if ( (j == schedule->first) && (done == 0) )
+				{
+					/* nothing stored yet - let the caller write it */
+					return -1;
+				}
+				return (__lsr_sig_recvd () == 0) ? -2 : 0;
+			}
+			if ( random_pass != 0 )
+			{
+				/* generate the random data right in the mapping */
+				__lsr_fill_stream_at (schedule->last_stream,
+					region + done, chunk, start + (off64_t)done);
+			}
+			else
+			{
+				__lsr_fill_mapped (region + done, chunk, pattern, done % 3);
+			}
+		}
+		if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+			/* if LAST_PASS_ZERO is defined, there will be
+			 one additionall pass with zeros, so sync no
+			 matter how many passes there are declared: */
+			|| (1 == 1)
+# endif
+			)
+		{
+			/* hand the stores over to the file and synchronize
+			   it like the other engines, in the selected mode */
+			msync (map, map_len, MS_ASYNC);
+			__lsr_sync_pass (fd);
+		}
+	}
+	munmap (map, map_len);
+	return 0;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_MMAP */
+
+#if (defined HAVE_UNISTD_H) && (defined LSR_CAN_USE_EXTENTS)
+# ifdef LSR_CAN_USE_FIEMAP
+#  define LSR_UNUSED_WITHOUT_FIEMAP
+# else
+#  define LSR_UNUSED_WITHOUT_FIEMAP LSR_ATTR ((unused))
+# endif
+
+# ifndef LSR_ANSIC
+static int __lsr_next_extent LSR_PARAMS ((const int fd,
+	struct fiemap * const fm, const off64_t from, const off64_t end,
+	off64_t * const ext_start, off64_t * const ext_end));
+# endif
+
+/**
+ * Finds the first allocated extent of the file which ends after the given
+ *	offset, clipped to the given region.
+ * \param fd The file descriptor to check.
+ * \param fm The FIEMAP request with space for one extent, or NULL if
+ *	SEEK_DATA and SEEK_HOLE should be used.
+ * \param from The offset to start looking at.
+ * \param end The end of the region.
+ * \param ext_start Pointer to the place for the start of the extent.
+ * \param ext_end Pointer to the place for the end of the extent.
+ * \return 1 if an extent was found, 0 if there is no more data in the region,
+ *	-1 on error.
+ */
+static int
+__lsr_next_extent (
+# ifdef LSR_ANSIC
+	const int fd, struct fiemap * const fm LSR_UNUSED_WITHOUT_FIEMAP,
+	const off64_t from, const off64_t end, off64_t * const ext_start,
+	off64_t * const ext_end)
+# else
+	fd, fm, from, end, ext_start, ext_end)
+	const int fd;
+	struct fiemap * const fm LSR_UNUSED_WITHOUT_FIEMAP;
+	const off64_t from;
+	const off64_t end;
+	off64_t * const ext_start;
+	off64_t * const ext_end;
+# endif
+{
+# ifdef LSR_CAN_USE_FIEMAP
+	if ( fm != NULL )
+	{
+		fm->fm_start = (__u64) from;
+		fm->fm_length = (__u64) (end - from);
+		fm->fm_extent_count = 1;
+		fm->fm_mapped_extents = 0;
+		if ( ioctl (fd, FS_IOC_FIEMAP, fm) != 0 )
+		{
+			return -1;
+		}
+		if ( fm->fm_mapped_extents == 0 )
+		{
+			return 0;
+		}
+		*ext_start = (off64_t) fm->fm_extents[0].fe_logical;
+		*ext_end = *ext_start + (off64_t) fm->fm_extents[0].fe_length;
+	}
+	else
+# endif
+	{
+		*ext_start = lseek64 (fd, from, SEEK_DATA);
+		if ( *ext_start < 0 )
+		{
+			/* ENXIO: no data after 'from' */
+			return 0;
+		}
+		*ext_end = lseek64 (fd, *ext_start, SEEK_HOLE);
+		if ( *ext_end < 0 )
+		{
+			return -1;
+		}
+	}
+	if ( *ext_start < from )
+	{
+		*ext_start = from;
+	}
+	if ( *ext_end > end )
+	{
+		*ext_end = end;
+	}
+	if ( *ext_start >= *ext_end )
+	{
+		return 0;
+	}
+	return 1;
+}
+
+/* ======================================================= */
+
+/* The allocated parts of the wiped region of a sparse file. */
+struct lsr_extents
+{
+	off64_t /*@only@*/ * bounds;	/* the start and the end of each part */
+	size_t n;			/* the number of the parts */
+	size_t room;			/* the number of the parts that fit */
+};
+
+# ifndef LSR_ANSIC
+static int __lsr_add_extent LSR_PARAMS ((struct lsr_extents * const extents,
+	const off64_t ext_start, const off64_t ext_end));
+# endif
+
+/**
+ * Adds an allocated part to the list, joining it with the previous one
+ *	if they are adjacent.
+ * \param extents The list of the parts.
+ * \param ext_start The start of the part.
+ * \param ext_end The end of the part.
+ * \return 0 on success, -1 if no memory could be allocated.
+ */
+static int
+__lsr_add_extent (
+# ifdef LSR_ANSIC
+	struct lsr_extents * const extents, const off64_t ext_start,
+	const off64_t ext_end)
+# else
+	extents, ext_start, ext_end)
+	struct lsr_extents * const extents;
+	const off64_t ext_start;
+	const off64_t ext_end;
+# endif
+{
+	off64_t /*@only@*/ * bounds;
+	size_t room;
+
+	if ( (extents->n > 0) && (extents->bounds[2 * extents->n - 1] == ext_start) )
+	{
+		/* FIEMAP reports the physical extents - the region is the same */
+		extents->bounds[2 * extents->n - 1] = ext_end;
+		return 0;
+	}
+	if ( extents->n == extents->room )
+	{
+		room = (extents->room == 0) ? 16 : extents->room * 2;
+		bounds = (off64_t *) malloc (sizeof (off64_t) * 2 * room);
+		if ( bounds == NULL )
+		{
+			return -1;
+		}
+		if ( extents->bounds != NULL )
+		{
+			LSR_MEMCOPY (bounds, extents->bounds,
+				sizeof (off64_t) * 2 * extents->n);
+			free (extents->bounds);
+		}
+		extents->bounds = bounds;
+		extents->room = room;
+	}
+	extents->bounds[2 * extents->n] = ext_start;
+	extents->bounds[2 * extents->n + 1] = ext_end;
+	extents->n++;
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_map_extents LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len,
+	struct lsr_extents * const extents));
+# endif
+
+/**
+ * Finds the allocated parts of the given region of a sparse file (with
+ *	FIEMAP or with SEEK_DATA and SEEK_HOLE on a new descriptor, so that
+ *	the offset of the file isn't moved), so that the holes don't get
+ *	allocated by the wipe. Must be called before taking the lease on
+ *	the file - opening it again would break the lease.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param extents The place for the allocated parts, to be freed with free()
+ *	of its bounds.
+ * \return 0 if the region has holes and its allocated parts were found
+ *	(maybe none), -1 if the whole region should be wiped (it has no holes
+ *	or they can't be found).
+ */
+static int
+__lsr_map_extents (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_extents * const extents)
+# else
+	fd, start, len, extents)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_extents * const extents;
+# endif
+{
+	struct fiemap /*@only@*/ *fm = NULL;
+# ifdef HAVE_SNPRINTF
+	char path[LSR_SYSFS_PATH_LEN];
+# endif
+	const off64_t end = start + len;
+	off64_t ext_start = 0;
+	off64_t ext_end = 0;
+	int mfd = -1;
+	int res = -1;
+# ifdef HAVE_FSTAT64
+	struct stat64 s;
+# else
+	struct stat s;
+# endif
+
+	extents->bounds = NULL;
+	extents->n = 0;
+	extents->room = 0;
+	/* Files with all their blocks allocated have no holes to skip. */
+# ifdef HAVE_FSTAT64
+	if ( fstat64 (fd, &s) != 0 )
+# else
+	if ( fstat (fd, &s) != 0 )
+# endif
+	{
+		return -1;
+	}
+	if ( (off64_t)s.st_blocks * 512 >= (off64_t)s.st_size )
+	{
+		return -1;
+	}
+
+# ifdef LSR_CAN_USE_FIEMAP
+	fm = (struct fiemap *) malloc ( sizeof (struct fiemap)
+		+ sizeof (struct fiemap_extent) );
+	if ( fm != NULL )
+	{
+		LSR_MEMSET (fm, 0, sizeof (struct fiemap)
+			+ sizeof (struct fiemap_extent));
+		/* flush the delayed allocations, so that they get reported */
+		fm->fm_flags = FIEMAP_FLAG_SYNC;
+		res = __lsr_next_extent (fd, fm, start, end, &ext_start, &ext_end);
+		fm->fm_flags = 0;
+		if ( res < 0 )
+		{
+			/* FIEMAP not supported by the filesystem */
+			free (fm);
+			fm = NULL;
+		}
+	}
+# endif
+	if ( fm == NULL )
+	{
+		/* SEEK_DATA and SEEK_HOLE would move the offset of
+		   the descriptor, which the program may be using */
+# ifdef HAVE_SNPRINTF
+		snprintf (path, sizeof (path), "/proc/self/fd/%d", fd);
+		path[sizeof (path) - 1] = '\0';
+		if ( __lsr_real_open_location () != NULL )
+		{
+			mfd = (*__lsr_real_open_location ()) (path, O_RDONLY);
+		}
+# endif
+		if ( mfd < 0 )
+		{
+			return -1;
+		}
+		res = __lsr_next_extent (mfd, NULL, start, end,
+			&ext_start, &ext_end);
+	}
+	while ( res > 0 )
+	{
+		if ( __lsr_add_extent (extents, ext_start, ext_end) != 0 )
+		{
+			res = -1;
+			break;
+		}
+		if ( ext_end >= end )
+		{
+			break;
+		}
+		res = __lsr_next_extent ((fm != NULL) ? fd : mfd, fm, ext_end, end,
+			&ext_start, &ext_end);
+	}
+	free (fm);
+	if ( mfd >= 0 )
+	{
+		close (mfd);
+	}
+	if ( (res < 0) || ((extents->n == 1) && (extents->bounds[0] == start)
+		&& (extents->bounds[1] == end)) )
+	{
+		/* no holes in the region or can't find them */
+		free (extents->bounds);
+		extents->bounds = NULL;
+		extents->n = 0;
+		return -1;
+	}
+	return 0;
+}
+#endif /* HAVE_UNISTD_H && LSR_CAN_USE_EXTENTS */
+
+/* ======================================================= */
+
+#ifdef LSR_CAN_DETECT_COW
+struct lsr_dev_type
+{
+	dev_t dev;			/* the device */
+	fsid_t fsid;			/* the ID of its filesystem */
+	unsigned long int fs_type;	/* the magic number of its filesystem */
+	unsigned long int encrypted;	/* non-zero if the device is dm-crypt */
+	unsigned long int ready;	/* non-zero when the fields above are valid */
+};
+
+static struct lsr_dev_type dev_types[LSR_NDEVS];
+static unsigned int ndev_types = 0;
+
+# ifdef LSR_CAN_DETECT_DM_CRYPT
+#  ifndef LSR_ANSIC
+static int __lsr_is_crypt_uuid LSR_PARAMS ((const char * const path));
+#  endif
+
+/**
+ * Checks if the given device-mapper UUID file belongs to a dm-crypt device.
+ * \param path The path to the "dm/uuid" file in sysfs.
+ * \return non-zero if the device is a dm-crypt (LUKS, plain) device.
+ */
+static int
+__lsr_is_crypt_uuid (
+#  ifdef LSR_ANSIC
+	const char * const path)
+#  else
+	path)
+	const char * const path;
+#  endif
+{
+	FILE * fp;
+	char uuid[16];
+	int res = 0;
+
+	fp = (*__lsr_real_fopen_location ()) (path, "r");
+	if ( fp == NULL )
+	{
+		return 0;
+	}
+	if ( fgets (uuid, sizeof (uuid), fp) != NULL )
+	{
+		/* dm-crypt names its devices "CRYPT-<type>-..." */
+		res = (strncmp (uuid, "CRYPT-", 6) == 0) ? 1 : 0;
+	}
+	fclose (fp);
+	return res;
+}
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static int __lsr_is_dm_crypt LSR_PARAMS ((const dev_t dev));
+#  endif
+
+/**
+ * Checks if the given block device is a dm-crypt device or lies only
+ * on such devices (like an LVM volume on LUKS).
+ * \param dev The device to check.
+ * \return non-zero if the device's data is encrypted by dm-crypt.
+ */
+static int
+__lsr_is_dm_crypt (
+#  ifdef LSR_ANSIC
+	const dev_t dev)
+#  else
+	dev)
+	const dev_t dev;
+#  endif
+{
+	char path[LSR_SYSFS_PATH_LEN];
+
+	snprintf (path, sizeof (path), "/sys/dev/block/%u:%u",
+		major (dev), minor (dev));
+	path[sizeof (path) - 1] = '\0';
+	return (__lsr_is_crypt_dir (path) == 1) ? 1 : 0;
+}
+# endif /* LSR_CAN_DETECT_DM_CRYPT */
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_get_dev_type LSR_PARAMS ((const int fd,
+	const dev_t dev, struct lsr_dev_type * const type));
+# endif
+
+/**
+ * Gets the type of the filesystem with the given file and checks if its
+ * device is encrypted. The results are remembered per filesystem, so the
+ * device is checked once for each of them. The device number alone isn't
+ * enough, because the anonymous devices (major 0) of unmounted filesystems
+ * are given to other ones later.
+ * \param fd The file descriptor of a file on the device.
+ * \param dev The device of the file.
+ * \param type The place for the information about the device.
+ * \return 0 on success, -1 if the type of the device is unknown.
+ */
+static int
+__lsr_get_dev_type (
+# ifdef LSR_ANSIC
+	const int fd, const dev_t dev, struct lsr_dev_type * const type)
+# else
+	fd, dev, type)
+	const int fd;
+	const dev_t dev;
+	struct lsr_dev_type * const type;
+# endif
+{
+	struct statfs fs;
+	unsigned int i;
+# ifdef __GNUC__
+	unsigned int slot;
+# endif
+
+	if ( fstatfs (fd, &fs) != 0 )
+	{
+		return -1;
+	}
+	type->dev = dev;
+	type->fsid = fs.f_fsid;
+	type->fs_type = ((unsigned long int) fs.f_type) & 0xFFFFFFFFUL;
+	for ( i = 0; i < LSR_NDEVS; i++ )
+	{
+		if ( dev_types[i].ready == 0 )
+		{
+			continue;
+		}
+# ifdef __GNUC__
+		__sync_synchronize ();
+# endif
+		if ( (dev_types[i].dev == dev)
+			&& (dev_types[i].fs_type == type->fs_type)
+			&& (memcmp (&dev_types[i].fsid, &type->fsid,
+				sizeof (type->fsid)) == 0) )
+		{
+			*type = dev_types[i];
+			return 0;
+		}
+	}
+# ifdef LSR_CAN_DETECT_DM_CRYPT
+	type->encrypted = (unsigned long int) __lsr_is_dm_crypt (dev);
+# else
+	type->encrypted = 0;
+# endif
+	type->ready = 1;
+# ifdef __GNUC__
+	/* a slot is never reused, so the threads don't need a lock */
+	slot = __sync_fetch_and_add (&ndev_types, 1);
+	if ( slot < LSR_NDEVS )
+	{
+		dev_types[slot].dev = type->dev;
+		dev_types[slot].fsid = type->fsid;
+		dev_types[slot].fs_type = type->fs_type;
+		dev_types[slot].encrypted = type->encrypted;
+		__sync_synchronize ();
+		dev_types[slot].ready = 1;
+	}
+# endif
+	return 0;
+}
+
+/* ======================================================= */
+
+# ifdef LSR_CAN_SET_NOCOW
+#  ifndef LSR_ANSIC
+static int __lsr_get_nocow LSR_PARAMS ((const int fd));
+#  endif
+
+/**
+ * Checks if the given file is marked as not copy-on-write.
+ * \param fd The file descriptor to check.
+ * \return non-zero if the file is not copy-on-write.
+ */
+static int
+__lsr_get_nocow (
+#  ifdef LSR_ANSIC
+	const int fd)
+#  else
+	fd)
+	const int fd;
+#  endif
+{
+	int flags = 0;
+
+	if ( ioctl (fd, FS_IOC_GETFLAGS, &flags) != 0 )
+	{
+		return 0;
+	}
+	return ((flags & FS_NOCOW_FL) != 0) ? 1 : 0;
+}
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static int __lsr_set_nocow LSR_PARAMS ((const int fd,
+	int * const old_flags));
+#  endif
+
+/**
+ * Marks the given file as not copy-on-write. Btrfs accepts the flag only
+ * for empty files, so it is read back to see if it has been set.
+ * \param fd The file descriptor to mark.
+ * \param old_flags The place for the flags of the file before the change,
+ *	to be restored with __lsr_reset_nocow(), or -1 if nothing has changed.
+ * \return 0 if the file is now not copy-on-write.
+ */
+static int
+__lsr_set_nocow (
+#  ifdef LSR_ANSIC
+	const int fd, int * const old_flags)
+#  else
+	fd, old_flags)
+	const int fd;
+	int * const old_flags;
+#  endif
+{
+	int flags = 0;
+
+	*old_flags = -1;
+	if ( ioctl (fd, FS_IOC_GETFLAGS, &flags) != 0 )
+	{
+		return -1;
+	}
+	if ( (flags & FS_NOCOW_FL) == 0 )
+	{
+		*old_flags = flags;
+		flags |= FS_NOCOW_FL;
+		if ( ioctl (fd, FS_IOC_SETFLAGS, &flags) != 0 )
+		{
+			*old_flags = -1;
+			return -1;
+		}
+	}
+	return (__lsr_get_nocow (fd) != 0) ? 0 : -1;
+}
+
+/* ======================================================= */
+
+#  ifndef LSR_ANSIC
+static void __lsr_reset_nocow LSR_PARAMS ((const int fd,
+	const int old_flags));
+#  endif
+
+/**
+ * Gives the file back the flags it had before __lsr_set_nocow().
+ * \param fd The file descriptor of the file.
+ * \param old_flags The flags saved by __lsr_set_nocow(), -1 for no change.
+ */
+static void
+__lsr_reset_nocow (
+#  ifdef LSR_ANSIC
+	const int fd, const int old_flags)
+#  else
+	fd, old_flags)
+	const int fd;
+	const int old_flags;
+#  endif
+{
+	int flags = old_flags;
+
+	if ( old_flags != -1 )
+	{
+		ioctl (fd, FS_IOC_SETFLAGS, &flags);
+	}
+}
+# endif /* LSR_CAN_SET_NOCOW */
+
+/* ======================================================= */
+
+# if (defined LSR_CAN_USE_FIEMAP) && (defined FIEMAP_EXTENT_SHARED) \
+	&& (defined HAVE_MALLOC)
+#  define LSR_CAN_FIND_SHARED 1
+#  ifndef LSR_ANSIC
+static int __lsr_has_shared_extents LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len));
+#  endif
+
+/**
+ * Checks if any part of the given region shares its blocks with
+ * other files (reflinks, snapshots, deduplication).
+ * \param fd The file descriptor to check.
+ * \param start The start of the region.
+ * \param len The length of the region.
+ * \return non-zero if the region has shared blocks.
+ */
+static int
+__lsr_has_shared_extents (
+#  ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len)
+#  else
+	fd, start, len)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+#  endif
+{
+	struct fiemap * fm;
+	off64_t pos = start;
+	const off64_t end = start + len;
+	unsigned int i;
+	int shared = 0;
+	int last = 0;
+
+	fm = (struct fiemap *) malloc (sizeof (struct fiemap)
+		+ LSR_FIEMAP_EXTENTS * sizeof (struct fiemap_extent));
+	if ( fm == NULL )
+	{
+		return 0;
+	}
+	while ( (pos < end) && (shared == 0) && (last == 0) )
+	{
+		LSR_MEMSET (fm, 0, sizeof (struct fiemap));
+		fm->fm_start = (__u64) pos;
+		fm->fm_length = (__u64) (end - pos);
+		fm->fm_extent_count = LSR_FIEMAP_EXTENTS;
+		if ( (ioctl (fd, FS_IOC_FIEMAP, fm) != 0)
+			|| (fm->fm_mapped_extents == 0) )
+		{
+			break;
+		}
+		for ( i = 0; i < fm->fm_mapped_extents; i++ )
+		{
+			if ( (fm->fm_extents[i].fe_flags & FIEMAP_EXTENT_SHARED) != 0 )
+			{
+				shared = 1;
+				break;
+			}
+			if ( (fm->fm_extents[i].fe_flags & FIEMAP_EXTENT_LAST) != 0 )
+			{
+				last = 1;
+			}
+		}
+		i = fm->fm_mapped_extents - 1;
+		pos = (off64_t) (fm->fm_extents[i].fe_logical
+			+ fm->fm_extents[i].fe_length);
+	}
+	free (fm);
+	return shared;
+}
+# else
+#  undef LSR_CAN_FIND_SHARED
+# endif
+
+# ifdef LSR_CAN_FIND_SHARED
+#  define LSR_UNUSED_WITHOUT_SHARED
+# else
+#  define LSR_UNUSED_WITHOUT_SHARED LSR_ATTR ((unused))
+# endif
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_is_cow LSR_PARAMS ((const int fd, const dev_t dev,
+	const off64_t start, const off64_t len));
+# endif
+
+/**
+ * Checks if overwriting the given region would write the new data
+ * somewhere else and leave the old data on the disk.
+ * \param fd The file descriptor to check.
+ * \param dev The device of the file.
+ * \param start The start of the region.
+ * \param len The length of the region.
+ * \return non-zero if the region is copy-on-write.
+ */
+static int
+__lsr_is_cow (
+# ifdef LSR_ANSIC
+	const int fd, const dev_t dev,
+	const off64_t start LSR_UNUSED_WITHOUT_SHARED,
+	const off64_t len LSR_UNUSED_WITHOUT_SHARED)
+# else
+	fd, dev, start, len)
+	const int fd;
+	const dev_t dev;
+	const off64_t start LSR_UNUSED_WITHOUT_SHARED;
+	const off64_t len LSR_UNUSED_WITHOUT_SHARED;
+# endif
+{
+	struct lsr_dev_type type;
+
+	if ( __lsr_get_dev_type (fd, dev, &type) != 0 )
+	{
+		type.fs_type = 0;
+	}
+	if ( type.fs_type == LSR_FS_ZFS )
+	{
+		return 1;
+	}
+	if ( (type.fs_type == LSR_FS_BTRFS) || (type.fs_type == LSR_FS_BCACHEFS) )
+	{
+# ifdef LSR_CAN_SET_NOCOW
+		if ( __lsr_get_nocow (fd) == 0 )
+# endif
+		{
+			return 1;
+		}
+	}
+# ifdef LSR_CAN_FIND_SHARED
+	/* reflinked or snapshotted blocks (like on XFS) are copied on write, too */
+	return __lsr_has_shared_extents (fd, start, len);
+# else
+	return 0;
+# endif
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_is_encrypted LSR_PARAMS ((const int fd, const dev_t dev));
+# endif
+
+/**
+ * Checks if the given file is stored encrypted, so that one pass hides
+ * the old data as well as many.
+ * \param fd The file descriptor to check.
+ * \param dev The device of the file.
+ * \return non-zero if the file is encrypted by fscrypt or lies on dm-crypt.
+ */
+static int
+__lsr_is_encrypted (
+# ifdef LSR_ANSIC
+	const int fd, const dev_t dev)
+# else
+	fd, dev)
+	const int fd;
+	const dev_t dev;
+# endif
+{
+	struct lsr_dev_type type;
+# ifdef LSR_CAN_DETECT_FSCRYPT
+	int flags = 0;
+
+	if ( (ioctl (fd, FS_IOC_GETFLAGS, &flags) == 0)
+		&& ((flags & FS_ENCRYPT_FL) != 0) )
+	{
+		return 1;
+	}
+# endif
+	if ( (__lsr_get_dev_type (fd, dev, &type) == 0)
+		&& (type.encrypted != 0) )
+	{
+		return 1;
+	}
+	return 0;
+}
+#endif /* LSR_CAN_DETECT_COW */
+
+/* ======================================================= */
+
+/**
+ * Checks if the data of the block device with the given directory in sysfs
+ *	is encrypted by dm-crypt: if the device is a dm-crypt device or if all
+ *	the devices under it are, checked down to the disks.
+ * \param dir The directory of the device, like "/sys/dev/block/253:1".
+ * \return 1 if the device's data is encrypted, 0 if not, -1 if this
+ *	can't be checked on this system.
+ */
+int
+__lsr_is_crypt_dir (
+#ifdef LSR_ANSIC
+	const char * const dir LSR_ONLY_WITH_DM_CRYPT)
+#else
+	dir)
+	const char * const dir LSR_ONLY_WITH_DM_CRYPT;
+#endif
+{
+#ifdef LSR_CAN_DETECT_DM_CRYPT
+	char path[LSR_SYSFS_PATH_LEN];
+	DIR * dirp;
+	struct dirent * entry;
+	int res = 1;
+	unsigned int nslaves = 0;
+
+	if ( (dir == NULL) || (__lsr_real_fopen_location () == NULL)
+		|| (strlen (dir) + sizeof ("/slaves/") >= sizeof (path)) )
+	{
+		return 0;
+	}
+	snprintf (path, sizeof (path), "%s/dm/uuid", dir);
+	path[sizeof (path) - 1] = '\0';
+	if ( __lsr_is_crypt_uuid (path) != 0 )
+	{
+		return 1;
+	}
+	snprintf (path, sizeof (path), "%s/slaves", dir);
+	path[sizeof (path) - 1] = '\0';
+	dirp = opendir (path);
+	if ( dirp == NULL )
+	{
+		return 0;
+	}
+	/* one plain device under a mirror or a volume group would
+	   keep a copy of the data in clear text */
+	while ( (res != 0) && ((entry = readdir (dirp)) != NULL) )
+	{
+		if ( entry->d_name[0] == '.' )
+		{
+			continue;
+		}
+		nslaves++;
+		if ( strlen (dir) + sizeof ("/slaves/") + strlen (entry->d_name)
+			>= sizeof (path) )
+		{
+			/* too deep to check */
+			res = 0;
+			break;
+		}
+		snprintf (path, sizeof (path), "%s/slaves/%s", dir, entry->d_name);
+		path[sizeof (path) - 1] = '\0';
+		res = (__lsr_is_crypt_dir (path) == 1) ? 1 : 0;
+	}
+	closedir (dirp);
+	return (nslaves != 0) ? res : 0;
+#else
+	return -1;
+#endif
+}
 
-	if ( (buffer == NULL) || (buflen == 0) || (selected == NULL) )
+/* ======================================================= */
+
+#ifdef LSR_CAN_DETECT_COW
+# ifndef LSR_ANSIC
+static int __lsr_dev_in_memory LSR_PARAMS ((const int fd, const dev_t dev));
+# endif
+
+/**
+ * Checks if the given file is kept only in memory (tmpfs, ramfs), so that
+ * nothing of it reaches a disk. The files on hugetlbfs are in memory, too,
+ * but can't be written to and need mappings aligned to huge pages.
+ * \param fd The file descriptor to check.
+ * \param dev The device of the file.
+ * \return non-zero if the file is in memory.
+ */
+static int
+__lsr_dev_in_memory (
+# ifdef LSR_ANSIC
+	const int fd, const dev_t dev)
+# else
+	fd, dev)
+	const int fd;
+	const dev_t dev;
+# endif
+{
+	struct lsr_dev_type type;
+
+	if ( __lsr_get_dev_type (fd, dev, &type) != 0 )
 	{
-		return;
+		return 0;
 	}
+	return ((type.fs_type == LSR_FS_TMPFS) || (type.fs_type == LSR_FS_RAMFS)) ? 1 : 0;
+}
+#endif /* LSR_CAN_DETECT_COW */
 
-	if ( patterns_dod[0] == 0xFFFFFFFF )
+/* ======================================================= */
+
+/**
+ * Checks if the given file is kept only in memory (tmpfs, ramfs),
+ * so that syncing it is useless.
+ * \param fd The file descriptor to check.
+ * \return non-zero if the file is in memory.
+ */
+int
+__lsr_fd_in_memory (
+#ifdef LSR_ANSIC
+	const int fd LSR_UNUSED_WITHOUT_DEVICES)
+#else
+	fd)
+	const int fd LSR_UNUSED_WITHOUT_DEVICES;
+#endif
+{
+#ifdef LSR_CAN_DETECT_COW
+# ifdef HAVE_FSTAT64
+	struct stat64 s;
+
+	if ( fstat64 (fd, &s) != 0 )
+# else
+	struct stat s;
+
+	if ( fstat (fd, &s) != 0 )
+# endif
 	{
-		/* Not initialized. Perform initialization. */
-#ifdef LSR_WANT_RANDOM
-		opt_method = LSR_METHOD_RANDOM;
+		return 0;
+	}
+	return __lsr_dev_in_memory (fd, s.st_dev);
 #else
-# ifdef LSR_WANT_SCHNEIER
-		opt_method = LSR_METHOD_SCHNEIER;
+	return 0;
+#endif
+}
+
+/* ======================================================= */
+
+#if (defined LSR_CAN_DETECT_COW) && (defined HAVE_UNISTD_H) \
+	&& (defined LSR_CAN_USE_MMAP) && (defined HAVE_MALLOC)
+# define LSR_CAN_WIPE_IN_MEMORY 1
+# ifndef LSR_ANSIC
+static int __lsr_wipe_region_memory LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given region of a file kept in memory with a single pass, without
+ *	syncing: storing the data in place (in a mapping or with writes when
+ *	the file can't be mapped) is all what can be done and more passes
+ *	don't change anything.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if the caller should fall back
+ *	to other methods, -2 if a write has failed and the old data is still there.
+ */
+static int
+__lsr_wipe_region_memory (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
 # else
-#  ifdef LSR_WANT_DOD
-		opt_method = LSR_METHOD_DOD;
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char pattern[3];
+	unsigned char * map;
+	unsigned char * buf;
+	off64_t map_start;
+	size_t map_len;
+	size_t page;
+	size_t done;
+	size_t chunk;
+	int random_pass;
+# ifdef HAVE_FSTAT64
+	struct stat64 s;
+# else
+	struct stat s;
+# endif
+
+	if ( (off64_t)(size_t)len != len )
+	{
+		return -1;
+	}
+	random_pass = __lsr_fill_scheduled (0, pattern, sizeof (pattern), schedule);
+	done = 0;
+
+	/* Storing to a hole in a mapping can make a SIGBUS when the filesystem
+	   is full, so map only files without holes. */
+# ifdef HAVE_FSTAT64
+	if ( (fstat64 (fd, &s) == 0)
+# else
+	if ( (fstat (fd, &s) == 0)
+# endif
+		&& ((off64_t)s.st_blocks * 512 >= (off64_t)s.st_size) )
+	{
+# ifdef HAVE_SYSCONF
+		page = (size_t) sysconf (_SC_PAGESIZE);
+# else
+#  ifdef HAVE_GETPAGESIZE
+		page = (size_t) getpagesize ();
 #  else
-		opt_method = LSR_METHOD_GUTMANN;
+		page = 4096;
 #  endif
 # endif
-#endif
+		map_start = start - (start % (off64_t)page);
+		map_len = (size_t) (start + len - map_start);
+		map = (unsigned char *) mmap64 (NULL, map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, map_start);
+		if ( map != MAP_FAILED )
+		{
+			for ( ; (done < (size_t)len) && (__lsr_sig_recvd () == 0); done += chunk )
+			{
+				chunk = N_MMAP_CHUNK;
+				if ( chunk > (size_t)len - done )
+				{
+					chunk = (size_t)len - done;
+				}
+				if ( __lsr_populate_mapped (map, (size_t) (start - map_start)
+					+ done, chunk, page) != 0 )
+				{
+					/* e.g. a full tmpfs - writing the rest
+					   will tell if it can be stored */
+					break;
+				}
+				if ( random_pass != 0 )
+				{
+					__lsr_fill_stream_at (schedule->last_stream,
+						map + (start - map_start) + done,
+						chunk, start + (off64_t)done);
+				}
+				else
+				{
+					__lsr_fill_mapped (map + (start - map_start) + done,
+						chunk, pattern, done % 3);
+				}
+			}
+			munmap (map, map_len);
+			if ( (done >= (size_t)len) || (__lsr_sig_recvd () != 0) )
+			{
+				return 0;
+			}
+		}
+	}
 
-#if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
-		patterns_dod[0] = (unsigned int)(random () & 0xFFF);
+	/* e.g. a write-only descriptor - write the (rest of the) pass instead */
+	buf = (unsigned char *) malloc (N_PAGE_BYTES);
+	if ( buf == NULL )
+	{
+		return -1;
+	}
+	if ( random_pass == 0 )
+	{
+		/* N_PAGE_BYTES is a multiple of 3, so only the start matters */
+		__lsr_fill_mapped (buf, N_PAGE_BYTES, pattern, done % 3);
+	}
+	for ( ; (done < (size_t)len) && (__lsr_sig_recvd () == 0); done += chunk )
+	{
+		chunk = N_PAGE_BYTES;
+		if ( chunk > (size_t)len - done )
+		{
+			chunk = (size_t)len - done;
+		}
+		if ( random_pass != 0 )
+		{
+			__lsr_fill_stream_at (schedule->last_stream, buf, chunk,
+				start + (off64_t)done);
+		}
+		if ( __lsr_write_at (fd, buf, chunk, start + (off64_t)done) != (ssize_t)chunk )
+		{
+			/* the old data is still there */
+			free (buf);
+			return -2;
+		}
+	}
+	free (buf);
+	return 0;
+}
 #else
-		patterns_dod[0] = (unsigned int)(rand () & 0xFFF);
+# undef LSR_CAN_WIPE_IN_MEMORY
 #endif
-		patterns_dod[1] = (~patterns_dod[0]) & 0xFFF;
+
+/* ======================================================= */
+
+#if (defined HAVE_UNISTD_H) && (defined HAVE_MALLOC) && (defined HAVE_SNPRINTF) \
+	&& (defined HAVE_FCNTL_H) && (defined HAVE_SYS_STAT_H) \
+	&& ((defined HAVE_FSTAT64) || (defined HAVE_FSTAT))
+# define LSR_CAN_VERIFY 1
+
+typedef size_t (*lsr_compare_kernel) LSR_PARAMS ((
+	const unsigned char * const data, const unsigned char * const expected,
+	const size_t len));
+
+# ifndef LSR_ANSIC
+static size_t __lsr_compare_generic LSR_PARAMS ((
+	const unsigned char * const data, const unsigned char * const expected,
+	const size_t len));
+# endif
+
+/**
+ * Finds the first byte which differs from the expected one.
+ * \param data The data to check.
+ * \param expected The expected data.
+ * \param len The length of the data.
+ * \return the offset of the first differing byte, len if all are equal.
+ */
+static size_t
+__lsr_compare_generic (
+# ifdef LSR_ANSIC
+	const unsigned char * const data, const unsigned char * const expected,
+	const size_t len)
+# else
+	data, expected, len)
+	const unsigned char * const data;
+	const unsigned char * const expected;
+	const size_t len;
+# endif
+{
+	size_t done;
+
+	for ( done = 0; done < len; done++ )
+	{
+		if ( data[done] != expected[done] )
+		{
+			break;
+		}
+	}
+	return done;
+}
+
+# ifdef LSR_CAN_USE_SIMD
+/* The vector kernels compare whole registers and find the exact byte
+   only in the register which differs. */
+
+#  define LSR_COMPARE_KERNEL(name, isa, vtype, vsize, load, differ) \
+static size_t LSR_ATTR ((target (isa))) \
+name ( \
+	const unsigned char * const data, const unsigned char * const expected, \
+	const size_t len) \
+{ \
+	size_t done; \
+	vtype a, b; \
+	\
+	for ( done = 0; done + vsize <= len; done += vsize ) \
+	{ \
+		a = load ((const vtype *) (const void *) (data + done)); \
+		b = load ((const vtype *) (const void *) (expected + done)); \
+		if ( differ (a, b) ) \
+		{ \
+			break; \
+		} \
+	} \
+	return done + __lsr_compare_generic (data + done, expected + done, len - done); \
+}
+
+#  define LSR_DIFFER_SSE2(a, b) (_mm_movemask_epi8 (_mm_cmpeq_epi8 ((a), (b))) != 0xFFFF)
+#  define LSR_DIFFER_AVX2(a, b) (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 ((a), (b))) != -1)
+#  define LSR_DIFFER_AVX512(a, b) (_mm512_cmpneq_epi8_mask ((a), (b)) != 0)
+
+LSR_COMPARE_KERNEL (__lsr_compare_sse2, "sse2", __m128i, 16,
+	_mm_loadu_si128, LSR_DIFFER_SSE2)
+LSR_COMPARE_KERNEL (__lsr_compare_avx2, "avx2", __m256i, 32,
+	_mm256_loadu_si256, LSR_DIFFER_AVX2)
+LSR_COMPARE_KERNEL (__lsr_compare_avx512, "avx512bw", __m512i, 64,
+	_mm512_loadu_si512, LSR_DIFFER_AVX512)
+#  undef LSR_DIFFER_AVX512
+#  undef LSR_DIFFER_AVX2
+#  undef LSR_DIFFER_SSE2
+#  undef LSR_COMPARE_KERNEL
+# endif /* LSR_CAN_USE_SIMD */
+
+static lsr_compare_kernel compare_kernel = NULL;
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static size_t __lsr_compare LSR_PARAMS ((const unsigned char * const data,
+	const unsigned char * const expected, const size_t len));
+# endif
+
+/**
+ * Finds the first byte which differs from the expected one, with the best
+ *	kernel for the processor.
+ * \param data The data to check.
+ * \param expected The expected data.
+ * \param len The length of the data.
+ * \return the offset of the first differing byte, len if all are equal.
+ */
+static size_t
+__lsr_compare (
+# ifdef LSR_ANSIC
+	const unsigned char * const data, const unsigned char * const expected,
+	const size_t len)
+# else
+	data, expected, len)
+	const unsigned char * const data;
+	const unsigned char * const expected;
+	const size_t len;
+# endif
+{
+	if ( compare_kernel == NULL )
+	{
+		/* the first use - select the kernel */
+		compare_kernel = &__lsr_compare_generic;
+# ifdef LSR_CAN_USE_SIMD
+		__builtin_cpu_init ();
+		if ( __builtin_cpu_supports ("avx512bw") )
+		{
+			compare_kernel = &__lsr_compare_avx512;
+		}
+		else if ( __builtin_cpu_supports ("avx2") )
+		{
+			compare_kernel = &__lsr_compare_avx2;
+		}
+		else if ( __builtin_cpu_supports ("sse2") )
+		{
+			compare_kernel = &__lsr_compare_sse2;
+		}
+# endif
+	}
+	return (*compare_kernel) (data, expected, len);
+}
+
+/* ======================================================= */
+
+struct lsr_verify
+{
+	off64_t ext_start;		/* the start of the current bad extent */
+	off64_t ext_end;		/* the end of the current bad extent */
+	off64_t nbad;			/* the number of bad bytes found */
+	unsigned long int nreports;	/* the number of extents reported */
+	unsigned long int ino;		/* the inode of the file, for the reports */
+	unsigned long int dev;		/* the device of the file, for the reports */
+};
+
+# ifndef LSR_ANSIC
+static void __lsr_verify_report LSR_PARAMS ((struct lsr_verify * const ver));
+# endif
+
+/**
+ * Reports the current bad extent, if any.
+ * \param ver The state of the verification.
+ */
+static void
+__lsr_verify_report (
+# ifdef LSR_ANSIC
+	struct lsr_verify * const ver)
+# else
+	ver)
+	struct lsr_verify * const ver;
+# endif
+{
+	if ( ver->ext_end <= ver->ext_start )
+	{
+		return;
+	}
+	ver->nbad += ver->ext_end - ver->ext_start;
+	if ( ver->nreports < LSR_VERIFY_MAX_REPORTS )
+	{
+# if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+		syslog (LOG_WARNING, "libsecrm: verification of inode %lu on device 0x%lx:"
+			" %lu bytes at offset %lu differ from the last pass",
+			ver->ino, ver->dev, (unsigned long int) (ver->ext_end - ver->ext_start),
+			(unsigned long int) ver->ext_start);
+# endif
+# ifdef LSR_DEBUG
+		fprintf (stderr, "libsecrm: verification: %ld bytes at offset %ld differ\n",
+			(long int) (ver->ext_end - ver->ext_start), (long int) ver->ext_start);
+		fflush (stderr);
+# endif
+	}
+	ver->nreports++;
+	ver->ext_start = ver->ext_end;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_verify_span LSR_PARAMS ((struct lsr_verify * const ver,
+	const unsigned char * const data, const unsigned char * const expected,
+	const size_t len, const off64_t offset));
+# endif
+
+/**
+ * Compares the data read back with the expected data and collects the bad
+ *	sectors into extents.
+ * \param ver The state of the verification.
+ * \param data The data read back.
+ * \param expected The expected data.
+ * \param len The length of the data.
+ * \param offset The offset of the data in the file.
+ */
+static void
+__lsr_verify_span (
+# ifdef LSR_ANSIC
+	struct lsr_verify * const ver, const unsigned char * const data,
+	const unsigned char * const expected, const size_t len, const off64_t offset)
+# else
+	ver, data, expected, len, offset)
+	struct lsr_verify * const ver;
+	const unsigned char * const data;
+	const unsigned char * const expected;
+	const size_t len;
+	const off64_t offset;
+# endif
+{
+	size_t pos = 0;
+	size_t bad;
+	size_t sector;
+
+	while ( pos < len )
+	{
+		bad = pos + __lsr_compare (data + pos, expected + pos, len - pos);
+		if ( bad >= len )
+		{
+			break;
+		}
+		/* the extents are made of whole sectors */
+		bad -= (size_t) ((offset + (off64_t) bad) % LSR_VERIFY_SECTOR);
+		if ( bad < pos )
+		{
+			bad = pos;
+		}
+		if ( offset + (off64_t) bad != ver->ext_end )
+		{
+			/* not a continuation of the current extent */
+			__lsr_verify_report (ver);
+			ver->ext_start = offset + (off64_t) bad;
+		}
+		pos = bad;
+		do
+		{
+			sector = LSR_VERIFY_SECTOR
+				- (size_t) ((offset + (off64_t) pos) % LSR_VERIFY_SECTOR);
+			if ( sector > len - pos )
+			{
+				sector = len - pos;
+			}
+			if ( __lsr_compare (data + pos, expected + pos, sector) == sector )
+			{
+				break;
+			}
+			pos += sector;
+		} while ( pos < len );
+		ver->ext_end = offset + (off64_t) pos;
+	}
+}
+
+/* ======================================================= */
+
+# if (defined POSIX_FADV_DONTNEED) \
+	&& ((defined HAVE_POSIX_FADVISE) || (defined HAVE_POSIX_FADVISE64))
+#  define LSR_UNUSED_WITHOUT_FADVISE
+# else
+#  define LSR_UNUSED_WITHOUT_FADVISE LSR_ATTR ((unused))
+# endif
+
+# ifndef LSR_ANSIC
+static int __lsr_verify_open LSR_PARAMS ((const char * const path,
+	const off64_t start, const off64_t len, const int direct));
+# endif
+
+/**
+ * Opens a new descriptor for reading the wiped data back.
+ * \param path The path to the file.
+ * \param start The offset of the checked region in the file.
+ * \param len The length of the checked region.
+ * \param direct Non-zero to bypass the page cache with direct I/O, zero
+ *	to read through the page cache after dropping the cached data.
+ * \return the new descriptor or -1 in case of error.
+ */
+static int
+__lsr_verify_open (
+# ifdef LSR_ANSIC
+	const char * const path, const off64_t start LSR_UNUSED_WITHOUT_FADVISE,
+	const off64_t len LSR_UNUSED_WITHOUT_FADVISE, const int direct)
+# else
+	path, start, len, direct)
+	const char * const path;
+	const off64_t start LSR_UNUSED_WITHOUT_FADVISE;
+	const off64_t len LSR_UNUSED_WITHOUT_FADVISE;
+	const int direct;
+# endif
+{
+	int vfd = -1;
+
+	if ( __lsr_real_open_location () == NULL )
+	{
+		return -1;
+	}
+	if ( direct != 0 )
+	{
+# ifdef O_DIRECT
+		vfd = (*__lsr_real_open_location ()) (path, O_RDONLY | O_DIRECT);
+# endif
+		return vfd;
+	}
+	vfd = (*__lsr_real_open_location ()) (path, O_RDONLY);
+# if (defined POSIX_FADV_DONTNEED) \
+	&& ((defined HAVE_POSIX_FADVISE) || (defined HAVE_POSIX_FADVISE64))
+	if ( vfd >= 0 )
+	{
+		/* drop the cached data, so that it's read from the disk */
+		posix_fadvise64 (vfd, start, len, POSIX_FADV_DONTNEED);
+	}
+# endif
+	return vfd;
+}
+
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static int __lsr_verify_region LSR_PARAMS ((const int fd,
+	const off64_t origin, const off64_t start, const off64_t len,
+	const struct lsr_schedule * const schedule,
+	const unsigned long int ino, const unsigned long int dev));
+# endif
+
+/**
+ * Reads the wiped region back, bypassing the page cache if possible,
+ *	and checks that it holds the data of the last pass.
+ * \param fd The file descriptor of the wiped file.
+ * \param origin The offset the patterns were aligned to when writing.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns of the wipe.
+ * \param ino The inode of the file, for the reports.
+ * \param dev The device of the file, for the reports.
+ * \return 0 if the region holds the data of the last pass, -1 if it doesn't
+ *	or if it couldn't be checked.
+ */
+static int
+__lsr_verify_region (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t origin, const off64_t start,
+	const off64_t len, const struct lsr_schedule * const schedule,
+	const unsigned long int ino, const unsigned long int dev)
+# else
+	fd, origin, start, len, schedule, ino, dev)
+	const int fd;
+	const off64_t origin;
+	const off64_t start;
+	const off64_t len;
+	const struct lsr_schedule * const schedule;
+	const unsigned long int ino;
+	const unsigned long int dev;
+# endif
+{
+	char path[LSR_SYSFS_PATH_LEN];
+	struct lsr_verify ver;
+	unsigned char pattern[LSR_PATTERN_LEN];
+	unsigned char rotated[LSR_PATTERN_LEN];
+	void /*@only@*/ *data = NULL;
+	unsigned char * expected;
+	const off64_t end = start + len;
+	off64_t seg;
+	off64_t seg_end;
+	off64_t off;
+	off64_t lo;
+	off64_t hi;
+	ssize_t got;
+	size_t phase;
+	size_t k;
+	int vfd = -1;
+	int rfd;
+	int direct = 0;
+	int unread = 0;
+	int random_pass;
+
+	ver.ext_start = 0;
+	ver.ext_end = 0;
+	ver.nbad = 0;
+	ver.nreports = 0;
+	ver.ino = ino;
+	ver.dev = dev;
+
+# if (defined LAST_PASS_ZERO) || (defined ALL_PASSES_ZERO)
+	LSR_MEMSET (pattern, 0, sizeof (pattern));
+	random_pass = 0;
+# else
+	if ( schedule->last_pat == LSR_PATTERN_NONE )
+	{
+		return -1;
 	}
+	random_pass = (schedule->last_pat == LSR_PATTERN_RANDOM) ? 1 : 0;
+	__lsr_get_pattern_bytes (schedule->last_bits, pattern);
+# endif
 
-	if ( opt_method == LSR_METHOD_GUTMANN )
+	/* the data must be on the disk to be read back from it */
+# ifdef HAVE_FDATASYNC
+	fdatasync (fd);
+# else
+	fsync (fd);
+# endif
+	/* a new descriptor: the file may be open only for writing */
+	snprintf (path, sizeof (path), "/proc/self/fd/%d", fd);
+	path[sizeof (path) - 1] = '\0';
+	vfd = __lsr_verify_open (path, start, len, 1);
+	if ( vfd >= 0 )
 	{
-		npat = sizeof (patterns_gutmann)/sizeof (patterns_gutmann[0]);
+		direct = 1;
 	}
-	else if ( opt_method == LSR_METHOD_RANDOM )
+	else
 	{
-		npat = sizeof (patterns_random)/sizeof (patterns_random[0]);
+		vfd = __lsr_verify_open (path, start, len, 0);
 	}
-	else if ( opt_method == LSR_METHOD_SCHNEIER )
+	if ( vfd < 0 )
 	{
-		npat = sizeof (patterns_schneier)/sizeof (patterns_schneier[0]);
+		return -1;
 	}
-	else if ( opt_method == LSR_METHOD_DOD )
+	if ( __lsr_real_psx_memalign_loc () != NULL )
 	{
-		npat = sizeof (patterns_dod)/sizeof (patterns_dod[0]);
+		if ( (*__lsr_real_psx_memalign_loc ()) (&data, LSR_DIRECT_ALIGN,
+			sizeof (unsigned char) * N_DIRECT_BYTES) != 0 )
+		{
+			data = NULL;
+		}
 	}
-	else
+	expected = (unsigned char *) malloc (sizeof (unsigned char) * N_DIRECT_BYTES);
+	if ( (data == NULL) || (expected == NULL) )
 	{
-		return;
+		free (data);
+		free (expected);
+		close (vfd);
+		return -1;
 	}
 
-	for ( i = 0; i < npat; i++ )
+	seg = start;
+	while ( (seg < end) && (unread == 0) && (__lsr_sig_recvd () == 0) )
 	{
-		if ( selected[i] == 0 )
+		seg_end = end;
+# if (defined SEEK_DATA) && (defined SEEK_HOLE)
+		/* the holes weren't written, so only check the data */
+		off = lseek64 (vfd, seg, SEEK_DATA);
+		if ( off >= 0 )
 		{
-			break;
+			seg = off;
+			off = lseek64 (vfd, seg, SEEK_HOLE);
+			if ( (off > seg) && (off < end) )
+			{
+				seg_end = off;
+			}
 		}
-	}
-	if ( (i >= npat) && (lsr_is_pass_random (pat_no, opt_method) != 1) )
-	{
-		/* no patterns left and this is not a "random" pass - deselect all the patterns */
-		for ( i = 0; (i < npat) && (__lsr_sig_recvd () == 0); i++ )
+#  ifdef HAVE_ERRNO_H
+		else if ( errno == ENXIO )
 		{
-			selected[i] = 0;
+			/* no more data */
+			break;
 		}
-	}
-        pat_no %= npasses;
-
-#ifdef ALL_PASSES_ZERO
-	bits = 0;
-#else
-	if ( lsr_is_pass_random (pat_no, opt_method) == 1 )
-	{
-# if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
-		bits = (unsigned int) ((size_t)random () & 0xFFF);
-# else
-		bits = (unsigned int) ((size_t)rand () & 0xFFF);
+#  endif
 # endif
-	}
-	else
-	{	/* For other passes, one of the fixed patterns is selected. */
-		if ( (opt_method == LSR_METHOD_GUTMANN)
-			|| (opt_method == LSR_METHOD_RANDOM) )
+		/* direct I/O needs aligned reads */
+		off = seg - (seg % LSR_DIRECT_ALIGN);
+		while ( (off < seg_end) && (__lsr_sig_recvd () == 0) )
 		{
-			do
+			got = -1;
+			if ( lseek64 (vfd, off, SEEK_SET) == off )
 			{
-# if (!defined __STRICT_ANSI__) && (defined HAVE_RANDOM)
-				i = (size_t)random () % npat;
-# else
-				i = (size_t)rand () % npat;
-# endif
+				got = read (vfd, data, N_DIRECT_BYTES);
 			}
-			while ( (selected[i] == 1) && (__lsr_sig_recvd () == 0) );
-			if ( __lsr_sig_recvd () != 0 )
+			if ( got <= 0 )
 			{
-				return;
+				if ( direct != 0 )
+				{
+					/* the device may reject direct reads - retry
+					   through the page cache */
+					rfd = __lsr_verify_open (path, start, len, 0);
+					if ( rfd >= 0 )
+					{
+						close (vfd);
+						vfd = rfd;
+						direct = 0;
+						continue;
+					}
+				}
+				/* the rest of the region can't be checked */
+				unread = 1;
+				break;
 			}
+			if ( random_pass != 0 )
+			{
+				__lsr_fill_stream_at (schedule->last_stream, expected,
+					(size_t) got, off);
+			}
+			else
+			{
+				/* the pattern starts at the start of the whole wipe */
+				phase = (size_t) (((off - origin) % LSR_PATTERN_LEN
+					+ LSR_PATTERN_LEN) % LSR_PATTERN_LEN);
+				for ( k = 0; k < LSR_PATTERN_LEN; k++ )
+				{
+					rotated[k] = pattern[(phase + k) % LSR_PATTERN_LEN];
+				}
+				__lsr_fill_pattern (expected, (size_t) got, rotated);
+			}
+			lo = (off < seg) ? seg : off;
+			hi = (off + got > seg_end) ? seg_end : off + got;
+			if ( hi > lo )
+			{
+				__lsr_verify_span (&ver, (unsigned char *) data + (lo - off),
+					expected + (lo - off), (size_t) (hi - lo), lo);
+			}
+			off += got;
 		}
-		else
-		{
-			/* other methods use their patterns in sequence */
-			i = pat_no;
-		}
-		if ( opt_method == LSR_METHOD_GUTMANN )
-		{
-			bits = patterns_gutmann[i];
-		}
-		else if ( opt_method == LSR_METHOD_RANDOM )
-		{
-			bits = patterns_random[i];
-		}
-		else if ( opt_method == LSR_METHOD_SCHNEIER )
-		{
-			bits = patterns_schneier[i];
-		}
-		else /*if ( opt_method == LSR_METHOD_DOD )*/
-		{
-			bits = patterns_dod[i] & 0xFFF;
-		}
-		selected[i] = 1;
+		seg = seg_end;
 	}
+	__lsr_verify_report (&ver);
+	if ( ver.nbad != 0 )
+	{
+# if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+		syslog (LOG_WARNING, "libsecrm: verification of inode %lu on device 0x%lx:"
+			" %lu bytes in %lu extents differ from the last pass",
+			ino, dev, (unsigned long int) ver.nbad, ver.nreports);
+# endif
+	}
+	if ( unread != 0 )
+	{
+# if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+		syslog (LOG_WARNING, "libsecrm: verification of inode %lu on device 0x%lx:"
+			" the data from offset %lld couldn't be read back",
+			ino, dev, (long long int) off);
+# endif
+	}
+	free (expected);
+	free (data);
+	close (vfd);
+	return ((ver.nbad != 0) || (unread != 0)) ? -1 : 0;
+}
+#else
+# undef LSR_CAN_VERIFY
+#endif /* HAVE_UNISTD_H && HAVE_MALLOC && HAVE_SNPRINTF && HAVE_FCNTL_H */
 
-#endif /* ALL_PASSES_ZERO */
-	/* Taken from `shred' source and modified */
-	bits |= bits << 12;
+/* ======================================================= */
 
-#ifdef LSR_DEBUG
-# ifndef ALL_PASSES_ZERO
-	if ( lsr_is_pass_random (pat_no, opt_method) == 1 )
+#ifdef HAVE_UNISTD_H
+# ifndef LSR_ANSIC
+static int __lsr_wipe_extent LSR_PARAMS ((const int fd, const off64_t start,
+	const off64_t len, struct lsr_schedule * const schedule));
+# endif
+
+/**
+ * Wipes the given contiguous part of the file with the passes of
+ *	the schedule which are to be written now, in the best way available.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the part in the file.
+ * \param len The length of the part.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the part was processed, -1 if no memory could be allocated,
+ *	-2 if a write has failed and the old data may still be there.
+ */
+static int
+__lsr_wipe_extent (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
+# else
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+# endif
+{
+	unsigned char /*@only@*/ *buf = NULL;		/* Buffer to be written to file blocks */
+# ifndef HAVE_LONG_LONG_INT
+	unsigned long int diff;
+	unsigned int i;
+	unsigned int nbuffers;
+# else
+	unsigned long long int diff;
+	unsigned long long int i;
+	unsigned long long int nbuffers;
+# endif
+	off64_t offset;
+	struct lsr_writeback wb;
+	size_t write_len;
+	ssize_t write_res;
+	unsigned int j;
+	int random_pass;
+	int res = -1;	/* -1 until an engine has processed the region */
+	const size_t buffer_size = sizeof (unsigned char) * N_BYTES;
+
+	diff = (unsigned long long int) len;
+	nbuffers = diff/buffer_size;
+
+# ifdef HAVE_MALLOC
+	if ( diff < LSR_BUF_SIZE )
 	{
-		fprintf (stderr, "libsecrm: Using pattern (random)\n");
+		/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
+		buf = (unsigned char *) malloc ( sizeof(unsigned char)*(unsigned long int) diff );
 	}
-	else
-# endif /* ALL_PASSES_ZERO */
+# endif
+# ifdef LSR_CAN_USE_DIRECT_IO
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) && (direct_io != 0) )
 	{
-		fprintf (stderr, "libsecrm: Using pattern %02x%02x%02x\n",
-			(unsigned char) ((bits >> 4) & 0xFF),
-			(unsigned char) ((bits >> 8) & 0xFF),
-			(unsigned char) (bits & 0xFF) );
+		res = __lsr_wipe_region_direct (fd, start, (off64_t)diff, schedule);
 	}
-#endif
-
-	buffer[0] = (unsigned char) ((bits >> 4) & 0xFF);
-	if ( buflen > 1 )
+# endif
+# ifdef LSR_CAN_USE_MMAP
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) && (use_mmap != 0)
+		/* storing to a mapping of a copy-on-write file needs new
+		   blocks and gets a SIGBUS if there are none */
+		&& (schedule->cow == 0) )
+	{
+		res = __lsr_wipe_region_mmap (fd, start, (off64_t)diff, schedule);
+	}
+# endif
+# ifdef LSR_CAN_USE_SPLICE
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) && (use_splice != 0) )
 	{
-		buffer[1] = (unsigned char) ((bits >> 8) & 0xFF);
+		res = __lsr_wipe_region_splice (fd, start, (off64_t)diff, schedule);
 	}
-	if ( buflen > 2 )
+# endif
+# ifdef LSR_CAN_USE_THREADS
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) )
 	{
-		buffer[2] = (unsigned char) (bits & 0xFF);
+		res = __lsr_wipe_region_threads (fd, start, (off64_t)diff, schedule);
 	}
-	for (i = 3; (i << 1) < buflen; i <<= 1)
+# endif
+# if (defined LSR_CAN_USE_IO_URING) && (defined HAVE_MALLOC)
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) && (use_uring != 0) )
 	{
-		LSR_MEMCOPY (buffer + i, buffer, i);
+		res = __lsr_wipe_region_uring (fd, start, (off64_t)diff, schedule);
 	}
-	if (i < buflen)
+# endif
+# if (defined LSR_CAN_USE_PWRITEV) && (defined HAVE_MALLOC)
+	if ( (res == -1) && (diff >= LSR_BUF_SIZE) )
 	{
-		LSR_MEMCOPY (buffer + i, buffer, buflen - i);
+		res = __lsr_wipe_region_vec (fd, start, (off64_t)diff, schedule);
 	}
-}
+# endif
+	if ( res != -1 )
+	{
+		/* An engine has wiped the region (or failed to write it). */
+		return res;
+	}
+	res = 0;
+	if ( (diff >= LSR_BUF_SIZE) || (buf == NULL) )
+	{
 
-/* =============================================================== */
+# ifndef HAVE_MALLOC
+		buf = __lsr_buffer;
+# else /* HAVE_MALLOC */
+		buf = (unsigned char *) malloc ( buffer_size );
+		if ( buf == NULL )
+		{
+			/* Unable to get any memory. */
+			return -1;
+		}
+# endif /* ! HAVE_MALLOC */
+		for ( j = schedule->first; (j < schedule->stop)
+			&& (__lsr_sig_recvd () == 0); j++ )
+		{
+# ifdef LSR_CAN_FALLOCATE_ZEROS
+			if ( __lsr_fallocate_zeros (fd, start, (off64_t)diff, j,
+				schedule->npasses) == 0 )
+			{
+				/* the filesystem has zeroed the region without writing */
+				__lsr_sync_pass (fd);
+				continue;
+			}
+# endif
+# ifdef LAST_PASS_ZERO
+			if ( j == schedule->npasses )
+			{
+				LSR_MEMSET (buf, 0, buffer_size);
+				offset = start;
+				__lsr_writeback_init (&wb, offset);
+				for ( i = 0; (i < nbuffers) && (__lsr_sig_recvd () == 0); i++ )
+				{
+					write_res = __lsr_write_at (fd, buf, buffer_size, offset);
+					if ( write_res != (ssize_t)buffer_size )
+					{
+						res = -2;
+						break;
+					}
+					offset += write_res;
+					__lsr_writeback_advance (fd, &wb, offset);
+				}
+				if ( res != 0 )
+				{
+					break;
+				}
+				write_len = sizeof(unsigned char)*((size_t) diff)%N_BYTES;
+				write_res = __lsr_write_at (fd, buf, write_len, offset);
+				if ( write_res != (ssize_t)write_len )
+				{
+					res = -2;
+					break;
+				}
+				__lsr_writeback_finish (fd, &wb, offset + write_res);
 
-#ifndef LSR_ANSIC
+				/* this is the last pass and there was at
+				  least one pass before - sync unconditionally */
+				__lsr_sync_pass (fd);
+				break;
+			}
+# endif /* LAST_PASS_ZERO */
+			random_pass = __lsr_fill_scheduled ( j, buf, buffer_size, schedule );
 
-# ifdef HAVE_SIGNAL_H
-#  if (defined __STRICT_ANSI__)
-typedef void (*sighandler_t) LSR_PARAMS ((int));
-#  endif
-# else		/* ! HAVE_SIGNAL_H */
-/* dummy types: */
-typedef void (*sighandler_t) LSR_PARAMS ((int));
-struct sigaction
-{
-	void     (*sa_handler) LSR_PARAMS ((int));
-}
-# endif		/* HAVE_SIGNAL_H */
+			offset = start;
+			__lsr_writeback_init (&wb, offset);
+			for ( i = 0; (i < nbuffers) && (__lsr_sig_recvd () == 0); i++ )
+			{
+				if ( random_pass != 0 )
+				{
+					__lsr_fill_stream_at (schedule->last_stream, buf,
+						buffer_size, offset);
+				}
+				write_res = __lsr_write_at (fd, buf, buffer_size, offset);
+				if ( write_res != (ssize_t)buffer_size )
+				{
+					res = -2;
+					break;
+				}
+				offset += write_res;
+				__lsr_writeback_advance (fd, &wb, offset);
+			}
+			if ( res != 0 )
+			{
+				break;
+			}
+			write_len = sizeof(unsigned char)*((size_t) diff)%N_BYTES;
+			if ( random_pass != 0 )
+			{
+				__lsr_fill_stream_at (schedule->last_stream, buf,
+					write_len, offset);
+			}
+			write_res = __lsr_write_at (fd, buf, write_len, offset);
+			if ( write_res != (ssize_t)write_len )
+			{
+				res = -2;
+				break;
+			}
+			__lsr_writeback_finish (fd, &wb, offset + write_res);
 
-static int __lsr_set_signal_lock
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	LSR_PARAMS (( int * const fcntl_signal, const int fd,
-		int * const fcntl_signal_old,
-		struct sigaction * const sa,
-		struct sigaction * const old_sa,
-		int * const res_sig
-	));
-# else
-	LSR_PARAMS (( int * const fcntl_signal, const int fd,
-		int * const fcntl_signal_old, sighandler_t * const sig_hndlr
-	));
+			if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+				/* if LAST_PASS_ZERO is defined, there will be
+				 one additionall pass with zeros, so sync no
+				 matter how many passes there are declared: */
+				|| (1 == 1)
+# endif
+				)
+			{
+				__lsr_sync_pass (fd);
+			}
+		}
+# ifdef HAVE_MALLOC
+		free (buf);
 # endif
 
-static void __lsr_unset_signal_unlock
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	LSR_PARAMS (( const int fcntl_signal, const int fd,
-		const int fcntl_sig_old,
-		const struct sigaction * const old_sa,
-		const int res_sig
-	));
-# else
-	LSR_PARAMS (( const int fcntl_signal, const int fd,
-		const int fcntl_sig_old, const sighandler_t * const sig_hndlr
-	));
+	}
+# ifdef HAVE_MALLOC
+	else if ( buf != NULL )
+	{
+
+		for ( j = schedule->first; (j < schedule->stop)
+			&& (__lsr_sig_recvd () == 0); j++ )
+		{
+#  ifdef LSR_CAN_FALLOCATE_ZEROS
+			if ( __lsr_fallocate_zeros (fd, start, (off64_t)diff, j,
+				schedule->npasses) == 0 )
+			{
+				/* the filesystem has zeroed the region without writing */
+				__lsr_sync_pass (fd);
+				continue;
+			}
+#  endif
+#  ifdef LAST_PASS_ZERO
+			if ( j == schedule->npasses )
+			{
+				/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
+				write_len = sizeof(unsigned char)*(unsigned long int)diff;
+				LSR_MEMSET (buf, 0, write_len);
+				write_res = __lsr_write_at (fd, buf, write_len, start);
+				if ( write_res != (ssize_t)write_len )
+				{
+					res = -2;
+					break;
+				}
+
+				/* this is the last pass and there was at
+				  least one pass before - sync unconditionally */
+				__lsr_sync_pass (fd);
+				break;
+			}
+#  endif /* LAST_PASS_ZERO */
+			/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
+			write_len = sizeof(unsigned char)*(unsigned long int)diff;
+			if ( __lsr_fill_scheduled ( j, buf, write_len, schedule ) != 0 )
+			{
+				__lsr_fill_stream_at (schedule->last_stream, buf,
+					write_len, start);
+			}
+			write_res = __lsr_write_at (fd, buf, write_len, start);
+			if ( write_res != (ssize_t)write_len )
+			{
+				res = -2;
+				break;
+			}
+
+			if ( LSR_SYNC_PASSES (schedule->npasses)
+# ifdef LAST_PASS_ZERO
+				/* if LAST_PASS_ZERO is defined, there will be
+				 one additionall pass with zeros, so sync no
+				 matter how many passes there are declared: */
+				|| (1 == 1)
 # endif
-
-#endif
+				)
+			{
+				__lsr_sync_pass (fd);
+			}
+		}
+		free (buf);
+	}
+# endif /* HAVE_MALLOC */
+	return res;
+}
 
 /* ======================================================= */
 
-#if (defined HAVE_SIGNAL_H) && (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
-# ifndef RETSIGTYPE
-#  define RETSIGTYPE void
-# endif
-/* Signal-related stuff */
 # ifndef LSR_ANSIC
-static RETSIGTYPE __lsr_fcntl_signal_received LSR_PARAMS((const int signum));
+static int __lsr_wipe_region LSR_PARAMS ((const int fd, const off64_t start,
+	const off64_t len, struct lsr_schedule * const schedule));
 # endif
 
 /**
- * Signal handler - Sets a flag which will stop further program operations, when a
- * signal which would normally terminate the program is received.
- * \param signum Signal number.
+ * Wipes the given region of the file with the passes of the schedule
+ *	which are to be written now. Only the allocated parts of a sparse
+ *	file (see __lsr_map_extents()) are written, each in the best way
+ *	available, so that the holes don't get allocated.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \return 0 if the region was processed, -1 if no memory could be allocated,
+ *	-2 if a write has failed and the old data may still be there.
  */
-static RETSIGTYPE
-__lsr_fcntl_signal_received (
+static int
+__lsr_wipe_region (
 # ifdef LSR_ANSIC
-	const int signum )
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule)
 # else
-	signum )
-	const int signum;
+	fd, start, len, schedule)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
 # endif
 {
-	sig_recvd = signum;
-# define void 1
-# define int 2
-# if RETSIGTYPE != void
-	return 0;
+# ifdef LSR_CAN_USE_EXTENTS
+	const struct lsr_extents * const extents = schedule->extents;
+	const unsigned long int phase = schedule->phase;
+	const unsigned int first = schedule->first;
+	const unsigned int stop = schedule->stop;
+	unsigned int j;
+	off64_t ext_start;
+	off64_t ext_end;
+	size_t i;
+	int res = 0;
+
+	if ( extents == NULL )
+	{
+		return __lsr_wipe_extent (fd, start, len, schedule);
+	}
+	/* one pass over all the parts at a time, so that each pass
+	   keeps its pattern or random stream in all of them */
+	for ( j = first; (j < stop) && (res == 0)
+		&& (__lsr_sig_recvd () == 0); j++ )
+	{
+		schedule->first = j;
+		schedule->stop = j + 1;
+		for ( i = 0; (i < extents->n) && (res == 0)
+			&& (__lsr_sig_recvd () == 0); i++ )
+		{
+			ext_start = extents->bounds[2 * i];
+			ext_end = extents->bounds[2 * i + 1];
+			if ( ext_start < start )
+			{
+				ext_start = start;
+			}
+			if ( ext_end > start + len )
+			{
+				ext_end = start + len;
+			}
+			if ( ext_start >= ext_end )
+			{
+				continue;
+			}
+			/* keep the phase of the patterns in the whole region */
+			schedule->phase = (phase + (unsigned long int)
+				((ext_start - start) % LSR_PATTERN_LEN)) % LSR_PATTERN_LEN;
+			res = __lsr_wipe_extent (fd, ext_start, ext_end - ext_start,
+				schedule);
+		}
+	}
+	schedule->first = first;
+	schedule->stop = stop;
+	schedule->phase = phase;
+	return res;
+# else
+	return __lsr_wipe_extent (fd, start, len, schedule);
 # endif
-# undef int
-# undef void
 }
-#endif /* HAVE_SIGNAL_H && HAVE_FCNTL_H && F_SETLEASE */
+#endif /* HAVE_UNISTD_H */
 
-#if ! ((defined HAVE_FCNTL_H) && (defined F_SETLEASE)		&& \
-	(defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_GETSIG) && \
-	(defined HAVE_DECL_F_SETSIG) && HAVE_DECL_F_GETSIG && HAVE_DECL_F_SETSIG)
-# define LSR_ONLY_WITH_FCNTL_SIGNALS	LSR_ATTR((unused))
-#else
-# define LSR_ONLY_WITH_FCNTL_SIGNALS
-#endif
+/* ======================================================= */
 
-/* =========== Setting signal handler and file lock ============== */
+#ifdef LSR_CAN_CHECKPOINT
+/* The progress of a wipe, saved so that the wipe can be resumed. */
+struct lsr_checkpoint
+{
+	unsigned long int seed;		/* the seed of the order of the patterns */
+	unsigned long int npasses;	/* the number of passes of the wipe */
+	off64_t start;			/* the offset of the wiped region */
+	off64_t size;			/* the size of the file */
+	unsigned long int pass;		/* the pass being written */
+	off64_t done;			/* the length of the written part of the pass */
+};
 
-static int __lsr_set_signal_lock (
-#ifdef LSR_ANSIC
-	int * const fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS,
-	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS,
-	int * const fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	, struct sigaction * const sa LSR_ONLY_WITH_FCNTL_SIGNALS,
-	struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS,
-	int * const res_sig LSR_ONLY_WITH_FCNTL_SIGNALS
-# else
-	, sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS
-# endif
-	)
-#else
-	fcntl_signal, fd, fcntl_sig_old
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	, sa, old_sa, res_sig
-# else
-	, sig_hndlr
+# ifndef LSR_ANSIC
+static int __lsr_checkpoint_load LSR_PARAMS ((const int fd,
+	struct lsr_checkpoint * const ckpt));
 # endif
-	)
-	int * const fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS;
-	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS;
-	int * const fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS;
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	struct sigaction * const sa LSR_ONLY_WITH_FCNTL_SIGNALS;
-	struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS;
-	int * const res_sig LSR_ONLY_WITH_FCNTL_SIGNALS;
+
+/**
+ * Reads the checkpoint of an interrupted wipe of the file.
+ * \param fd The file descriptor of the file.
+ * \param ckpt The place for the checkpoint.
+ * \return 0 if the file has a checkpoint, -1 otherwise.
+ */
+static int
+__lsr_checkpoint_load (
+# ifdef LSR_ANSIC
+	const int fd, struct lsr_checkpoint * const ckpt)
 # else
-	sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS;
+	fd, ckpt)
+	const int fd;
+	struct lsr_checkpoint * const ckpt;
 # endif
-#endif
 {
-	int res = -1;
-
-#if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
-	int res_fcntl = 0;
-# if (defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_GETSIG) && \
-	(defined HAVE_DECL_F_SETSIG) && HAVE_DECL_F_GETSIG && HAVE_DECL_F_SETSIG
-
-	if ( (fcntl_signal == NULL) || (fcntl_sig_old == NULL) )
-	{
-		return res;
-	}
-#  if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	if ( (sa == NULL) || (old_sa == NULL) || (res_sig == NULL) )
-	{
-		return res;
-	}
-#  else
-	if ( sig_hndlr == NULL )
-	{
-		return res;
-	}
-#  endif
-	res = 0;
-	*fcntl_signal = fcntl (fd, F_GETSIG);
+	char text[LSR_CHECKPOINT_LEN];
+	const char * p = text;
+	off64_t values[7];
+	ssize_t len;
+	unsigned int i;
 
-	if ( *fcntl_signal == 0 )
+	len = fgetxattr (fd, LSR_CHECKPOINT_XATTR, text, sizeof (text) - 1);
+	if ( len <= 0 )
 	{
-#  ifdef SIGIO
-		*fcntl_signal = SIGIO;
-#  else
-		*fcntl_signal = SIGPOLL; /* POSIX, so available */
-#  endif
+		return -1;
 	}
-	/* replace the uncatchables */
-	if ( (*fcntl_signal == SIGSTOP) || (*fcntl_signal == SIGKILL) )
+	text[len] = '\0';
+	for ( i = 0; i < sizeof (values) / sizeof (values[0]); i++ )
 	{
-		*fcntl_sig_old = *fcntl_signal;
-#  ifdef SIGIO
-		*fcntl_signal = SIGIO;
-#  else
-		*fcntl_signal = SIGTERM; /* POSIX, so available */
-#  endif
-		if ( fcntl (fd, F_SETSIG, *fcntl_signal) != 0 )
+		if ( __lsr_parse_number (&p, &values[i]) != 0 )
 		{
-			*fcntl_signal = 0;
+			return -1;
 		}
 	}
-	else
+	if ( (*p != '\0') || (values[0] != LSR_CHECKPOINT_VERSION) )
 	{
-		*fcntl_sig_old = 0;
+		return -1;
 	}
+	ckpt->seed = (unsigned long int) values[1];
+	ckpt->npasses = (unsigned long int) values[2];
+	ckpt->start = values[3];
+	ckpt->size = values[4];
+	ckpt->pass = (unsigned long int) values[5];
+	ckpt->done = values[6];
+	return 0;
+}
 
-#  if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
-	*sig_hndlr = signal ( *fcntl_signal, &__lsr_fcntl_signal_received );
-	if ( *sig_hndlr == SIG_ERR )
-	{
-		if ( *fcntl_sig_old != 0 )
-		{
-			fcntl (fd, F_SETSIG, *fcntl_sig_old);
-		}
-		res = -1;
-	}
-#  else
-	LSR_MEMSET (sa, 0, sizeof (struct sigaction));
-	(*sa).sa_handler = &__lsr_fcntl_signal_received;
-	*res_sig = sigaction ( *fcntl_signal, sa, old_sa );
-	if ( *res_sig != 0 )
+/* ======================================================= */
+
+# ifndef LSR_ANSIC
+static void __lsr_checkpoint_save LSR_PARAMS ((const int fd,
+	const struct lsr_checkpoint * const ckpt));
+# endif
+
+/**
+ * Saves the checkpoint of a wipe of the file, after the data written
+ *	so far has reached the disk.
+ * \param fd The file descriptor of the file.
+ * \param ckpt The checkpoint to save.
+ */
+static void
+__lsr_checkpoint_save (
+# ifdef LSR_ANSIC
+	const int fd, const struct lsr_checkpoint * const ckpt)
+# else
+	fd, ckpt)
+	const int fd;
+	const struct lsr_checkpoint * const ckpt;
+# endif
+{
+	char text[LSR_CHECKPOINT_LEN];
+	int len;
+
+	/* a checkpoint mustn't get ahead of the data */
+# ifdef HAVE_FDATASYNC
+	if ( fdatasync (fd) != 0 )
+# else
+	if ( fsync (fd) != 0 )
+# endif
 	{
-		if ( *fcntl_sig_old != 0 )
-		{
-			fcntl (fd, F_SETSIG, *fcntl_sig_old);
-		}
-		res = -1;
+		return;
 	}
-
-#  endif
-# endif	/* HAVE_SIGNAL_H */
-	res_fcntl = fcntl (fd, F_SETLEASE, F_WRLCK);
-	if ( res_fcntl != 0 )
+# ifdef HAVE_LONG_LONG_INT
+	len = snprintf (text, sizeof (text), "%d %lu %lu %llu %llu %lu %llu",
+		LSR_CHECKPOINT_VERSION, ckpt->seed, ckpt->npasses,
+		(unsigned long long int) ckpt->start,
+		(unsigned long long int) ckpt->size, ckpt->pass,
+		(unsigned long long int) ckpt->done);
+# else
+	len = snprintf (text, sizeof (text), "%d %lu %lu %lu %lu %lu %lu",
+		LSR_CHECKPOINT_VERSION, ckpt->seed, ckpt->npasses,
+		(unsigned long int) ckpt->start,
+		(unsigned long int) ckpt->size, ckpt->pass,
+		(unsigned long int) ckpt->done);
+# endif
+	if ( (len > 0) && (len < (int) sizeof (text)) )
 	{
-		if ( *fcntl_sig_old != 0 )
-		{
-			fcntl (fd, F_SETSIG, *fcntl_sig_old);
-		}
-		res = -2;
+		fsetxattr (fd, LSR_CHECKPOINT_XATTR, text, (size_t) len, 0);
 	}
-#endif	/* (defined HAVE_FCNTL_H) && (defined F_SETLEASE) */
-
-	return res;
 }
 
+/* ======================================================= */
 
-/* =========== Resetting signal handler and releasing file lock ============== */
-
-static void __lsr_unset_signal_unlock (
-#ifdef LSR_ANSIC
-	const int fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS,
-	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS,
-	const int fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	, const struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS,
-	const int res_sig LSR_ONLY_WITH_FCNTL_SIGNALS
-# else
-	, const sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS
-# endif
-	)
-#else
-	fcntl_signal, fd, fcntl_sig_old
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	, old_sa, res_sig
-# else
-	, sig_hndlr
+# ifndef LSR_ANSIC
+static int __lsr_wipe_checkpointed LSR_PARAMS ((const int fd,
+	const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule, const off64_t size,
+	off64_t * const verify_start));
 # endif
-	)
-	const int fcntl_signal LSR_ONLY_WITH_FCNTL_SIGNALS;
-	const int fd LSR_ONLY_WITH_FCNTL_SIGNALS;
-	const int fcntl_sig_old LSR_ONLY_WITH_FCNTL_SIGNALS;
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	const struct sigaction * const old_sa LSR_ONLY_WITH_FCNTL_SIGNALS;
-	const int res_sig LSR_ONLY_WITH_FCNTL_SIGNALS;
+
+/**
+ * Wipes the given (big) region of the file in parts, saving the progress
+ *	after each part, and continues an interrupted wipe of the region
+ *	if the file has its checkpoint. Only a wipe starting at the same
+ *	offset is continued - a different region is wiped from its start.
+ * \param fd The file descriptor to wipe.
+ * \param start The offset of the region in the file.
+ * \param len The length of the region.
+ * \param schedule The schedule of the patterns for the wipe.
+ * \param size The size of the file.
+ * \param verify_start Set to the offset (from the start of the region) of
+ *	the data of the last pass written by this wipe, if an interrupted wipe
+ *	of the last pass is continued.
+ * \return 0 if the region was processed, -1 if no memory could be allocated,
+ *	-2 if a write has failed and the old data may still be there.
+ */
+static int
+__lsr_wipe_checkpointed (
+# ifdef LSR_ANSIC
+	const int fd, const off64_t start, const off64_t len,
+	struct lsr_schedule * const schedule, const off64_t size,
+	off64_t * const verify_start)
 # else
-	const sighandler_t * const sig_hndlr LSR_ONLY_WITH_FCNTL_SIGNALS;
+	fd, start, len, schedule, size, verify_start)
+	const int fd;
+	const off64_t start;
+	const off64_t len;
+	struct lsr_schedule * const schedule;
+	const off64_t size;
+	off64_t * const verify_start;
 # endif
-#endif
 {
-#if (defined HAVE_FCNTL_H) && (defined F_SETLEASE)
-# if (defined HAVE_SIGNAL_H) && (defined HAVE_DECL_F_SETSIG) && (HAVE_DECL_F_SETSIG)
-	fcntl (fd, F_SETLEASE, F_UNLCK);
+	struct lsr_checkpoint ckpt;
+	/* whole pattern pages, so that the parts continue the patterns */
+	const off64_t part = (off64_t) (checkpoint_bytes
+		- checkpoint_bytes % N_PAGE_BYTES);
+	const unsigned int stop = schedule->stop;
+	unsigned int pass = schedule->first;
+	unsigned int bits;
+	unsigned int j;
+	off64_t done = 0;
+	off64_t part_len;
+	int res = 0;
 
-#  if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
-	if ( sig_hndlr != SIG_ERR )
+	if ( (__lsr_checkpoint_load (fd, &ckpt) == 0)
+		&& (ckpt.npasses == schedule->npasses) && (ckpt.start == start)
+		&& (ckpt.size == size) && (ckpt.pass < (unsigned long int) stop)
+		&& (ckpt.done >= 0) && (ckpt.done < len)
+		&& (ckpt.done % N_PAGE_BYTES == 0) )
 	{
-		if ( (fcntl_sig_old == 0) || (fcntl_signal != 0) )
+		/* select the patterns of the passes already written again,
+		   so that the rest of the wipe doesn't repeat them */
+		__lsr_schedule_seed (schedule, ckpt.seed);
+		for ( j = 0; (j < ckpt.pass) && (j < schedule->npasses); j++ )
 		{
-			signal ( fcntl_signal, sig_hndlr );
+			__lsr_schedule_pattern (schedule, j, &bits);
 		}
-		else
+		pass = (unsigned int) ckpt.pass;
+		done = ckpt.done;
+		if ( pass + 1 == stop )
 		{
-			signal ( fcntl_sig_old, sig_hndlr );
+			/* the beginning was written by another wipe */
+			*verify_start = done;
 		}
 	}
-#  else
-	if ( res_sig == 0 )
-	{
-		if ( (fcntl_sig_old == 0) || (fcntl_signal != 0) )
-		{
-			sigaction ( fcntl_signal, old_sa, NULL );
-		}
-		else
+	else
+	{
+		ckpt.seed = schedule->seed;
+		ckpt.npasses = schedule->npasses;
+		ckpt.start = start;
+		ckpt.size = size;
+	}
+
+	for ( ; (pass < stop) && (res == 0) && (__lsr_sig_recvd () == 0); pass++ )
+	{
+		schedule->first = pass;
+		schedule->stop = pass + 1;
+		for ( ; (done < len) && (__lsr_sig_recvd () == 0); done += part_len )
 		{
-			sigaction ( fcntl_sig_old, old_sa, NULL );
+			part_len = (len - done < part) ? len - done : part;
+			res = __lsr_wipe_region (fd, start + done, part_len, schedule);
+			if ( (res != 0) || (__lsr_sig_recvd () != 0) )
+			{
+				/* the part may be incomplete */
+				break;
+			}
+			ckpt.pass = pass;
+			ckpt.done = done + part_len;
+			if ( ckpt.done == len )
+			{
+				if ( pass + 1 == stop )
+				{
+					/* the whole wipe is done */
+					break;
+				}
+				ckpt.pass++;
+				ckpt.done = 0;
+			}
+			__lsr_checkpoint_save (fd, &ckpt);
 		}
+		done = 0;
 	}
-#  endif
-	if ( fcntl_sig_old != 0 )
+	schedule->first = 0;
+	schedule->stop = stop;
+	if ( (res == 0) && (__lsr_sig_recvd () == 0) )
 	{
-		fcntl (fd, F_SETSIG, fcntl_sig_old);
+		fremovexattr (fd, LSR_CHECKPOINT_XATTR);
 	}
-# endif		/* HAVE_SIGNAL_H */
-#endif
+	return res;
 }
+#endif /* LSR_CAN_CHECKPOINT */
 
 /* ======================================================= */
 
 #ifdef HAVE_UNISTD_H
+# ifndef LSR_ANSIC
+static void __lsr_report_unwiped LSR_PARAMS ((const int fd,
+	const unsigned long int ino, const unsigned long int dev,
+	const char * const why));
+# endif
+
+/**
+ * Reports a wipe which didn't complete to the system log. The intercepted
+ *	functions don't fail because of it, so this is the only trace left.
+ * \param fd The file descriptor of the file.
+ * \param ino The inode of the file.
+ * \param dev The device of the file.
+ * \param why The reason of the failure.
+ */
+static void
+__lsr_report_unwiped (
+# ifdef LSR_ANSIC
+	const int fd, const unsigned long int ino, const unsigned long int dev,
+	const char * const why)
+# else
+	fd, ino, dev, why)
+	const int fd;
+	const unsigned long int ino;
+	const unsigned long int dev;
+	const char * const why;
+# endif
+{
+# if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+	syslog (LOG_WARNING, "libsecrm: wiping inode %lu on device 0x%lx"
+		" (fd %d) didn't complete: %s", ino, dev, fd, why);
+# endif
+# ifdef LSR_DEBUG
+	fprintf (stderr, "libsecrm: wiping fd=%d didn't complete: %s\n", fd, why);
+	fflush (stderr);
+# endif
+}
+
+/* ======================================================= */
+
+/**
+ * Wipes the part of the file past the given length, without truncating it.
+ *	The callers (the intercepted functions) ignore the result and go on
+ *	with the real operation - a failed wipe is only reported to the system
+ *	log (see __lsr_report_unwiped()), the data is removed anyway.
+ * \param fd The file descriptor of the file.
+ * \param length The length to keep. The data past it gets wiped.
+ * \return 0 if the data has been wiped (or there was nothing to wipe), -1 if
+ *	the file couldn't be processed, the wipe was cancelled or the
+ *	verification found data different from the last pass, -2 if a write
+ *	has failed and the old data may still be there.
+ */
 int
 __lsr_fd_truncate (
 # ifdef LSR_ANSIC
@@ -755,23 +9071,19 @@ __lsr_fd_truncate (
 	const off64_t length;
 # endif
 {
-	unsigned char /*@only@*/ *buf = NULL;		/* Buffer to be written to file blocks */
-	int selected[LSR_NPAT] = {0};
+	struct lsr_schedule schedule;
 # ifndef HAVE_LONG_LONG_INT
 	unsigned long int diff;
-	unsigned int i;
-	unsigned int nbuffers;
 # else
 	unsigned long long int diff;
-	unsigned long long int i;
-	unsigned long long int nbuffers;
 # endif
 	off64_t size;
+# if (defined LSR_CAN_CHECKPOINT) || (defined LSR_CAN_VERIFY)
+	off64_t verify_start = 0;	/* the data before this was written by others */
+# endif
+# ifndef LSR_CAN_USE_PWRITE
 	off64_t pos;
-	size_t write_len;
-	ssize_t write_res;
-	unsigned int j;
-	const size_t buffer_size = sizeof (unsigned char) * N_BYTES;
+# endif
 # ifdef HAVE_SYS_STAT_H
 # ifdef HAVE_STAT64
 	struct stat64 s;
@@ -781,19 +9093,20 @@ __lsr_fd_truncate (
 #  endif
 # endif
 # endif
-# ifdef HAVE_SIGNAL_H
-	int fcntl_signal;
-	int fcntl_sig_old;
-#  if (!defined HAVE_SIGACTION) || (defined __STRICT_ANSI__)
-	sighandler_t sig_hndlr;
-#  else
-	struct sigaction sa;
-	struct sigaction old_sa;
-#  endif
+	struct lsr_lease lease;
+	sig_atomic_t cancelled;
+# ifdef LSR_CAN_USE_EXTENTS
+	struct lsr_extents extents;
 # endif
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-	int res_sig;
+# ifdef LSR_CAN_WIPE_IN_MEMORY
+	int in_memory;
+	int mem_res = -1;
 # endif
+# ifdef LSR_CAN_SET_NOCOW
+	int old_flags = -1;	/* the flags of the file before marking it NOCOW */
+# endif
+	int wipe_res = 0;
+	int old_prio;
 
 	if ( fd < 0 )
 	{
@@ -802,7 +9115,8 @@ __lsr_fd_truncate (
 
 	__lsr_main ();
 # ifdef LSR_DEBUG
-	fprintf (stderr, "libsecrm: __lsr_fd_truncate(fd=%d, len=%ld)\n", fd, length);
+	fprintf (stderr, "libsecrm: __lsr_fd_truncate(fd=%d, len=%lu)\n", fd,
+		(unsigned long int) length);
 	fflush (stderr);
 # endif
 
@@ -822,6 +9136,8 @@ __lsr_fd_truncate (
 		{
 			return -1;
 		}
+		/* the file size is known here, so no seeking is needed */
+		size = (off64_t) s.st_size;
 	}
 	else
 	{
@@ -832,222 +9148,212 @@ __lsr_fd_truncate (
 	return -1;
 # endif /* (defined HAVE_SYS_STAT_H) */
 
-	/* save the current position and find the file size */
-# if (defined HAVE_LONG_LONG_INT) && (defined LSR_ANSIC)
-	/* save the current position */
-	pos = lseek64 ( fd, 0LL, SEEK_CUR );
-	/* find the file size */
-	size = lseek64 ( fd, 0LL, SEEK_END );
-# else
-	pos = lseek64 ( fd, 0, SEEK_CUR );
-	size = lseek64 ( fd, 0, SEEK_END );
-# endif
-
-	lseek64 ( fd, pos, SEEK_SET );
-
 	if ( (size == 0) || (length >= size) )
 	{
 		/* Nothing to do */
 		return 0;
 	}
-
-	/* seeking to correct position */
-	if ( lseek64 (fd, length, SEEK_SET) != length )
+	__lsr_schedule_init (&schedule);
+# ifdef HAVE_SYS_STAT_H
+	__lsr_pace_device (s.st_dev);
+# endif
+# ifdef LSR_CAN_WIPE_IN_MEMORY
+	in_memory = __lsr_dev_in_memory (fd, s.st_dev);
+# endif
+# ifdef LSR_CAN_DETECT_COW
+	/* needed also to know if the region can be mapped */
+	schedule.cow = __lsr_is_cow (fd, s.st_dev, length, size - length);
+	if ( (cow_policy != LSR_COW_WIPE) && (schedule.cow != 0) )
 	{
-		/* Unable to set current file position. */
-		return -1;
+		if ( cow_policy == LSR_COW_SKIP )
+		{
+			/* overwriting would leave the old data anyway */
+#  if (defined HAVE_SYSLOG_H) && (defined HAVE_SYSLOG)
+			syslog (LOG_NOTICE, "libsecrm: not wiping inode %lu on device 0x%lx"
+				" (fd %d): copy-on-write filesystem",
+				(unsigned long int) s.st_ino, (unsigned long int) s.st_dev, fd);
+#  endif
+#  ifdef LSR_DEBUG
+			fprintf (stderr, "libsecrm: not wiping fd=%d: copy-on-write filesystem\n", fd);
+			fflush (stderr);
+#  endif
+			return 0;
+		}
+#  ifdef LSR_CAN_SET_NOCOW
+		if ( (cow_policy != LSR_COW_ONE_PASS)
+			&& (__lsr_set_nocow (fd, &old_flags) == 0) )
+		{
+			schedule.cow = __lsr_is_cow (fd, s.st_dev, length, size - length);
+		}
+#  endif
+		if ( (cow_policy == LSR_COW_ONE_PASS) || (schedule.cow != 0) )
+		{
+			/* one pass reaches the disk as well as many */
+			__lsr_schedule_set_passes (&schedule, 1);
+		}
 	}
+	if ( (crypt_passes != 0) && (crypt_passes < schedule.npasses)
+		&& (__lsr_is_encrypted (fd, s.st_dev) != 0) )
+	{
+		/* only the ciphertext reaches the disk */
+		__lsr_schedule_set_passes (&schedule, crypt_passes);
+	}
+# endif
 
+# ifndef LSR_CAN_USE_PWRITE
+	/* save the current position */
+#  if (defined HAVE_LONG_LONG_INT) && (defined LSR_ANSIC)
+	pos = lseek64 ( fd, 0LL, SEEK_CUR );
+#  else
+	pos = lseek64 ( fd, 0, SEEK_CUR );
+#  endif
+# endif
 
 	if ( __lsr_sig_recvd () != 0 )
 	{
-		lseek64 ( fd, pos, SEEK_SET );
+# ifdef LSR_CAN_SET_NOCOW
+		__lsr_reset_nocow (fd, old_flags);
+# endif
 		return -1;
 	}
 	diff = (unsigned long long int)(size - length);
-	nbuffers = diff/buffer_size;
+# ifdef LSR_CAN_USE_EXTENTS
+	/* before taking the lease - finding the holes may open the file again */
+	extents.bounds = NULL;
+	if ( (diff >= LSR_BUF_SIZE)
+		&& (__lsr_map_extents (fd, length, (off64_t)diff, &extents) == 0) )
+	{
+		schedule.extents = &extents;
+	}
+# endif
 
 	/* =========== Wiping loop ============== */
-	if ( __lsr_set_signal_lock ( &fcntl_signal, fd, &fcntl_sig_old
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-		, &sa, &old_sa, &res_sig
-# else
-		, &sig_hndlr
-# endif
-		) != 0
-	)
+	if ( __lsr_lease_take (fd, &lease) != 0 )
 	{
-		lseek64 ( fd, pos, SEEK_SET );
+# ifdef LSR_CAN_USE_EXTENTS
+		free (extents.bounds);
+# endif
+# ifdef LSR_CAN_SET_NOCOW
+		__lsr_reset_nocow (fd, old_flags);
+# endif
 		return -1;
 	}
+	old_prio = __lsr_lower_io_priority ();
 
-# ifdef HAVE_MALLOC
-	if ( diff < LSR_BUF_SIZE )
+# ifdef LSR_CAN_WIPE_IN_MEMORY
+	if ( in_memory != 0 )
 	{
-		/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
-		buf = (unsigned char *) malloc ( sizeof(unsigned char)*(unsigned long int) diff );
+		mem_res = __lsr_wipe_region_memory (fd, length, (off64_t)diff, &schedule);
+	}
+	if ( mem_res == 0 )
+	{
+		/* The region has been filled once, in memory - nothing to sync. */
+	}
+	else if ( mem_res == -2 )
+	{
+		/* the file can't be written to (e.g. it's full) - other
+		   methods would fail the same way */
+		wipe_res = -2;
 	}
+	else
 # endif
-	if ( (diff >= LSR_BUF_SIZE) || (buf == NULL) )
+# ifdef LSR_CAN_CHECKPOINT
+	if ( (checkpoint_bytes != 0) && (diff > checkpoint_bytes) )
 	{
-
-# ifndef HAVE_MALLOC
-		buf = __lsr_buffer;
-# else /* HAVE_MALLOC */
-		buf = (unsigned char *) malloc ( buffer_size );
-		if ( buf == NULL )
-		{
-			/* Unable to get any memory. */
-			lseek64 ( fd, pos, SEEK_SET );
-			__lsr_unset_signal_unlock ( fcntl_signal, fd, fcntl_sig_old
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-				, &old_sa, res_sig
-# else
-				, &sig_hndlr
+		wipe_res = __lsr_wipe_checkpointed (fd, length, (off64_t)diff,
+			&schedule, (off64_t)size, &verify_start);
+	}
+	else
 # endif
-				);
-			return -1;
-		}
-# endif /* ! HAVE_MALLOC */
-		for ( j = 0; (j < npasses
-# ifdef LAST_PASS_ZERO
-			+1
+	{
+		wipe_res = __lsr_wipe_region (fd, length, (off64_t)diff, &schedule);
+	}
+# ifdef LSR_CAN_USE_EXTENTS
+	free (extents.bounds);
+	schedule.extents = NULL;
 # endif
-			) && (__lsr_sig_recvd () == 0); j++ )
-		{
-# ifdef LAST_PASS_ZERO
-			if ( j == npasses )
-			{
-				LSR_MEMSET (buf, 0, buffer_size);
-				for ( i = 0; (i < nbuffers) && (__lsr_sig_recvd () == 0); i++ )
-				{
-					write_res = write (fd, buf, buffer_size);
-					if ( write_res != (ssize_t)buffer_size )
-					{
-						break;
-					}
-				}
-				write_len = sizeof(unsigned char)*((size_t) diff)%N_BYTES;
-				write_res = write (fd, buf, write_len);
-				if ( write_res != (ssize_t)write_len )
-				{
-					break;
-				}
-
-				/* this is the last pass and there was at
-				  least one pass before - sync unconditionally */
-				fsync (fd);
-				break;
-			}
-# endif /* LAST_PASS_ZERO */
-			__lsr_fill_buffer ( j, buf, buffer_size, selected );
-
-			for ( i = 0; (i < nbuffers) && (__lsr_sig_recvd () == 0); i++ )
-			{
-				write_res = write (fd, buf, buffer_size);
-				if ( write_res != (ssize_t)buffer_size )
-				{
-					break;
-				}
-			}
-			write_len = sizeof(unsigned char)*((size_t) diff)%N_BYTES;
-			write_res = write (fd, buf, write_len);
-			if ( write_res != (ssize_t)write_len )
-			{
-				break;
-			}
-
-			if ( (npasses > 1)
-# ifdef LAST_PASS_ZERO
-				/* if LAST_PASS_ZERO is defined, there will be
-				 one additionall pass with zeros, so sync no
-				 matter how many passes there are declared: */
-				|| (1 == 1)
+	if ( wipe_res != 0 )
+	{
+		/* Unable to get any memory or to write. */
+		__lsr_restore_io_priority (old_prio);
+		__lsr_lease_release (fd, &lease);
+		__lsr_report_unwiped (fd, (unsigned long int) s.st_ino,
+			(unsigned long int) s.st_dev, (wipe_res == -2) ?
+			"the data couldn't be written" : "out of memory");
+# ifdef LSR_CAN_SET_NOCOW
+		__lsr_reset_nocow (fd, old_flags);
 # endif
-				)
-			{
-				fsync (fd);
-			}
-			/* go back to the start position of writing */
-			if ( lseek64 ( fd, length, SEEK_SET) != length )
-			{
-				/* Unable to set current file position. */
-				break;
-			}
-		}
-# ifdef HAVE_MALLOC
-		free (buf);
+		return wipe_res;
+	}
+# ifdef LSR_CAN_WIPE_IN_MEMORY
+	if ( in_memory == 0 )
 # endif
-
+	{
+		__lsr_sync_final (fd);
 	}
-# ifdef HAVE_MALLOC
-	else if ( buf != NULL )
+# ifdef LSR_CAN_SET_NOCOW
+	/* the data is on the disk, the file can be copy-on-write again */
+	__lsr_reset_nocow (fd, old_flags);
+# endif
+# ifndef LSR_CAN_USE_PWRITE
+	lseek64 ( fd, pos, SEEK_SET );
+# endif
+	cancelled = __lsr_lease_release (fd, &lease);
+	if ( cancelled != 0 )
 	{
-
-		for ( j = 0; (j < npasses
-#  ifdef LAST_PASS_ZERO
-			+1
+		/* the wipe has been interrupted */
+		__lsr_report_unwiped (fd, (unsigned long int) s.st_ino,
+			(unsigned long int) s.st_dev, "cancelled");
+		wipe_res = -1;
+	}
+# ifdef LSR_CAN_VERIFY
+	/* after releasing the lease - opening the file again would wait for it */
+	if ( (verify != 0) && (cancelled == 0)
+#  ifdef LSR_CAN_WIPE_IN_MEMORY
+		&& (in_memory == 0)
 #  endif
-			) && (__lsr_sig_recvd () == 0); j++ )
-		{
-#  ifdef LAST_PASS_ZERO
-			if ( j == npasses )
-			{
-				/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
-				write_len = sizeof(unsigned char)*(unsigned long int)diff;
-				LSR_MEMSET (buf, 0, write_len);
-				write_res = write (fd, buf, write_len);
-				if ( write_res != (ssize_t)write_len )
-				{
-					break;
-				}
-
-				/* this is the last pass and there was at
-				  least one pass before - sync unconditionally */
-				fsync (fd);
-				break;
-			}
-#  endif /* LAST_PASS_ZERO */
-			/* We know 'diff' < LSR_BUF_SIZE < ULONG_MAX here, so it's safe to cast */
-			write_len = sizeof(unsigned char)*(unsigned long int)diff;
-			__lsr_fill_buffer ( j, buf, write_len, selected );
-			write_res = write (fd, buf, write_len);
-			if ( write_res != (ssize_t)write_len )
-			{
-				break;
-			}
-
-			if ( (npasses > 1)
-# ifdef LAST_PASS_ZERO
-				/* if LAST_PASS_ZERO is defined, there will be
-				 one additionall pass with zeros, so sync no
-				 matter how many passes there are declared: */
-				|| (1 == 1)
-# endif
-				)
-			{
-				fsync (fd);
-			}
-			/* go back to the start position of writing */
-			if ( lseek64 (fd, length, SEEK_SET) != length )
-			{
-				/* Unable to set current file position. */
-				break;
-			}
-		}
-		free (buf);
+		&& (__lsr_verify_region (fd, length, length + verify_start,
+			(off64_t)diff - verify_start, &schedule,
+			(unsigned long int) s.st_ino, (unsigned long int) s.st_dev) != 0) )
+	{
+		/* the wiped data didn't reach the disk */
+		wipe_res = -1;
 	}
-# endif /* HAVE_MALLOC */
-	lseek64 ( fd, pos, SEEK_SET );
-	__lsr_unset_signal_unlock ( fcntl_signal, fd, fcntl_sig_old
-# if (defined HAVE_SIGACTION) && (!defined __STRICT_ANSI__)
-		, &old_sa, res_sig
-# else
-		, &sig_hndlr
 # endif
-		);
-	return 0;
+	__lsr_restore_io_priority (old_prio);
+	return wipe_res;
 }
 #endif	/* unistd.h */
 
 /* ======================================================= */
+
+/**
+ * Finishes wiping the file, if a previous wipe of it was interrupted
+ *	and its checkpoint was saved.
+ * \param fd The file descriptor of the file.
+ * \return 0 if the interrupted wipe has been finished, -1 otherwise.
+ */
+int
+__lsr_fd_resume (
+#ifdef LSR_ANSIC
+	const int fd LSR_ONLY_WITH_CHECKPOINTS)
+#else
+	fd)
+	const int fd LSR_ONLY_WITH_CHECKPOINTS;
+#endif
+{
+#ifdef LSR_CAN_CHECKPOINT
+	struct lsr_checkpoint ckpt;
+
+	if ( (fd < 0) || (__lsr_checkpoint_load (fd, &ckpt) != 0) )
+	{
+		return -1;
+	}
+	/* the public function has only one error value */
+	return (__lsr_fd_truncate (fd, ckpt.start) == 0) ? 0 : -1;
+#else
+	return -1;
+#endif
+}
+
+/* ======================================================= */
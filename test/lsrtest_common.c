@@ -47,6 +47,18 @@
 # include <string.h>
 #endif
 
+#if (defined LSR_WANT_IO_URING) && (defined HAVE_LINUX_IO_URING_H) \
+	&& (defined HAVE_SYS_SYSCALL_H) && (defined HAVE_SYS_MMAN_H) \
+	&& (defined HAVE_STDARG_H)
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# include <sys/mman.h>
+# include <stdarg.h>
+# define LSRTEST_COUNT_URING 1
+#else
+# undef LSRTEST_COUNT_URING
+#endif
+
 static def_write orig_write;
 static volatile size_t nwritten = 0;
 static volatile size_t nwritten_total = 0;
@@ -81,6 +93,323 @@ ssize_t write(int fd, const void *buf, size_t count)
 	}
 }
 
+static def_pwrite orig_pwrite;
+static def_pwrite64 orig_pwrite64;
+static unsigned char * starts = NULL;
+static size_t nstarts = 0;
+static size_t max_starts = 0;
+static off64_t write_limit = 0;
+static off64_t corrupt_at = -1;
+static size_t ncorrupted = 0;
+static const char * lease_breaker = NULL;
+static size_t nbreaks = 0;
+
+/* the part of a write which fits below the limit, like on a full disk */
+static size_t limit_write(size_t count, off64_t offset)
+{
+	if ((write_limit == 0) || (offset + (off64_t) count <= write_limit))
+	{
+		return count;
+	}
+	if (offset >= write_limit)
+	{
+		return 0;
+	}
+	return (size_t) (write_limit - offset);
+}
+
+/* remembers the first bytes of the writes at the start of the file */
+static void record_start(const void *buf, size_t count, off64_t offset)
+{
+	if ((starts != NULL) && (offset == 0) && (count >= LSRTEST_START_LEN)
+		&& (nstarts < max_starts))
+	{
+		memcpy(starts + nstarts * LSRTEST_START_LEN, buf, LSRTEST_START_LEN);
+		nstarts++;
+	}
+}
+
+/* opens the file given to lsrtest_break_lease(), once, without waiting
+   for the lease on it, like another program would */
+static void break_lease(void)
+{
+	int fd;
+
+	if (lease_breaker == NULL)
+	{
+		return;
+	}
+	fd = open(lease_breaker, O_RDONLY | O_NONBLOCK);
+	if (fd >= 0)
+	{
+		/* no lease on the file */
+		close(fd);
+	}
+	else
+	{
+		/* EWOULDBLOCK, the lease is being broken */
+		nbreaks++;
+	}
+	lease_breaker = NULL;
+}
+
+/* spoils the byte at corrupt_at, if the given successful write has covered it */
+static void corrupt_written(int fd, const void *buf, size_t count, off64_t offset)
+{
+	unsigned char spoiled;
+
+	if ((corrupt_at < offset) || (corrupt_at >= offset + (off64_t) count))
+	{
+		return;
+	}
+	if (orig_pwrite64 == NULL)
+	{
+		*(void **) (&orig_pwrite64) = dlsym (RTLD_NEXT, "pwrite64");
+	}
+	spoiled = (unsigned char) (((const unsigned char *) buf)[corrupt_at - offset] ^ 0xFF);
+	if ((*orig_pwrite64)(fd, &spoiled, 1, corrupt_at) == 1)
+	{
+		ncorrupted++;
+	}
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t res;
+
+	if (orig_pwrite == NULL)
+	{
+		*(void **) (&orig_pwrite) = dlsym (RTLD_NEXT, "pwrite");
+	}
+	if (is_inside_write_flag == 0)
+	{
+		was_in_write_flag += 1;
+		nwritten = count;
+		nwritten_total += count;
+		record_start(buf, count, offset);
+		break_lease();
+	}
+	if ((count != 0) && (limit_write(count, offset) == 0))
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+	res = (*orig_pwrite)(fd, buf, limit_write(count, offset), offset);
+	if (res > 0)
+	{
+		corrupt_written(fd, buf, (size_t) res, offset);
+	}
+	return res;
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	ssize_t res;
+
+	if (orig_pwrite64 == NULL)
+	{
+		*(void **) (&orig_pwrite64) = dlsym (RTLD_NEXT, "pwrite64");
+	}
+	if (is_inside_write_flag == 0)
+	{
+		was_in_write_flag += 1;
+		nwritten = count;
+		nwritten_total += count;
+		record_start(buf, count, offset);
+		break_lease();
+	}
+	if ((count != 0) && (limit_write(count, offset) == 0))
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+	res = (*orig_pwrite64)(fd, buf, limit_write(count, offset), offset);
+	if (res > 0)
+	{
+		corrupt_written(fd, buf, (size_t) res, offset);
+	}
+	return res;
+}
+
+#ifdef HAVE_SYS_UIO_H
+static def_pwritev orig_pwritev;
+static def_pwritev64 orig_pwritev64;
+
+static size_t count_iovec(const struct iovec *iov, int iovcnt)
+{
+	size_t count = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+	{
+		count += iov[i].iov_len;
+	}
+	return count;
+}
+
+/* corrupt_written() for each vector of a write */
+static void corrupt_written_iovec(int fd, const struct iovec *iov, int iovcnt,
+	off64_t offset, ssize_t res)
+{
+	int i;
+	size_t len;
+
+	for (i = 0; (i < iovcnt) && (res > 0); i++)
+	{
+		len = ((size_t) res < iov[i].iov_len) ? (size_t) res : iov[i].iov_len;
+		corrupt_written(fd, iov[i].iov_base, len, offset);
+		offset += (off64_t) len;
+		res -= (ssize_t) len;
+	}
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	ssize_t res;
+
+	if (orig_pwritev == NULL)
+	{
+		*(void **) (&orig_pwritev) = dlsym (RTLD_NEXT, "pwritev");
+	}
+	if (is_inside_write_flag == 0)
+	{
+		was_in_write_flag += 1;
+		nwritten = count_iovec(iov, iovcnt);
+		nwritten_total += nwritten;
+		if (iovcnt > 0)
+		{
+			record_start(iov[0].iov_base, iov[0].iov_len, offset);
+		}
+		break_lease();
+	}
+	if (limit_write(count_iovec(iov, iovcnt), offset) != count_iovec(iov, iovcnt))
+	{
+		/* not worth splitting the vector */
+		errno = ENOSPC;
+		return -1;
+	}
+	res = (*orig_pwritev)(fd, iov, iovcnt, offset);
+	corrupt_written_iovec(fd, iov, iovcnt, offset, res);
+	return res;
+}
+
+ssize_t pwritev64(int fd, const struct iovec *iov, int iovcnt, off64_t offset)
+{
+	ssize_t res;
+
+	if (orig_pwritev64 == NULL)
+	{
+		*(void **) (&orig_pwritev64) = dlsym (RTLD_NEXT, "pwritev64");
+	}
+	if (is_inside_write_flag == 0)
+	{
+		was_in_write_flag += 1;
+		nwritten = count_iovec(iov, iovcnt);
+		nwritten_total += nwritten;
+		if (iovcnt > 0)
+		{
+			record_start(iov[0].iov_base, iov[0].iov_len, offset);
+		}
+		break_lease();
+	}
+	if (limit_write(count_iovec(iov, iovcnt), offset) != count_iovec(iov, iovcnt))
+	{
+		/* not worth splitting the vector */
+		errno = ENOSPC;
+		return -1;
+	}
+	res = (*orig_pwritev64)(fd, iov, iovcnt, offset);
+	corrupt_written_iovec(fd, iov, iovcnt, offset, res);
+	return res;
+}
+#endif /* HAVE_SYS_UIO_H */
+
+#ifdef LSRTEST_COUNT_URING
+/* the writes submitted through io_uring don't go through the functions
+   above, so count them from the submission queue */
+typedef long int (*def_syscall)(long int number, ...);
+static def_syscall orig_syscall;
+static int uring_fd = -1;
+static struct io_uring_params uring_params;
+
+static void count_uring_writes(int fd, unsigned int to_submit)
+{
+	size_t sq_len = uring_params.sq_off.array
+		+ uring_params.sq_entries * sizeof(unsigned int);
+	size_t sqes_len = uring_params.sq_entries * sizeof(struct io_uring_sqe);
+	unsigned char * sq_ring;
+	struct io_uring_sqe * sqes;
+	unsigned int head;
+	unsigned int mask;
+	unsigned int * array;
+	unsigned int i;
+
+	/* a view of the same rings as the ones of the library */
+	sq_ring = (unsigned char *) mmap (NULL, sq_len, PROT_READ,
+		MAP_SHARED, fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+	{
+		return;
+	}
+	sqes = (struct io_uring_sqe *) mmap (NULL, sqes_len, PROT_READ,
+		MAP_SHARED, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		munmap (sq_ring, sq_len);
+		return;
+	}
+	head = *(unsigned int *) (sq_ring + uring_params.sq_off.head);
+	mask = *(unsigned int *) (sq_ring + uring_params.sq_off.ring_mask);
+	array = (unsigned int *) (sq_ring + uring_params.sq_off.array);
+	for (i = 0; i < to_submit; i++)
+	{
+		const struct io_uring_sqe * sqe = &sqes[array[(head + i) & mask]];
+		if ((sqe->opcode == IORING_OP_WRITE_FIXED)
+			|| (sqe->opcode == IORING_OP_WRITE))
+		{
+			was_in_write_flag += 1;
+			nwritten = sqe->len;
+			nwritten_total += sqe->len;
+			record_start((const void *) (unsigned long int) sqe->addr,
+				sqe->len, (off64_t) sqe->off);
+		}
+	}
+	munmap (sqes, sqes_len);
+	munmap (sq_ring, sq_len);
+}
+
+long int syscall(long int number, ...)
+{
+	va_list args;
+	long int a[6];
+	long int res;
+	int i;
+
+	if (orig_syscall == NULL)
+	{
+		*(void **) (&orig_syscall) = dlsym (RTLD_NEXT, "syscall");
+	}
+	va_start (args, number);
+	for (i = 0; i < 6; i++)
+	{
+		a[i] = va_arg (args, long int);
+	}
+	va_end (args);
+	if ((number == __NR_io_uring_enter) && ((int) a[0] == uring_fd)
+		&& (is_inside_write_flag == 0))
+	{
+		count_uring_writes ((int) a[0], (unsigned int) a[1]);
+	}
+	res = (*orig_syscall)(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+	if ((number == __NR_io_uring_setup) && (res >= 0))
+	{
+		uring_fd = (int) res;
+		memcpy (&uring_params, (void *) a[1], sizeof(uring_params));
+	}
+	return res;
+}
+#endif /* LSRTEST_COUNT_URING */
+
 static def_rename orig_rename;
 static char last_name[50];
 
@@ -115,6 +444,45 @@ void lsrtest_set_nwritten_total (size_t s)
 	nwritten_total = s;
 }
 
+void lsrtest_record_starts (unsigned char * where, size_t max)
+{
+	starts = where;
+	max_starts = max;
+	nstarts = 0;
+}
+
+size_t lsrtest_get_nstarts (void)
+{
+	return nstarts;
+}
+
+void lsrtest_set_write_limit (off64_t limit)
+{
+	write_limit = limit;
+}
+
+void lsrtest_set_corrupt_at (off64_t offset)
+{
+	corrupt_at = offset;
+	ncorrupted = 0;
+}
+
+size_t lsrtest_get_ncorrupted (void)
+{
+	return ncorrupted;
+}
+
+void lsrtest_break_lease (const char * const name)
+{
+	lease_breaker = name;
+	nbreaks = 0;
+}
+
+size_t lsrtest_get_nbreaks (void)
+{
+	return nbreaks;
+}
+
 long int lsrtest_was_in_write (void)
 {
 	return was_in_write_flag;
@@ -156,6 +524,24 @@ void lsrtest_prepare_banned_file(void)
 
 /* ======================================================= */
 
+void lsrtest_prepare_big_file(void)
+{
+	FILE *f = NULL;
+	size_t i;
+
+	f = fopen(LSR_TEST_FILENAME, "w");
+	if (f != NULL)
+	{
+		for (i = 0; i < LSR_TEST_BIG_FILE_LENGTH; i++)
+		{
+			fputc('a', f);
+		}
+		fclose(f);
+	}
+}
+
+/* ======================================================= */
+
 #ifdef LSR_CAN_USE_PIPE
 void lsrtest_prepare_pipe(void)
 {
@@ -171,6 +557,12 @@ static void setup_global(void) /* unchecked */
 {
 	*(void **) (&orig_write) = dlsym (RTLD_NEXT, "write");
 	*(void **) (&orig_rename) = dlsym (RTLD_NEXT, "rename");
+#ifdef HAVE_SYS_UIO_H
+	*(void **) (&orig_pwrite) = dlsym (RTLD_NEXT, "pwrite");
+	*(void **) (&orig_pwrite64) = dlsym (RTLD_NEXT, "pwrite64");
+	*(void **) (&orig_pwritev) = dlsym (RTLD_NEXT, "pwritev");
+	*(void **) (&orig_pwritev64) = dlsym (RTLD_NEXT, "pwritev64");
+#endif
 }
 
 /*
@@ -65,6 +65,10 @@ static int errno = -1;
 #  define O_TRUNC	01000
 # endif
 
+# ifdef HAVE_SYS_UIO_H
+#  include <sys/uio.h>
+# endif
+
 # include <check.h>
 
 /* compatibility with older 'check' versions */
@@ -112,6 +116,7 @@ static int errno = -1;
 # define LSR_TEST_FILENAME "zz1"
 # define LSR_TEST_FILE_LENGTH 3
 # define LSR_TEST_FILE_EXT_LENGTH 100
+# define LSR_TEST_BIG_FILE_LENGTH (2*1024*1024+5)
 
 # define LSR_LINK_FILENAME "zzl"
 # define LSR_PIPE_FILENAME "zzpipe"
@@ -153,6 +158,12 @@ either the fixture or the test, or both. */
 
 typedef ssize_t (*def_write)(int fd, const void *buf, size_t count);
 typedef int (*def_rename)(const char *oldpath, const char *newpath);
+typedef ssize_t (*def_pwrite)(int fd, const void *buf, size_t count, off_t offset);
+typedef ssize_t (*def_pwrite64)(int fd, const void *buf, size_t count, off64_t offset);
+# ifdef HAVE_SYS_UIO_H
+typedef ssize_t (*def_pwritev)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+typedef ssize_t (*def_pwritev64)(int fd, const struct iovec *iov, int iovcnt, off64_t offset);
+# endif
 
 # ifdef __cplusplus
 extern "C" {
@@ -164,6 +175,38 @@ extern void lsrtest_set_nwritten LSR_PARAMS((size_t s));
 extern GCC_WARN_UNUSED_RESULT size_t lsrtest_get_nwritten_total LSR_PARAMS((void));
 extern void lsrtest_set_nwritten_total LSR_PARAMS((size_t s));
 
+/* the name of the method selected when building the library */
+# ifdef LSR_WANT_RANDOM
+#  define LSRTEST_METHOD "random"
+# else
+#  ifdef LSR_WANT_SCHNEIER
+#   define LSRTEST_METHOD "schneier"
+#  else
+#   ifdef LSR_WANT_DOD
+#    define LSRTEST_METHOD "dod"
+#   else
+#    ifdef LSR_WANT_CLEAR
+#     define LSRTEST_METHOD "clear"
+#    else
+#     define LSRTEST_METHOD "gutmann"
+#    endif
+#   endif
+#  endif
+# endif
+
+/* the number of the first bytes of the file recorded from each write */
+# define LSRTEST_START_LEN 3
+extern void lsrtest_record_starts LSR_PARAMS((unsigned char * where, size_t max));
+extern GCC_WARN_UNUSED_RESULT size_t lsrtest_get_nstarts LSR_PARAMS((void));
+/* the writes past the limit fail, like on a full disk, 0 means no limit */
+extern void lsrtest_set_write_limit LSR_PARAMS((off64_t limit));
+/* the byte at the offset gets changed after each write which covers it, -1 means none */
+extern void lsrtest_set_corrupt_at LSR_PARAMS((off64_t offset));
+extern GCC_WARN_UNUSED_RESULT size_t lsrtest_get_ncorrupted LSR_PARAMS((void));
+/* the file gets opened by the next write, breaking the lease on it */
+extern void lsrtest_break_lease LSR_PARAMS((const char * const name));
+extern GCC_WARN_UNUSED_RESULT size_t lsrtest_get_nbreaks LSR_PARAMS((void));
+
 extern GCC_WARN_UNUSED_RESULT long int lsrtest_was_in_write LSR_PARAMS((void));
 
 extern GCC_WARN_UNUSED_RESULT int lsrtest_is_inside_write LSR_PARAMS((void));
@@ -173,6 +216,7 @@ extern GCC_WARN_UNUSED_RESULT const char * lsrtest_get_last_name LSR_PARAMS((voi
 extern void lsrtest_set_last_name LSR_PARAMS((const char newpath[]));
 
 extern void lsrtest_prepare_banned_file LSR_PARAMS((void));
+extern void lsrtest_prepare_big_file LSR_PARAMS((void));
 # ifdef LSR_CAN_USE_PIPE
 extern void lsrtest_prepare_pipe LSR_PARAMS((void));
 # endif
@@ -40,6 +40,10 @@
 # include <stdlib.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
 #ifdef HAVE_STRING_H
 # if (!defined STDC_HEADERS) && (defined HAVE_MEMORY_H)
 #  include <memory.h>
@@ -105,6 +109,185 @@ END_TEST
 
 /* ======================================================= */
 
+/* the default number of passes of the given method after switching to it */
+static unsigned long int method_passes(const char * const name)
+{
+	ck_assert_int_eq(__lsr_set_method (name), 0);
+	return __lsr_get_npasses ();
+}
+
+/* the expected default number of passes of the given method */
+static unsigned long int default_passes(const char * const name, const unsigned long int own)
+{
+	if (strcmp (name, LSRTEST_METHOD) == 0)
+	{
+		return LSR_PASSES;
+	}
+	return own;
+}
+
+START_TEST(test_method_switch)
+{
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	LSR_PROLOG_FOR_TEST();
+	ck_assert_uint_eq(method_passes ("gutmann"), default_passes ("gutmann", 27 + 9));
+	ck_assert_uint_eq(method_passes ("random"), default_passes ("random", 22 + 3));
+	ck_assert_uint_eq(method_passes ("schneier"), default_passes ("schneier", 2 + 5));
+	ck_assert_uint_eq(method_passes ("dod"), default_passes ("dod", 2 + 1));
+	ck_assert_uint_eq(method_passes ("nist"), default_passes ("clear", 1));
+	/* the number of passes stays when the method doesn't change */
+	__lsr_set_npasses (5);
+	ck_assert_uint_eq(method_passes ("clear"), 5);
+	/* an unknown method changes nothing */
+	ck_assert_int_eq(__lsr_set_method ("no-such-method"), -1);
+	ck_assert_uint_eq(__lsr_get_npasses (), 5);
+	/* the compile-time method gets the compile-time number of passes back */
+	ck_assert_uint_eq(method_passes ("dod"), default_passes ("dod", 2 + 1));
+	ck_assert_uint_eq(method_passes (LSRTEST_METHOD), LSR_PASSES);
+	__lsr_set_npasses (npasses);
+}
+END_TEST
+
+/* ======================================================= */
+
+#define LSRTEST_SYSFS "lsrtest_sysfs"
+
+/* the paths of the fake sysfs tree, removed in the reverse order */
+static char sysfs_paths[64][128];
+static unsigned int nsysfs_paths = 0;
+
+/* adds a fake block device to the tree, a dm device if the uuid is given */
+static void make_block_dev(const char * const dir, const char * const uuid)
+{
+	FILE *f;
+
+	snprintf(sysfs_paths[nsysfs_paths++], sizeof(sysfs_paths[0]), "%s", dir);
+	mkdir(dir, 0700);
+	snprintf(sysfs_paths[nsysfs_paths], sizeof(sysfs_paths[0]), "%s/slaves", dir);
+	mkdir(sysfs_paths[nsysfs_paths++], 0700);
+	if (uuid != NULL)
+	{
+		snprintf(sysfs_paths[nsysfs_paths], sizeof(sysfs_paths[0]), "%s/dm", dir);
+		mkdir(sysfs_paths[nsysfs_paths++], 0700);
+		snprintf(sysfs_paths[nsysfs_paths], sizeof(sysfs_paths[0]), "%s/dm/uuid", dir);
+		f = fopen(sysfs_paths[nsysfs_paths++], "w");
+		if (f != NULL)
+		{
+			fprintf(f, "%s\n", uuid);
+			fclose(f);
+		}
+	}
+}
+
+START_TEST(test_dm_crypt)
+{
+	LSR_PROLOG_FOR_TEST();
+
+	make_block_dev(LSRTEST_SYSFS, NULL);
+	/* a disk */
+	make_block_dev(LSRTEST_SYSFS "/plain", NULL);
+	/* a LUKS device */
+	make_block_dev(LSRTEST_SYSFS "/luks", "CRYPT-LUKS2-0123-luks");
+	/* LVM on two encrypted disks */
+	make_block_dev(LSRTEST_SYSFS "/lvm", "LVM-abcd");
+	make_block_dev(LSRTEST_SYSFS "/lvm/slaves/a", "CRYPT-LUKS1-4567-a");
+	make_block_dev(LSRTEST_SYSFS "/lvm/slaves/b", "CRYPT-PLAIN-b");
+	/* LVM on an encrypted and a plain disk */
+	make_block_dev(LSRTEST_SYSFS "/mixed", "LVM-efgh");
+	make_block_dev(LSRTEST_SYSFS "/mixed/slaves/a", "CRYPT-LUKS2-89ab-a");
+	make_block_dev(LSRTEST_SYSFS "/mixed/slaves/b", NULL);
+	/* LVM on RAID on two encrypted disks */
+	make_block_dev(LSRTEST_SYSFS "/deep", "LVM-ijkl");
+	make_block_dev(LSRTEST_SYSFS "/deep/slaves/md", NULL);
+	make_block_dev(LSRTEST_SYSFS "/deep/slaves/md/slaves/a", "CRYPT-LUKS2-cdef-a");
+	make_block_dev(LSRTEST_SYSFS "/deep/slaves/md/slaves/b", "CRYPT-LUKS2-cdef-b");
+	/* LVM on RAID on an encrypted and a plain disk */
+	make_block_dev(LSRTEST_SYSFS "/deep2", "LVM-mnop");
+	make_block_dev(LSRTEST_SYSFS "/deep2/slaves/md", NULL);
+	make_block_dev(LSRTEST_SYSFS "/deep2/slaves/md/slaves/a", "CRYPT-LUKS2-0246-a");
+	make_block_dev(LSRTEST_SYSFS "/deep2/slaves/md/slaves/b", NULL);
+
+	if (__lsr_is_crypt_dir (LSRTEST_SYSFS "/luks") != -1)
+	{
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/plain"), 0);
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/luks"), 1);
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/lvm"), 1);
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/mixed"), 0);
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/deep"), 1);
+		ck_assert_int_eq(__lsr_is_crypt_dir (LSRTEST_SYSFS "/deep2"), 0);
+	}
+	while (nsysfs_paths > 0)
+	{
+		remove(sysfs_paths[--nsysfs_paths]);
+	}
+}
+END_TEST
+
+/* ======================================================= */
+
+#define LSRTEST_PSI "lsrtest_psi"
+
+/* the stall time read from a fake pressure file with the given line */
+static off64_t fake_stalled(const char * const line)
+{
+	FILE *f;
+	off64_t stalled;
+
+	f = fopen(LSRTEST_PSI, "w");
+	if (f == NULL)
+	{
+		return -2;
+	}
+	fprintf(f, "%s\n", line);
+	fclose(f);
+	stalled = __lsr_pace_stalled (LSRTEST_PSI);
+	unlink(LSRTEST_PSI);
+	return stalled;
+}
+
+START_TEST(test_io_pressure)
+{
+	unsigned long int rate;
+	int i;
+	const unsigned long int mb = 1024 * 1024;
+
+	LSR_PROLOG_FOR_TEST();
+
+	if (fake_stalled("some avg10=1.00 avg60=0.50 avg300=0.10 total=123456") != -2)
+	{
+		ck_assert_int_eq((int) fake_stalled("some avg10=1.00 avg60=0.50 avg300=0.10 total=123456"), 123456);
+		ck_assert_int_eq((int) fake_stalled("full avg10=0.00 avg60=0.00 avg300=0.00 total=5"), -1);
+		ck_assert_int_eq((int) fake_stalled("some avg10=0.00"), -1);
+		ck_assert_int_eq((int) __lsr_pace_stalled (LSRTEST_PSI "-missing"), -1);
+	}
+	/* no pressure - no limit */
+	ck_assert_uint_eq(__lsr_pace_adapt (0, 100 * mb, 0, 0), 0);
+	/* the pace gets halved from the rate achieved */
+	rate = __lsr_pace_adapt (0, 100 * mb, 1, 0);
+	ck_assert_uint_eq(rate, 50 * mb);
+	rate = __lsr_pace_adapt (rate, 80 * mb, 1, 0);
+	ck_assert_uint_eq(rate, 25 * mb);
+	rate = __lsr_pace_adapt (rate, 10 * mb, 1, 0);
+	ck_assert_uint_eq(rate, 5 * mb);
+	/* but not below the minimum */
+	for (i = 0; i < 10; i++)
+	{
+		rate = __lsr_pace_adapt (rate, 0, 1, 0);
+	}
+	ck_assert_uint_eq(rate, mb);
+	/* without the pressure, the pace grows in steps */
+	rate = __lsr_pace_adapt (rate, mb, 0, 0);
+	ck_assert_uint_eq(rate, 9 * mb);
+	rate = __lsr_pace_adapt (rate, mb, 0, 0);
+	ck_assert_uint_eq(rate, 17 * mb);
+	/* until it reaches the static limit, which then applies alone */
+	ck_assert_uint_eq(__lsr_pace_adapt (rate, mb, 0, 20 * mb), 0);
+}
+END_TEST
+
+/* ======================================================= */
+
 START_TEST(test_fill_buffer)
 {
 #define OFFSET 20
@@ -185,6 +368,89 @@ END_TEST
 
 /* ======================================================= */
 
+START_TEST(test_fill_buffer_big)
+{
+	/* big enough for all the ways of filling, not aligned */
+#define LSR_TEST_FILL_LENGTH (5 * 1024 * 1024 + 7)
+	static unsigned char buffer[LSR_TEST_FILL_LENGTH + 1];
+	size_t j;
+	int selected[LSR_NPAT] = {0};
+	unsigned long int pat_no;
+
+	/* try to pick a non-random pattern */
+#ifdef LSR_WANT_RANDOM
+	pat_no = 1;
+#else
+# ifdef LSR_WANT_SCHNEIER
+	pat_no = 0;
+# else
+#  ifdef LSR_WANT_DOD
+	pat_no = 0;
+#  else
+	pat_no = 4;
+#  endif
+# endif
+#endif
+
+	LSR_PROLOG_FOR_TEST();
+
+	buffer[LSR_TEST_FILL_LENGTH] = 'x';
+	__lsr_fill_buffer (pat_no, &buffer[1], LSR_TEST_FILL_LENGTH - 1, selected);
+	for ( j = 4; j < LSR_TEST_FILL_LENGTH; j++ )
+	{
+		if ( buffer[j] != buffer[j - 3] )
+		{
+			ck_abort_msg("test_fill_buffer_big: pattern %lu: buffer[%lu] = 0x%x != buffer[%lu] = 0x%x\n",
+				pat_no, (unsigned long int) j, buffer[j],
+				(unsigned long int) (j - 3), buffer[j - 3]);
+		}
+	}
+	ck_assert_int_eq(buffer[LSR_TEST_FILL_LENGTH], 'x');
+}
+END_TEST
+
+/* ======================================================= */
+
+START_TEST(test_chacha20)
+{
+	/* the test vector of the block function from RFC 8439, 2.3.2 */
+	static const unsigned char expected[64] = {
+		0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+		0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+		0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+		0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+		0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+		0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+		0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+		0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+	};
+	unsigned char key[32];
+	unsigned char out[64];
+	size_t i;
+
+	LSR_PROLOG_FOR_TEST();
+
+	for ( i = 0; i < sizeof (key); i++ )
+	{
+		key[i] = (unsigned char) i;
+	}
+	/* the 96-bit nonce 00:00:00:09:00:00:00:4a:00:00:00:00 and the 32-bit
+	   counter 1 are the 64-bit counter and the 64-bit stream here */
+	__lsr_chacha20_block (key, 0x4a000000UL,
+		(off64_t) ((((off64_t) 0x09000000) << 32) | 1), out);
+	for ( i = 0; i < sizeof (out); i++ )
+	{
+		if ( out[i] != expected[i] )
+		{
+			ck_abort_msg("test_chacha20: out[%lu] = 0x%x != 0x%x\n",
+				(unsigned long int) i, out[i], expected[i]);
+		}
+	}
+}
+END_TEST
+
+/* ======================================================= */
+
 static Suite * lsr_create_suite(void)
 {
 	Suite * s = suite_create("libsecrm_other");
@@ -196,7 +462,12 @@ static Suite * lsr_create_suite(void)
 	tcase_add_test(tests_other, test_symb_var);
 #endif
 	tcase_add_test(tests_other, test_fill_buffer);
+	tcase_add_test(tests_other, test_fill_buffer_big);
+	tcase_add_test(tests_other, test_chacha20);
 	tcase_add_test(tests_other, test_iter_env);
+	tcase_add_test(tests_other, test_method_switch);
+	tcase_add_test(tests_other, test_dm_crypt);
+	tcase_add_test(tests_other, test_io_pressure);
 
 	lsrtest_add_fixtures (tests_other);
 
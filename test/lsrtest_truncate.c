@@ -25,6 +25,92 @@
 # include <unistd.h>
 #endif
 
+#ifdef HAVE_STRING_H
+# if (!defined STDC_HEADERS) && (defined HAVE_MEMORY_H)
+#  include <memory.h>
+# endif
+# include <string.h>
+#endif
+
+#ifdef HAVE_SYS_XATTR_H
+# include <sys/xattr.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#if (defined HAVE_SYS_VFS_H) && (defined HAVE_SYS_IOCTL_H) && (defined HAVE_LINUX_FS_H)
+# include <sys/vfs.h>
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+#ifdef HAVE_TIME_H
+# include <time.h>
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+# include <signal.h>
+#endif
+
+#include "lsr_priv.h"
+
+/* ======================================================= */
+
+/* the number of bytes of the big test file which still hold the original data */
+static size_t count_unwiped(const int fd)
+{
+	unsigned char buf[4096];
+	ssize_t r;
+	ssize_t i;
+	off_t offset = 0;
+	size_t left = 0;
+
+	while ((r = pread(fd, buf, sizeof(buf), offset)) > 0)
+	{
+		for (i = 0; i < r; i++)
+		{
+			if (buf[i] == 'a')
+			{
+				left++;
+			}
+		}
+		offset += r;
+	}
+	return left;
+}
+
+/* whether the big test file repeats with the period of the patterns */
+static int is_periodic(const int fd)
+{
+	unsigned char buf[4096 * 3];
+	ssize_t r;
+	ssize_t i;
+	off_t offset = 0;
+
+	while ((r = pread(fd, buf, sizeof(buf), offset)) > 0)
+	{
+		for (i = 3; i < r; i++)
+		{
+			if (buf[i] != buf[i - 3])
+			{
+				return 0;
+			}
+		}
+		offset += r;
+	}
+	return 1;
+}
+
 /* ======================================================= */
 
 START_TEST(test_ftruncate)
@@ -121,6 +207,1160 @@ START_TEST(test_ftruncate_pipe)
 END_TEST
 #endif /* LSR_CAN_USE_PIPE */
 
+START_TEST(test_ftruncate_big)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	size_t npasses;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	npasses = __lsr_get_npasses ();
+#ifdef LAST_PASS_ZERO
+	npasses++;
+#endif
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		r = ftruncate(fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		if (r != 0)
+		{
+			ck_abort_msg("test_ftruncate_big: file could not have been truncated: errno=%d, r=%d\n", errno, r);
+		}
+		close(fd);
+	}
+	else
+	{
+		ck_abort_msg("test_ftruncate_big: file not opened: errno=%d\n", errno);
+	}
+	/* each pass has covered the whole file, once */
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * npasses);
+}
+END_TEST
+
+#ifdef LSR_WANT_IO_URING
+START_TEST(test_ftruncate_uring_random)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_uring_random: file not opened: errno=%d\n", errno);
+	}
+	/* the last two Schneier passes are random */
+	__lsr_set_method ("schneier");
+	__lsr_set_npasses (4);
+	__lsr_set_verify (1);
+# ifdef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (0);
+# endif
+	r = __lsr_fd_truncate (fd, 0);
+	nwritten = lsrtest_get_nwritten_total ();
+# ifdef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (1);
+# endif
+	__lsr_set_verify (0);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	close(fd);
+	/* the random data written from the two buffers reads back right */
+	ck_assert_int_eq(r, 0);
+# ifdef LAST_PASS_ZERO
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * 5);
+# else
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * 4);
+# endif
+}
+END_TEST
+#endif
+
+#ifdef O_DIRECT
+START_TEST(test_ftruncate_direct)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	size_t npasses;
+	ssize_t w;
+	int flags;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	npasses = __lsr_get_npasses ();
+# ifdef LAST_PASS_ZERO
+	npasses++;
+# endif
+	__lsr_set_direct_io (1);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		r = ftruncate(fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		if (r != 0)
+		{
+			ck_abort_msg("test_ftruncate_direct: file could not have been truncated: errno=%d, r=%d\n", errno, r);
+		}
+		/* the program's descriptor must not have been switched to direct I/O */
+		flags = fcntl(fd, F_GETFL);
+		w = write(fd, "aaa", 3);
+		close(fd);
+	}
+	else
+	{
+		ck_abort_msg("test_ftruncate_direct: file not opened: errno=%d\n", errno);
+	}
+# ifndef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (0);
+# endif
+	ck_assert_int_eq(flags & O_DIRECT, 0);
+	ck_assert_int_eq((int) w, 3);
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * npasses);
+}
+END_TEST
+
+# ifdef HAVE_SYS_INOTIFY_H
+START_TEST(test_ftruncate_direct_opened)
+{
+	int fd;
+	int r;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	__lsr_set_direct_io (1);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_direct_opened: file not opened: errno=%d\n", errno);
+	}
+	/* another program opens the file while the lease is given back */
+	lsrtest_break_lease (LSR_TEST_FILENAME);
+	r = __lsr_fd_truncate (fd, 0);
+	lsrtest_break_lease (NULL);
+	close(fd);
+#  ifndef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (0);
+#  endif
+	/* the opening has been noticed and the wipe cancelled */
+	ck_assert_int_eq(r, -1);
+}
+END_TEST
+# endif
+#endif /* O_DIRECT */
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MSYNC)
+START_TEST(test_ftruncate_mmap)
+{
+	int fd;
+	int r;
+	int r_end;
+	size_t nwritten;
+	size_t left;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	__lsr_set_mmap (1);
+# ifdef LSR_WANT_DIRECT_IO
+	/* direct I/O is used before the mapping */
+	__lsr_set_direct_io (0);
+# endif
+	/* the parts between the checkpoints are written, not mapped */
+	__lsr_set_checkpoint_bytes (0);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		/* wipe the whole file without truncating it */
+		r = __lsr_fd_truncate (fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		left = count_unwiped(fd);
+		/* the mapping is synchronized in the selected mode, too */
+		__lsr_set_sync_mode (3);
+		r_end = __lsr_fd_truncate (fd, 0);
+		__lsr_set_sync_mode (LSR_SYNC_MODE);
+		close(fd);
+	}
+	else
+	{
+		__lsr_set_mmap (0);
+		ck_abort_msg("test_ftruncate_mmap: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_mmap (0);
+# ifdef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (1);
+# endif
+	__lsr_set_checkpoint_bytes (LSR_CHECKPOINT_BYTES);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(r_end, 0);
+	/* the patterns were stored in the mapping, not written */
+	ck_assert_uint_eq(nwritten, 0);
+	ck_assert(left < LSR_TEST_BIG_FILE_LENGTH / 16);
+}
+END_TEST
+#endif
+
+#if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+START_TEST(test_ftruncate_threads)
+{
+	int fd;
+	int r;
+	size_t left;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	__lsr_set_threads (4);
+	__lsr_set_thread_threshold (1);
+	__lsr_set_verify (1);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		/* wipe the whole file without truncating it */
+		r = __lsr_fd_truncate (fd, 0);
+		left = count_unwiped(fd);
+		close(fd);
+	}
+	else
+	{
+		r = -1;
+		left = 0;
+	}
+	__lsr_set_verify (0);
+	__lsr_set_thread_threshold (0);
+	__lsr_set_threads (0);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_threads: file not opened: errno=%d\n", errno);
+	}
+	/* every range of the last pass must hold the right data */
+	ck_assert_int_eq(r, 0);
+	ck_assert(left < LSR_TEST_BIG_FILE_LENGTH / 16);
+}
+END_TEST
+#endif
+
+START_TEST(test_ftruncate_splice)
+{
+	int fd;
+	int r;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	__lsr_set_splice (1);
+	__lsr_set_verify (1);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_splice: file not opened: errno=%d\n", errno);
+	}
+	/* the patterns read back must be the ones spliced in */
+	r = __lsr_fd_truncate (fd, 0);
+	__lsr_set_verify (0);
+	__lsr_set_splice (0);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq((int) lseek(fd, 0, SEEK_END), LSR_TEST_BIG_FILE_LENGTH);
+	close(fd);
+}
+END_TEST
+
+#if (defined HAVE_FALLOCATE) && (defined FALLOC_FL_PUNCH_HOLE) && (defined FALLOC_FL_KEEP_SIZE) \
+	&& ((defined LAST_PASS_ZERO) || (defined ALL_PASSES_ZERO))
+/* whether the filesystem of the test file can free the blocks of a file */
+static int can_punch_holes(void)
+{
+	int fd;
+	int r;
+
+	fd = open(LSR_TEST_FILENAME ".probe", O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	r = (write(fd, "aaaa", 4) == 4)
+		&& (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, 4) == 0);
+	close(fd);
+	unlink(LSR_TEST_FILENAME ".probe");
+	return r;
+}
+
+START_TEST(test_ftruncate_falloc_zero)
+{
+	const int punch = can_punch_holes ();
+	unsigned char buf[4096];
+	size_t npasses;
+	size_t nwritten;
+	size_t nonzero = 0;
+	ssize_t got;
+	ssize_t i;
+	off_t offset = 0;
+	int fd;
+	int r;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+# ifdef ALL_PASSES_ZERO
+	/* only the first pass overwrites the data, the others free the blocks */
+	npasses = 1;
+# else
+	/* the additional pass of zeros frees the blocks */
+	npasses = __lsr_get_npasses ();
+# endif
+	__lsr_set_falloc_zero (1);
+	__lsr_set_verify (1);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_falloc_zero: file not opened: errno=%d\n", errno);
+	}
+	r = __lsr_fd_truncate (fd, 0);
+	nwritten = lsrtest_get_nwritten_total ();
+	__lsr_set_verify (0);
+	__lsr_set_falloc_zero (0);
+	ck_assert_int_eq(r, 0);
+	/* the file reads as zeros and keeps its size */
+	while ((got = pread(fd, buf, sizeof(buf), offset)) > 0)
+	{
+		for (i = 0; i < got; i++)
+		{
+			if (buf[i] != '\0')
+			{
+				nonzero++;
+			}
+		}
+		offset += got;
+	}
+	close(fd);
+	ck_assert_uint_eq(nonzero, 0);
+	ck_assert_int_eq((int) offset, LSR_TEST_BIG_FILE_LENGTH);
+	if (punch)
+	{
+		ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * npasses);
+	}
+}
+END_TEST
+#endif
+
+#if (defined HAVE_SYS_VFS_H) && (defined HAVE_SYS_IOCTL_H) && (defined HAVE_LINUX_FS_H) \
+	&& (defined FS_IOC_GETFLAGS)
+/* whether the filesystem of the file writes the new data somewhere else */
+static int is_cow_fs(const int fd)
+{
+	struct statfs fs;
+	unsigned long int magic;
+
+	if (fstatfs(fd, &fs) != 0)
+	{
+		return 0;
+	}
+	magic = ((unsigned long int) fs.f_type) & 0xFFFFFFFFUL;
+	/* btrfs, bcachefs, ZFS */
+	return (magic == 0x9123683EUL) || (magic == 0xCA451A4EUL) || (magic == 0x2FC12FC1UL);
+}
+
+START_TEST(test_ftruncate_cow_policy)
+{
+	unsigned long int policy;
+	size_t npasses;
+	size_t nwritten;
+	int flags_before;
+	int flags_after;
+	int cow;
+	int fd;
+	int r;
+
+	LSR_PROLOG_FOR_TEST();
+
+	npasses = __lsr_get_npasses ();
+# ifdef LAST_PASS_ZERO
+	npasses++;
+# endif
+	for (policy = 0; policy <= 3; policy++)
+	{
+		lsrtest_prepare_big_file ();
+		fd = open(LSR_TEST_FILENAME, O_RDWR);
+		if (fd < 0)
+		{
+			ck_abort_msg("test_ftruncate_cow_policy: file not opened: errno=%d\n", errno);
+		}
+		cow = is_cow_fs(fd);
+		flags_before = -1;
+		ioctl(fd, FS_IOC_GETFLAGS, &flags_before);
+		__lsr_set_cow_policy (policy);
+		lsrtest_set_nwritten_total (0);
+		r = __lsr_fd_truncate (fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		flags_after = -1;
+		ioctl(fd, FS_IOC_GETFLAGS, &flags_after);
+		close(fd);
+		__lsr_set_cow_policy (LSR_COW_POLICY);
+
+		ck_assert_int_eq(r, 0);
+		/* the flags of the file are the user's, even if marked NOCOW for the wipe */
+		ck_assert_int_eq(flags_after, flags_before);
+		if ((cow == 0) || (policy == 0))
+		{
+			/* the policy matters only on the copy-on-write filesystems */
+			ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * npasses);
+		}
+		else if (policy == 3)
+		{
+			ck_assert_uint_eq(nwritten, 0);
+		}
+		else
+		{
+			ck_assert(nwritten < LSR_TEST_BIG_FILE_LENGTH * npasses);
+		}
+	}
+}
+END_TEST
+#endif
+
+START_TEST(test_ftruncate_sync_modes)
+{
+	int fd;
+	int r[4];
+	size_t nwritten[4];
+	size_t npasses;
+	unsigned long int mode;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	npasses = __lsr_get_npasses ();
+# ifdef LAST_PASS_ZERO
+	npasses++;
+# endif
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_sync_modes: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_verify (1);
+	for (mode = 0; mode < 4; mode++)
+	{
+		__lsr_set_sync_mode (mode);
+		lsrtest_set_nwritten_total (0);
+		/* wipe the whole file without truncating it */
+		r[mode] = __lsr_fd_truncate (fd, 0);
+		nwritten[mode] = lsrtest_get_nwritten_total ();
+	}
+	__lsr_set_verify (0);
+	__lsr_set_sync_mode (LSR_SYNC_MODE);
+	close(fd);
+	/* the mode changes only how the passes reach the disk */
+	for (mode = 0; mode < 4; mode++)
+	{
+		ck_assert_int_eq(r[mode], 0);
+		ck_assert_uint_eq(nwritten[mode], LSR_TEST_BIG_FILE_LENGTH * npasses);
+	}
+}
+END_TEST
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MINCORE)
+START_TEST(test_ftruncate_writeback)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	size_t npasses;
+	size_t npages;
+	size_t ncached = 0;
+	size_t i;
+	long int page;
+	unsigned char * map;
+	unsigned char * pages;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	npasses = __lsr_get_npasses ();
+# ifdef LAST_PASS_ZERO
+	npasses++;
+# endif
+	page = sysconf (_SC_PAGESIZE);
+	npages = (LSR_TEST_BIG_FILE_LENGTH + (size_t)page - 1) / (size_t)page;
+	pages = (unsigned char *) malloc (npages);
+	if (pages == NULL)
+	{
+		return;
+	}
+	__lsr_set_writeback_window (64 * 1024);
+	/* the small parts between the checkpoints would skip the window */
+	__lsr_set_checkpoint_bytes (0);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		/* wipe the whole file without truncating it */
+		r = __lsr_fd_truncate (fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		map = (unsigned char *) mmap (NULL, LSR_TEST_BIG_FILE_LENGTH,
+			PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED)
+		{
+			if (mincore (map, LSR_TEST_BIG_FILE_LENGTH, pages) == 0)
+			{
+				for (i = 0; i < npages; i++)
+				{
+					if ((pages[i] & 1) != 0)
+					{
+						ncached++;
+					}
+				}
+			}
+			munmap (map, LSR_TEST_BIG_FILE_LENGTH);
+		}
+		close(fd);
+	}
+	else
+	{
+		r = -1;
+		nwritten = 0;
+	}
+	__lsr_set_writeback_window (0);
+	__lsr_set_checkpoint_bytes (LSR_CHECKPOINT_BYTES);
+	free (pages);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_writeback: file not opened: errno=%d\n", errno);
+	}
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH * npasses);
+	/* the wiped data has been pushed out of the page cache */
+	ck_assert(ncached < npages / 2);
+}
+END_TEST
+#endif
+
+#if (defined HAVE_TIME_H) && (defined HAVE_CLOCK_GETTIME) \
+	&& (defined HAVE_NANOSLEEP) && (defined CLOCK_MONOTONIC)
+/* the time of wiping the whole file, in microseconds */
+static long int timed_wipe(const int fd, int * const r)
+{
+	struct timespec before;
+	struct timespec after;
+
+	clock_gettime (CLOCK_MONOTONIC, &before);
+	*r = __lsr_fd_truncate (fd, 0);
+	clock_gettime (CLOCK_MONOTONIC, &after);
+	return (after.tv_sec - before.tv_sec) * 1000000L
+		+ (after.tv_nsec - before.tv_nsec) / 1000L;
+}
+
+/* the I/O priority of the process, -1 if unknown */
+static long int get_io_priority(void)
+{
+# if (defined HAVE_SYS_SYSCALL_H) && (defined __NR_ioprio_get)
+	return syscall (__NR_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, 0);
+# else
+	return -1;
+# endif
+}
+
+START_TEST(test_ftruncate_rate)
+{
+	int fd;
+	int r_bytes;
+	int r_iops;
+	long int t_bytes;
+	long int t_iops;
+	long int nwrites;
+	long int prio_before;
+	long int prio_after;
+	const unsigned long int npasses = __lsr_get_npasses ();
+	const unsigned long int rate_bytes = 4 * 1024 * 1024;
+	const unsigned long int rate_iops = 100;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_rate: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_method ("clear");
+	__lsr_set_npasses (1);
+	prio_before = get_io_priority ();
+	__lsr_set_io_priority (2);
+	__lsr_set_rate_bytes (rate_bytes);
+	t_bytes = timed_wipe (fd, &r_bytes);
+	__lsr_set_rate_bytes (0);
+	__lsr_set_io_priority (LSR_IO_PRIORITY);
+	prio_after = get_io_priority ();
+	/* small writes, so that there are many of them */
+	__lsr_set_writeback_window (64 * 1024);
+	__lsr_set_rate_iops (rate_iops);
+	nwrites = lsrtest_was_in_write ();
+	t_iops = timed_wipe (fd, &r_iops);
+	nwrites = lsrtest_was_in_write () - nwrites;
+	__lsr_set_rate_iops (0);
+	__lsr_set_writeback_window (0);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	close(fd);
+	ck_assert_int_eq(r_bytes, 0);
+	ck_assert_int_eq(r_iops, 0);
+	/* only a tenth of a second of the budget can be used at once */
+	ck_assert(t_bytes >= (long int) ((LSR_TEST_BIG_FILE_LENGTH - rate_bytes / 10)
+		/ (rate_bytes / 1000)) * 1000L);
+	ck_assert(t_iops >= (nwrites - (long int) rate_iops / 10 - 1)
+		* (1000000L / (long int) rate_iops));
+	/* the priority has been restored after the wipe */
+	ck_assert_int_eq(prio_after, prio_before);
+}
+END_TEST
+#endif
+
+START_TEST(test_ftruncate_pattern_pages)
+{
+	int fd;
+	int r_first;
+	int r_second;
+	size_t left;
+	int periodic;
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_pattern_pages: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_verify (1);
+	/* 0xFF and then zeros, from the pages of the first method */
+	__lsr_set_method ("schneier");
+	__lsr_set_npasses (2);
+	r_first = __lsr_fd_truncate (fd, 0);
+	left = count_unwiped(fd);
+	/* the pages have to be rendered again for another method */
+	__lsr_set_method ("dod");
+	__lsr_set_npasses (2);
+	r_second = __lsr_fd_truncate (fd, 0);
+	periodic = is_periodic(fd);
+	close(fd);
+	__lsr_set_verify (0);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	ck_assert_int_eq(r_first, 0);
+	ck_assert_uint_eq(left, 0);
+	ck_assert_int_eq(r_second, 0);
+	ck_assert_int_eq(periodic, 1);
+}
+END_TEST
+
+#ifndef ALL_PASSES_ZERO
+/* the number of the fixed patterns of the "random" method */
+# define LSRTEST_NPAT_RANDOM 22
+
+START_TEST(test_ftruncate_schedule)
+{
+	/* two rounds of the patterns, with the random passes at the start,
+	   in the middle and at the end */
+	const unsigned long int passes = 2 * LSRTEST_NPAT_RANDOM + 3;
+	const unsigned long int npasses = __lsr_get_npasses ();
+	unsigned char starts[(2 * LSRTEST_NPAT_RANDOM + 4) * LSRTEST_START_LEN];
+	unsigned char * fixed[2 * LSRTEST_NPAT_RANDOM];
+	size_t nstarts;
+	size_t nfixed = 0;
+	size_t pass;
+	size_t i;
+	size_t j;
+	int fd;
+	int r;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_schedule: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_method ("random");
+	__lsr_set_npasses (passes);
+	/* the first bytes of each pass show its pattern */
+	lsrtest_record_starts (starts, sizeof (starts) / LSRTEST_START_LEN);
+	r = __lsr_fd_truncate (fd, 0);
+	nstarts = lsrtest_get_nstarts ();
+	lsrtest_record_starts (NULL, 0);
+	close(fd);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+
+	ck_assert_int_eq(r, 0);
+	ck_assert(nstarts >= passes);
+	for (pass = 0; pass < passes; pass++)
+	{
+		if ((pass != 0) && (pass != passes / 2) && (pass != passes - 1))
+		{
+			fixed[nfixed] = &starts[pass * LSRTEST_START_LEN];
+			nfixed++;
+		}
+	}
+	ck_assert_uint_eq(nfixed, 2 * LSRTEST_NPAT_RANDOM);
+	/* each round must use every pattern once */
+	for (i = 0; i < nfixed; i++)
+	{
+		for (j = i + 1; j < nfixed; j++)
+		{
+			if ((i / LSRTEST_NPAT_RANDOM == j / LSRTEST_NPAT_RANDOM)
+				&& (memcmp (fixed[i], fixed[j], LSRTEST_START_LEN) == 0))
+			{
+				ck_abort_msg("test_ftruncate_schedule: fixed passes %lu and %lu have the same pattern\n",
+					(unsigned long int) i, (unsigned long int) j);
+			}
+		}
+	}
+}
+END_TEST
+#endif
+
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP)
+/* big enough for the wiping buffer to be mapped in a huge page */
+# define LSRTEST_HUGE_FILE_LENGTH (64*1024*1024 + 5)
+
+/* the number of the memory mappings of the process */
+static size_t count_mappings(void)
+{
+	FILE *f;
+	char line[512];
+	size_t lines = 0;
+
+	f = fopen("/proc/self/maps", "r");
+	if (f == NULL)
+	{
+		return 0;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		/* the heap appears when malloc() first needs it and the shared
+		   pattern pages when the first engine needs them, and both stay */
+		if ((strstr(line, "[heap]") == NULL)
+			&& (strstr(line, "libsecrm-patterns") == NULL))
+		{
+			lines++;
+		}
+	}
+	fclose(f);
+	return lines;
+}
+
+/* wipes a huge file with the current engine, returns the number of new mappings */
+static size_t wipe_huge_file(void)
+{
+	unsigned char buf[65536];
+	size_t i;
+	size_t before;
+	size_t after;
+	int fd;
+	int r;
+
+	memset(buf, 'a', sizeof(buf));
+	fd = open(LSR_TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_staging: file not opened: errno=%d\n", errno);
+	}
+	for (i = 0; i < LSRTEST_HUGE_FILE_LENGTH; i += sizeof(buf))
+	{
+		ck_assert_int_eq((int) write(fd, buf, (LSRTEST_HUGE_FILE_LENGTH - i < sizeof(buf))?
+			LSRTEST_HUGE_FILE_LENGTH - i : sizeof(buf)) > 0, 1);
+	}
+	before = count_mappings();
+	r = __lsr_fd_truncate (fd, 0);
+	after = count_mappings();
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(count_unwiped(fd), 0);
+	close(fd);
+	return (after > before)? after - before : 0;
+}
+
+START_TEST(test_ftruncate_staging)
+{
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	LSR_PROLOG_FOR_TEST();
+	/* one pass is enough to get and free the buffers */
+	__lsr_set_method ("clear");
+	/* the first wiping gets the long-lived buffers, if any */
+	wipe_huge_file();
+	/* the buffers in huge pages must be unmapped after each engine */
+	ck_assert_uint_eq(wipe_huge_file(), 0);
+	__lsr_set_splice (1);
+	ck_assert_uint_eq(wipe_huge_file(), 0);
+	__lsr_set_splice (0);
+# ifdef O_DIRECT
+	__lsr_set_direct_io (1);
+	ck_assert_uint_eq(wipe_huge_file(), 0);
+#  ifndef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (0);
+#  endif
+# endif
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	unlink(LSR_TEST_FILENAME);
+}
+END_TEST
+#endif
+
+#define LSRTEST_SHM_FILENAME "/dev/shm/lsrtest_truncate.shm"
+
+START_TEST(test_ftruncate_in_memory)
+{
+	unsigned char buf[4096];
+	size_t i;
+	size_t left;
+	int fd;
+	int r;
+
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSRTEST_SHM_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		/* no tmpfs here */
+		return;
+	}
+	memset(buf, 'a', sizeof(buf));
+	for (i = 0; i < LSR_TEST_BIG_FILE_LENGTH; i += sizeof(buf))
+	{
+		ck_assert_int_eq((int) write(fd, buf, sizeof(buf)), (int) sizeof(buf));
+	}
+	ck_assert_int_eq(__lsr_fd_in_memory (fd), 1);
+	close(fd);
+
+	/* can't be mapped, so the pass is written */
+	fd = open(LSRTEST_SHM_FILENAME, O_WRONLY);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_in_memory: file not opened: errno=%d\n", errno);
+	}
+	/* the filesystem gets full in the middle of the file */
+	lsrtest_set_write_limit (LSR_TEST_BIG_FILE_LENGTH / 2);
+	r = __lsr_fd_truncate (fd, 0);
+	lsrtest_set_write_limit (0);
+	close(fd);
+
+	fd = open(LSRTEST_SHM_FILENAME, O_RDONLY);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_in_memory: file not reopened: errno=%d\n", errno);
+	}
+	left = count_unwiped(fd);
+	close(fd);
+	unlink(LSRTEST_SHM_FILENAME);
+	/* a wipe which has left the old data mustn't be reported as done */
+	if (r == 0)
+	{
+		ck_assert(left < LSR_TEST_BIG_FILE_LENGTH / 16);
+	}
+}
+END_TEST
+
+START_TEST(test_ftruncate_sparse)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	struct stat st;
+	int sparse = 0;
+
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd >= 0)
+	{
+		/* only the last block gets allocated, the rest is a hole */
+		lseek(fd, LSR_TEST_BIG_FILE_LENGTH - 3, SEEK_SET);
+		if (write(fd, "aaa", 3) != 3)
+		{
+			close(fd);
+			ck_abort_msg("test_ftruncate_sparse: file not written: errno=%d\n", errno);
+		}
+		if ((fstat(fd, &st) == 0) && ((off_t)st.st_blocks * 512 < st.st_size))
+		{
+			sparse = 1;
+		}
+		r = ftruncate(fd, 0);
+		nwritten = lsrtest_get_nwritten ();
+		if (r != 0)
+		{
+			ck_abort_msg("test_ftruncate_sparse: file could not have been truncated: errno=%d, r=%d\n", errno, r);
+		}
+		close(fd);
+	}
+	else
+	{
+		ck_abort_msg("test_ftruncate_sparse: file not opened: errno=%d\n", errno);
+	}
+	if (sparse != 0)
+	{
+		/* the hole must not have been filled */
+		ck_assert((nwritten > 0) && (nwritten < LSR_TEST_BIG_FILE_LENGTH));
+	}
+}
+END_TEST
+
+START_TEST(test_ftruncate_sparse_verify)
+{
+	int fd;
+	int r;
+	off_t pos;
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_sparse_verify: file not opened: errno=%d\n", errno);
+	}
+	/* extents which don't start at a multiple of the pattern length */
+	if ((pwrite(fd, "aaaa", 4, 4096) != 4)
+		|| (pwrite(fd, "aaaa", 4, 5 * 4096) != 4)
+		|| (ftruncate(fd, LSR_TEST_BIG_FILE_LENGTH) != 0))
+	{
+		close(fd);
+		ck_abort_msg("test_ftruncate_sparse_verify: file not written: errno=%d\n", errno);
+	}
+	__lsr_set_verify (1);
+	/* the last DoD pass is a fixed pattern, different in each phase */
+	__lsr_set_method ("dod");
+	__lsr_set_npasses (2);
+	lseek(fd, 7, SEEK_SET);
+	r = __lsr_fd_truncate (fd, 0);
+	pos = lseek(fd, 0, SEEK_CUR);
+	close(fd);
+	__lsr_set_verify (0);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	/* the extents have been written in the phase of the whole region */
+	ck_assert_int_eq(r, 0);
+	/* finding the holes mustn't move the offset of the program's descriptor */
+	ck_assert_int_eq(pos, 7);
+}
+END_TEST
+
+START_TEST(test_ftruncate_verify_mismatch)
+{
+	int fd;
+	int r_good;
+	int r_bad;
+	size_t ncorrupted;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_verify_mismatch: file not opened: errno=%d\n", errno);
+	}
+	__lsr_set_verify (1);
+	/* the writes through io_uring or to a direct descriptor can't
+	   be corrupted here */
+	__lsr_set_uring (0);
+#ifdef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (0);
+#endif
+	r_good = __lsr_fd_truncate (fd, 0);
+	/* one block differs from what the last pass has written */
+	lsrtest_set_corrupt_at (LSR_TEST_BIG_FILE_LENGTH / 2);
+	r_bad = __lsr_fd_truncate (fd, 0);
+	ncorrupted = lsrtest_get_ncorrupted ();
+	lsrtest_set_corrupt_at (-1);
+	__lsr_set_uring (1);
+#ifdef LSR_WANT_DIRECT_IO
+	__lsr_set_direct_io (1);
+#endif
+	__lsr_set_verify (0);
+	close(fd);
+	ck_assert_int_eq(r_good, 0);
+	ck_assert(ncorrupted != 0);
+	ck_assert_int_eq(r_bad, -1);
+}
+END_TEST
+
+#if (defined HAVE_SYS_XATTR_H) && (defined HAVE_FSETXATTR) && (defined HAVE_FGETXATTR)
+START_TEST(test_ftruncate_resume)
+{
+	int fd;
+	int r;
+	size_t nwritten;
+	char ckpt[128];
+	unsigned long int pass;
+	/* the wipe was interrupted after this part of its last pass */
+	const unsigned long int done = 100 * 3 * 4096;
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	__lsr_set_checkpoint_bytes (1);
+	pass = __lsr_get_npasses () - 1;
+# ifdef LAST_PASS_ZERO
+	pass++;
+# endif
+	sprintf (ckpt, "1 12345 %lu 0 %lu %lu %lu", __lsr_get_npasses (),
+		(unsigned long int) LSR_TEST_BIG_FILE_LENGTH, pass, done);
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		if (fsetxattr (fd, LSR_CHECKPOINT_XATTR, ckpt, strlen (ckpt), 0) != 0)
+		{
+			/* no extended attributes here */
+			close(fd);
+			return;
+		}
+		r = ftruncate(fd, 0);
+		nwritten = lsrtest_get_nwritten_total ();
+		if (r != 0)
+		{
+			ck_abort_msg("test_ftruncate_resume: file could not have been truncated: errno=%d, r=%d\n", errno, r);
+		}
+		r = (int) fgetxattr (fd, LSR_CHECKPOINT_XATTR, ckpt, sizeof (ckpt));
+		close(fd);
+	}
+	else
+	{
+		ck_abort_msg("test_ftruncate_resume: file not opened: errno=%d\n", errno);
+	}
+	/* the checkpoint is removed after the wipe */
+	ck_assert_int_eq(r, -1);
+	/* only the rest of the last pass has been written */
+	ck_assert_uint_eq(nwritten, LSR_TEST_BIG_FILE_LENGTH - done);
+}
+END_TEST
+#endif
+
+#if (defined HAVE_SIGNAL_H) && (defined F_SETLEASE) && (defined F_GETSIG) \
+	&& (defined F_GETOWN_EX) && (defined SIGRTMIN) && (defined SIGRTMAX)
+/* wipes the file while another program opens it, returns the number of the breaks */
+static size_t broken_wipe(const int fd, int * const r)
+{
+	size_t nbreaks;
+
+	lsrtest_break_lease (LSR_TEST_FILENAME);
+	*r = __lsr_fd_truncate (fd, 0);
+	nbreaks = lsrtest_get_nbreaks ();
+	lsrtest_break_lease (NULL);
+	return nbreaks;
+}
+
+START_TEST(test_ftruncate_lease)
+{
+	int fd;
+	int r_broken;
+	int r_next;
+	int r_blocked;
+	int r_after;
+	size_t nbreaks;
+	size_t nbreaks_blocked;
+	int sig_after;
+	int sig;
+	struct f_owner_ex owner;
+	struct f_owner_ex owner_after;
+	sigset_t breaks;
+	sigset_t old_mask;
+	const unsigned long int npasses = __lsr_get_npasses ();
+
+	lsrtest_prepare_big_file ();
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd < 0)
+	{
+		ck_abort_msg("test_ftruncate_lease: file not opened: errno=%d\n", errno);
+	}
+	/* the program's own settings of the descriptor */
+	fcntl (fd, F_SETSIG, SIGUSR1);
+	owner.type = F_OWNER_PID;
+	owner.pid = getpid ();
+	fcntl (fd, F_SETOWN_EX, &owner);
+	__lsr_set_method ("clear");
+	__lsr_set_npasses (1);
+	/* the break cancels the wipe during which it came, not the next one */
+	nbreaks = broken_wipe (fd, &r_broken);
+	r_next = __lsr_fd_truncate (fd, 0);
+	/* the same when the program blocks the signals of the breaks */
+	sigemptyset (&breaks);
+	for (sig = SIGRTMIN; sig <= SIGRTMAX; sig++)
+	{
+		sigaddset (&breaks, sig);
+	}
+	sigprocmask (SIG_BLOCK, &breaks, &old_mask);
+	nbreaks_blocked = broken_wipe (fd, &r_blocked);
+	r_after = __lsr_fd_truncate (fd, 0);
+	sigprocmask (SIG_SETMASK, &old_mask, NULL);
+	sig_after = fcntl (fd, F_GETSIG);
+	owner_after.type = 0;
+	owner_after.pid = 0;
+	fcntl (fd, F_GETOWN_EX, &owner_after);
+	close(fd);
+	__lsr_set_method (LSRTEST_METHOD);
+	__lsr_set_npasses (npasses);
+	/* (the writes through io_uring don't open the file here) */
+	if (nbreaks != 0)
+	{
+		ck_assert_int_eq(r_broken, -1);
+	}
+	ck_assert_int_eq(r_next, 0);
+	if (nbreaks_blocked != 0)
+	{
+		ck_assert_int_eq(r_blocked, -1);
+	}
+	ck_assert_int_eq(r_after, 0);
+	/* the settings have been restored after the wipes */
+	ck_assert_int_eq(sig_after, SIGUSR1);
+	ck_assert_int_eq(owner_after.type, F_OWNER_PID);
+	ck_assert_int_eq(owner_after.pid, getpid ());
+}
+END_TEST
+#endif
+
+START_TEST(test_ftruncate_keeps_offset)
+{
+	int fd;
+	int r;
+	off_t pos;
+
+	LSR_PROLOG_FOR_TEST();
+
+	fd = open(LSR_TEST_FILENAME, O_RDWR);
+	if (fd >= 0)
+	{
+		lseek(fd, 2, SEEK_SET);
+		r = ftruncate(fd, 1);
+		pos = lseek(fd, 0, SEEK_CUR);
+		if (r != 0)
+		{
+			ck_abort_msg("test_ftruncate_keeps_offset: file could not have been truncated: errno=%d, r=%d\n", errno, r);
+		}
+		close(fd);
+	}
+	else
+	{
+		ck_abort_msg("test_ftruncate_keeps_offset: file not opened: errno=%d\n", errno);
+	}
+	ck_assert_int_eq((int) pos, 2);
+}
+END_TEST
+
 /* ======================================================= */
 
 START_TEST(test_ftruncate64)
@@ -395,6 +1635,58 @@ static Suite * lsr_create_suite(void)
 #ifdef LSR_CAN_USE_PIPE
 	tcase_add_test(tests_falloc_trunc, test_ftruncate_pipe);
 #endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_big);
+#ifdef LSR_WANT_IO_URING
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_uring_random);
+#endif
+#ifdef O_DIRECT
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_direct);
+# ifdef HAVE_SYS_INOTIFY_H
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_direct_opened);
+# endif
+#endif
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MSYNC)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_mmap);
+#endif
+#if (defined HAVE_PTHREAD_H) && (defined HAVE_PTHREAD_CREATE)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_threads);
+#endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_splice);
+#if (defined HAVE_FALLOCATE) && (defined FALLOC_FL_PUNCH_HOLE) && (defined FALLOC_FL_KEEP_SIZE) \
+	&& ((defined LAST_PASS_ZERO) || (defined ALL_PASSES_ZERO))
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_falloc_zero);
+#endif
+#if (defined HAVE_SYS_VFS_H) && (defined HAVE_SYS_IOCTL_H) && (defined HAVE_LINUX_FS_H) \
+	&& (defined FS_IOC_GETFLAGS)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_cow_policy);
+#endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_sync_modes);
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && (defined HAVE_MINCORE)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_writeback);
+#endif
+#if (defined HAVE_TIME_H) && (defined HAVE_CLOCK_GETTIME) \
+	&& (defined HAVE_NANOSLEEP) && (defined CLOCK_MONOTONIC)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_rate);
+#endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_pattern_pages);
+#ifndef ALL_PASSES_ZERO
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_schedule);
+#endif
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_staging);
+#endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_in_memory);
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_sparse);
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_sparse_verify);
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_verify_mismatch);
+#if (defined HAVE_SYS_XATTR_H) && (defined HAVE_FSETXATTR) && (defined HAVE_FGETXATTR)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_resume);
+#endif
+#if (defined HAVE_SIGNAL_H) && (defined F_SETLEASE) && (defined F_GETSIG) \
+	&& (defined F_GETOWN_EX) && (defined SIGRTMIN) && (defined SIGRTMAX)
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_lease);
+#endif
+	tcase_add_test(tests_falloc_trunc, test_ftruncate_keeps_offset);
 
 	tcase_add_test(tests_falloc_trunc, test_ftruncate64);
 	tcase_add_test(tests_falloc_trunc, test_ftruncate64_banned);